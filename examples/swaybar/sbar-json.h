@@ -20,6 +20,7 @@
 #include "sbar.h"
 #include "macros.h"
 #include "util.h"
+#include "sbar-schema.h"
 
 enum sbar_json_surface_type {
 	SBAR_JSON_SURFACE_TYPE_BAR,
@@ -92,6 +93,7 @@ struct sbar_json_block_type_text {
 
 struct sbar_json_block_type_image {
 	char *path;
+	char *data; // base64, used instead of path if set
 	enum sbar_block_type_image_image_type type;
 };
 
@@ -200,10 +202,26 @@ struct sbar_json_connection {
 	sbar_json_seat_create_t seat_create;
 
 	bool state_events;
+	bool pointer_events;
+	bool state_delta;
+	uint32_t state_events_mask; // enum sbar_state_events_mask, 0 for default
 	bool dirty;
 	uint64_t sync;
 };
 
+static void sbar_json_connection_buffer_append(struct sbar_json_connection_buffer *buffer,
+		const char *data, size_t len) {
+	size_t required_size = len + buffer->index + 1;
+	if (required_size > buffer->size) {
+		buffer->size = required_size * 2;
+		buffer->data = realloc(buffer->data, buffer->size);
+	}
+
+	memcpy(&buffer->data[buffer->index], data, len);
+	buffer->index += len;
+	buffer->data[buffer->index++] = '\n';
+}
+
 static void sbar_json_state_set_dirty(struct sbar_json_connection *connection) {
 	if (!connection->dirty) {
 		connection->sync++;
@@ -253,6 +271,7 @@ static MAYBE_UNUSED void sbar_json_block_fini(struct sbar_json_block *block) {
 		break;
 	case SBAR_BLOCK_TYPE_IMAGE:
 		free(block->image.path);
+		free(block->image.data);
 		break;
 	case SBAR_BLOCK_TYPE_COMPOSITE:
 		for (size_t i = 0; i < block->composite.blocks.len; ++i) {
@@ -471,75 +490,64 @@ static json_object *sbar_json_describe_block(struct sbar_json_block *block) {
 	}
 
 	json_object *block_json = json_object_new_object();
-	json_object_object_add_ex(block_json, "id",
-		json_object_new_uint64(block->id), jso_add_flags);
+	struct sbar_schema_block encoded = { 0 };
+	SBAR_SCHEMA_SET(encoded.id, (int64_t)block->id);
 	if (!block->dirty) {
+		sbar_schema_encode(&sbar_schema_block, &encoded, block_json);
 		return block_json;
 	}
 
 	if (block->type != SBAR_BLOCK_TYPE_DEFAULT) {
-		json_object_object_add_ex(block_json, "type",
-			json_object_new_uint64(block->type), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.type, block->type);
 	}
 	if (block->anchor != SBAR_BLOCK_ANCHOR_DEFAULT) {
-		json_object_object_add_ex(block_json, "anchor",
-			json_object_new_uint64(block->anchor), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.anchor, block->anchor);
 	}
 	if (block->color > 0) {
-		json_object_object_add_ex(block_json, "color",
-			json_object_new_uint64(block->color), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.color, block->color);
 	}
 	if (block->min_width != 0) {
-		json_object_object_add_ex(block_json, "min_width",
-			json_object_new_int64(block->min_width), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.min_width, block->min_width);
 	}
 	if (block->max_width != 0) {
-		json_object_object_add_ex(block_json, "max_width",
-			json_object_new_int64(block->max_width), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.max_width, block->max_width);
 	}
 	if (block->min_height != 0) {
-		json_object_object_add_ex(block_json, "min_height",
-			json_object_new_int64(block->min_height), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.min_height, block->min_height);
 	}
 	if (block->max_height != 0) {
-		json_object_object_add_ex(block_json, "max_height",
-			json_object_new_int64(block->max_height), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.max_height, block->max_height);
 	}
 	if (block->content_anchor != SBAR_BLOCK_CONTENT_ANCHOR_DEFAULT) {
-		json_object_object_add_ex(block_json, "content_anchor",
-			json_object_new_uint64(block->content_anchor), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.content_anchor, block->content_anchor);
 	}
 	if (block->content_transform != SBAR_BLOCK_CONTENT_TRANSFORM_DEFAULT) {
-		json_object_object_add_ex(block_json, "content_transform",
-			json_object_new_uint64(block->content_transform), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.content_transform, block->content_transform);
 	}
 	if (block->content_width != 0) {
-		json_object_object_add_ex(block_json, "content_width",
-			json_object_new_int64(block->content_width), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.content_width, block->content_width);
 	}
 	if (block->content_height != 0) {
-		json_object_object_add_ex(block_json, "content_height",
-			json_object_new_int64(block->content_height), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.content_height, block->content_height);
 	}
+	struct sbar_schema_value_json *borders[] = {
+		&encoded.border_left,
+		&encoded.border_right,
+		&encoded.border_bottom,
+		&encoded.border_top,
+	};
 	for (size_t j = 0; j < LENGTH(block->borders); ++j) {
 		if (block->borders[j].width > 0) {
-			json_object *border = json_object_new_object();
-			json_object_object_add_ex(border, "width",
-				json_object_new_int64(block->borders[j].width), jso_add_flags);
-			json_object_object_add_ex(border, "color",
-				json_object_new_int64(block->borders[j].color), jso_add_flags);
-			static const char *keys[] = {
-				"border_left",
-				"border_right",
-				"border_bottom",
-				"border_top",
-			};
-			json_object_object_add_ex(block_json, keys[j], border, jso_add_flags);
+			struct sbar_schema_border border = { 0 };
+			SBAR_SCHEMA_SET(border.width, block->borders[j].width);
+			SBAR_SCHEMA_SET(border.color, block->borders[j].color);
+			json_object *border_json = json_object_new_object();
+			sbar_schema_encode(&sbar_schema_border, &border, border_json);
+			SBAR_SCHEMA_SET(*borders[j], border_json);
 		}
 	}
 	if (!block->render) {
-		json_object_object_add_ex(block_json, "render",
-			json_object_new_boolean(block->render), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.render, block->render);
 	}
 	switch (block->type) {
 	case SBAR_BLOCK_TYPE_DEFAULT:
@@ -547,33 +555,32 @@ static json_object *sbar_json_describe_block(struct sbar_json_block *block) {
 		break;
 	case SBAR_BLOCK_TYPE_TEXT:
 		assert(block->text.text != NULL);
-		json_object_object_add_ex(block_json, "text",
-			json_object_new_string(block->text.text), jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.text, block->text.text);
 		if (block->text.font_names.len > 0) {
 			json_object *font_names_array = json_object_new_array_ext(
 				(int)block->text.font_names.len);
-			json_object_object_add_ex(block_json, "font_names", font_names_array, jso_add_flags);
 			for (size_t j = 0; j < block->text.font_names.len; ++j) {
 				json_object_array_add(font_names_array,
 					json_object_new_string(block->text.font_names.items[j]));
 			}
+			SBAR_SCHEMA_SET(encoded.font_names, font_names_array);
 		}
 		if (block->text.font_attributes) {
-			json_object_object_add_ex(block_json, "font_attributes",
-				json_object_new_string(block->text.font_attributes), jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.font_attributes, block->text.font_attributes);
 		}
 		if (block->text.color != 0xFFFFFFFF) {
-			json_object_object_add_ex(block_json, "text_color",
-				json_object_new_uint64(block->text.color), jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.text_color, block->text.color);
 		}
 		break;
 	case SBAR_BLOCK_TYPE_IMAGE:
-		assert(block->image.path != NULL);
-		json_object_object_add_ex(block_json, "path",
-			json_object_new_string(block->image.path), jso_add_flags);
+		assert((block->image.path != NULL) || (block->image.data != NULL));
+		if (block->image.data) {
+			SBAR_SCHEMA_SET(encoded.data, block->image.data);
+		} else {
+			SBAR_SCHEMA_SET(encoded.path, block->image.path);
+		}
 		if (block->image.type != SBAR_BLOCK_TYPE_DEFAULT) {
-			json_object_object_add_ex(block_json, "image_type",
-				json_object_new_uint64(block->image.type), jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.image_type, block->image.type);
 		}
 		break;
 	case SBAR_BLOCK_TYPE_COMPOSITE: {
@@ -584,13 +591,13 @@ static json_object *sbar_json_describe_block(struct sbar_json_block *block) {
 			json_object *b_json = sbar_json_describe_block(b);
 			json_object_array_add(blocks_array, b_json);
 			if ((b->x >= 0) && (b->y >= 0)) {
-				json_object_object_add_ex(b_json, "x",
-					json_object_new_int64(b->x), jso_add_flags);
-				json_object_object_add_ex(b_json, "y",
-					json_object_new_int64(b->y), jso_add_flags);
+				struct sbar_schema_block position = { 0 };
+				SBAR_SCHEMA_SET(position.x, b->x);
+				SBAR_SCHEMA_SET(position.y, b->y);
+				sbar_schema_encode(&sbar_schema_block, &position, b_json);
 			}
 		}
-		json_object_object_add_ex(block_json, "blocks", blocks_array, jso_add_flags);
+		SBAR_SCHEMA_SET(encoded.blocks, blocks_array);
 		break;
 	}
 	default:
@@ -598,6 +605,7 @@ static json_object *sbar_json_describe_block(struct sbar_json_block *block) {
 		break;
 	}
 
+	sbar_schema_encode(&sbar_schema_block, &encoded, block_json);
 	block->dirty = false;
 	return block_json;
 }
@@ -612,54 +620,48 @@ static void sbar_json_describe_surfaces(list_t *surfaces, json_object *dest_arra
 		switch (surface->type) {
 		case SBAR_JSON_SURFACE_TYPE_BAR: {
 			struct sbar_json_surface_type_bar *bar = &surface->bar;
+			struct sbar_schema_bar encoded = { 0 };
 			if (bar->exclusive_zone >= 0) {
-				json_object_object_add_ex(surface_json, "exclusive_zone",
-					json_object_new_int64(bar->exclusive_zone), jso_add_flags);
+				SBAR_SCHEMA_SET(encoded.exclusive_zone, bar->exclusive_zone);
 			}
 			if (bar->anchor != SBAR_BAR_ANCHOR_DEFAULT) {
-				json_object_object_add_ex(surface_json, "anchor",
-					json_object_new_uint64(bar->anchor), jso_add_flags);
+				SBAR_SCHEMA_SET(encoded.anchor, bar->anchor);
 			}
 			if (bar->layer != SBAR_BAR_LAYER_DEFAULT) {
-				json_object_object_add_ex(surface_json, "layer",
-					json_object_new_uint64(bar->layer), jso_add_flags);
+				SBAR_SCHEMA_SET(encoded.layer, bar->layer);
 			}
+			struct sbar_schema_value_int *margins[] = {
+				&encoded.margin_top,
+				&encoded.margin_right,
+				&encoded.margin_bottom,
+				&encoded.margin_left,
+			};
 			for (size_t i = 0; i < LENGTH(bar->margins); ++i) {
 				if (bar->margins[i] >= 0) {
-					static const char *keys[] = {
-						"margin_top",
-						"margin_right",
-						"margin_bottom",
-						"margin_left",
-					};
-					json_object_object_add_ex(surface_json, keys[i],
-						json_object_new_int64(bar->margins[i]), jso_add_flags);
+					SBAR_SCHEMA_SET(*margins[i], bar->margins[i]);
 				}
 			}
+			sbar_schema_encode(&sbar_schema_bar, &encoded, surface_json);
 			break;
 		}
 		case SBAR_JSON_SURFACE_TYPE_POPUP: {
 			struct sbar_json_surface_type_popup *popup = &surface->popup;
-			json_object_object_add_ex(surface_json, "x",
-				json_object_new_int64(popup->x), jso_add_flags);
-			json_object_object_add_ex(surface_json, "y",
-				json_object_new_int64(popup->y), jso_add_flags);
+			struct sbar_schema_popup encoded = { 0 };
+			SBAR_SCHEMA_SET(encoded.x, popup->x);
+			SBAR_SCHEMA_SET(encoded.y, popup->y);
 			if (!popup->vertical) {
-				json_object_object_add_ex(surface_json, "vertical",
-					json_object_new_boolean(popup->vertical), jso_add_flags);
+				SBAR_SCHEMA_SET(encoded.vertical, popup->vertical);
 			}
 			if (popup->gravity != SBAR_POPUP_GRAVITY_DEFAULT) {
-				json_object_object_add_ex(surface_json, "gravity",
-					json_object_new_uint64(popup->gravity), jso_add_flags);
+				SBAR_SCHEMA_SET(encoded.gravity, popup->gravity);
 			}
 			if (popup->constraint_adjustment != 0) {
-				json_object_object_add_ex(surface_json, "constraint_adjustment",
-					json_object_new_uint64(popup->constraint_adjustment), jso_add_flags);
+				SBAR_SCHEMA_SET(encoded.constraint_adjustment, popup->constraint_adjustment);
 			}
 			if (popup->grab) {
-				json_object_object_add_ex(surface_json, "grab",
-					json_object_new_uint64(popup->grab_serial), jso_add_flags);
+				SBAR_SCHEMA_SET(encoded.grab, popup->grab_serial);
 			}
+			sbar_schema_encode(&sbar_schema_popup, &encoded, surface_json);
 			break;
 		}
 		default:
@@ -667,25 +669,20 @@ static void sbar_json_describe_surfaces(list_t *surfaces, json_object *dest_arra
 			break;
 		}
 
-		json_object_object_add_ex(surface_json, "userdata",
-			json_object_new_uint64(surface->id), jso_add_flags);
+		struct sbar_schema_surface encoded = { 0 };
+		SBAR_SCHEMA_SET(encoded.userdata, json_object_new_uint64(surface->id));
 		if (surface->wanted_width > 0) {
-			json_object_object_add_ex(surface_json, "width",
-				json_object_new_int64(surface->wanted_width), jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.width, surface->wanted_width);
 		}
 		if (surface->wanted_height > 0) {
-			json_object_object_add_ex(surface_json, "height",
-				json_object_new_int64(surface->wanted_height), jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.height, surface->wanted_height);
 		}
 		if (surface->cursor_shape != SBAR_SURFACE_CURSOR_SHAPE_DEFAULT_) {
-			json_object_object_add_ex(surface_json, "cursor_shape",
-				json_object_new_uint64(surface->cursor_shape), jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.cursor_shape, surface->cursor_shape);
 		}
 		if (surface->input_regions.len > 0) {
 			json_object *input_regions_array =
 				json_object_new_array_ext((int)surface->input_regions.len);
-			json_object_object_add_ex(surface_json, "input_regions",
-				input_regions_array, jso_add_flags);
 			for (size_t i = 0; i < surface->input_regions.len; ++i) {
 				struct sbar_json_box *region =
 					&((struct sbar_json_box *)surface->input_regions.items)[i];
@@ -708,24 +705,25 @@ static void sbar_json_describe_surfaces(list_t *surfaces, json_object *dest_arra
 				}
 				json_object_array_add(input_regions_array, region_json);
 			}
+			SBAR_SCHEMA_SET(encoded.input_regions, input_regions_array);
 		}
 		if (!surface->render) {
-			json_object_object_add_ex(surface_json, "render",
-				json_object_new_boolean(surface->render), jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.render, surface->render);
 		}
 		size_t popups_len = list_length(&surface->popups);
 		if (popups_len > 0) {
 			json_object *popups_array = json_object_new_array_ext((int)popups_len);
 			sbar_json_describe_surfaces(&surface->popups, popups_array, SBAR_JSON_SURFACE_TYPE_POPUP);
-			json_object_object_add_ex(surface_json, "popups", popups_array, jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.popups, popups_array);
 		}
 		if (surface->blocks.len > 0) {
 			json_object *blocks_array = json_object_new_array_ext((int)surface->blocks.len);
 			for (size_t i = 0; i < surface->blocks.len; ++i) {
 				json_object_array_add(blocks_array, sbar_json_describe_block(surface->blocks.items[i]));
 			}
-			json_object_object_add_ex(surface_json, "blocks", blocks_array, jso_add_flags);
+			SBAR_SCHEMA_SET(encoded.blocks, blocks_array);
 		}
+		sbar_schema_encode(&sbar_schema_surface, &encoded, surface_json);
 
 		json_object_array_add(dest_array, surface_json);
 	}
@@ -760,6 +758,18 @@ static MAYBE_UNUSED int sbar_json_flush(struct sbar_json_connection *connection)
 			json_object_new_uint64(connection->sync), jso_add_flags);
 		json_object_object_add_ex(state, "state_events",
 			json_object_new_boolean(connection->state_events), jso_add_flags);
+		if (connection->state_events_mask != 0) {
+			json_object_object_add_ex(state, "state_events_mask",
+				json_object_new_uint64(connection->state_events_mask), jso_add_flags);
+		}
+		if (connection->pointer_events) {
+			json_object_object_add_ex(state, "pointer_events",
+				json_object_new_boolean(connection->pointer_events), jso_add_flags);
+		}
+		if (connection->state_delta) {
+			json_object_object_add_ex(state, "state_delta",
+				json_object_new_boolean(connection->state_delta), jso_add_flags);
+		}
 
 		sbar_json_describe_outputs(connection, state);
 
@@ -767,16 +777,8 @@ static MAYBE_UNUSED int sbar_json_flush(struct sbar_json_connection *connection)
 		const char *state_str = json_object_to_json_string_length(
 			state, JSON_C_TO_STRING_PLAIN, &state_str_len);
 
-		struct sbar_json_connection_buffer *write_buffer = &connection->write_buffer;
-		size_t required_size = state_str_len + write_buffer->index + 1;
-		if (required_size > write_buffer->size) {
-			write_buffer->size = required_size * 2;
-			write_buffer->data = realloc(write_buffer->data, write_buffer->size);
-		}
-
-		memcpy(&write_buffer->data[write_buffer->index], state_str, state_str_len);
-		write_buffer->index += state_str_len;
-		write_buffer->data[write_buffer->index++] = '\n';
+		sbar_json_connection_buffer_append(&connection->write_buffer,
+			state_str, state_str_len);
 
 		json_object_put(state);
 		connection->dirty = false;
@@ -838,41 +840,52 @@ static void sbar_json_parse_sbar_surfaces(struct sbar_json_connection *connectio
 			surface->destroy(surface);
 			continue;
 		}
+		if (json_object_is_type(surface_json, json_type_boolean)) {
+			continue; // unchanged, delta
+		}
 
+		// every key is optional in delta or with state_events_mask
 		json_object *width, *height, *scale, *blocks_array, *popups;
 		json_object_object_get_ex(surface_json, "width", &width);
-		json_object_object_get_ex(surface_json, "height", &height);
-		json_object_object_get_ex(surface_json, "scale", &scale);
 		json_object_object_get_ex(surface_json, "blocks", &blocks_array);
 		json_object_object_get_ex(surface_json, "popups", &popups);
 
-		assert(json_object_is_type(width, json_type_int));
-		assert(json_object_is_type(height, json_type_int));
-		assert(json_object_is_type(scale, json_type_int));
-		assert(json_object_is_type(blocks_array, json_type_array));
-
-		surface->width = json_object_get_int(width);
-		surface->height = json_object_get_int(height);
-		surface->scale = json_object_get_int(scale);
-
-		assert(surface->blocks.len == json_object_array_length(blocks_array));
-		surface->block_hotspots.len = 0;
-		for (size_t j = 0; j < surface->blocks.len; ++j) {
-			json_object *block = json_object_array_get_idx(blocks_array, j);
-			if (block) {
-				struct sbar_json_box hotspot = sbar_json_parse_sbar_block(block);
-				array_add(&surface->block_hotspots, &hotspot);
-			} else {
-				log_debug("WARNING: block is NULL");
-				array_add(&surface->block_hotspots, &(struct sbar_json_box){ 0 });
+		if (width) {
+			json_object_object_get_ex(surface_json, "height", &height);
+			json_object_object_get_ex(surface_json, "scale", &scale);
+
+			assert(json_object_is_type(width, json_type_int));
+			assert(json_object_is_type(height, json_type_int));
+			assert(json_object_is_type(scale, json_type_int));
+
+			surface->width = json_object_get_int(width);
+			surface->height = json_object_get_int(height);
+			surface->scale = json_object_get_int(scale);
+		}
+
+		if (blocks_array) {
+			assert(json_object_is_type(blocks_array, json_type_array));
+			assert(surface->blocks.len == json_object_array_length(blocks_array));
+			surface->block_hotspots.len = 0;
+			for (size_t j = 0; j < surface->blocks.len; ++j) {
+				json_object *block = json_object_array_get_idx(blocks_array, j);
+				if (block) {
+					struct sbar_json_box hotspot = sbar_json_parse_sbar_block(block);
+					array_add(&surface->block_hotspots, &hotspot);
+				} else {
+					log_debug("WARNING: block is NULL");
+					array_add(&surface->block_hotspots, &(struct sbar_json_box){ 0 });
+				}
 			}
 		}
 
-		if (surface->updated_callback) {
+		if ((width || blocks_array) && surface->updated_callback) {
 			surface->updated_callback(surface);
 		}
 
-		sbar_json_parse_sbar_surfaces(connection, popups, &surface->popups);
+		if (popups) {
+			sbar_json_parse_sbar_surfaces(connection, popups, &surface->popups);
+		}
 	}
 }
 
@@ -928,24 +941,28 @@ static void sbar_json_parse_sbar_outputs(struct sbar_json_connection *connection
 		list_for_each(output, &connection->outputs, link) {
 			json_object *output_json = json_object_array_get_idx(outputs_array, i++);
 			json_object *width, *height, *scale, *transform, *bars;
-			json_object_object_get_ex(output_json, "width", &width);
-			json_object_object_get_ex(output_json, "height", &height);
-			json_object_object_get_ex(output_json, "scale", &scale);
-			json_object_object_get_ex(output_json, "transform", &transform);
 			json_object_object_get_ex(output_json, "bars", &bars);
+			// missing if output did not change, delta
+			if (json_object_object_get_ex(output_json, "width", &width)) {
+				json_object_object_get_ex(output_json, "height", &height);
+				json_object_object_get_ex(output_json, "scale", &scale);
+				json_object_object_get_ex(output_json, "transform", &transform);
+
+				assert(json_object_is_type(width, json_type_int));
+				assert(json_object_is_type(height, json_type_int));
+				assert(json_object_is_type(scale, json_type_int));
+				assert(json_object_is_type(transform, json_type_int));
+
+				// ? TODO: upd callback
+				output->width = json_object_get_int(width);
+				output->height = json_object_get_int(height);
+				output->scale = json_object_get_int(scale);
+				output->transform = (uint32_t)json_object_get_int(transform);
+			}
 
-			assert(json_object_is_type(width, json_type_int));
-			assert(json_object_is_type(height, json_type_int));
-			assert(json_object_is_type(scale, json_type_int));
-			assert(json_object_is_type(transform, json_type_int));
-
-			// ? TODO: upd callback
-			output->width = json_object_get_int(width);
-			output->height = json_object_get_int(height);
-			output->scale = json_object_get_int(scale);
-			output->transform = (uint32_t)json_object_get_int(transform);
-
-			sbar_json_parse_sbar_surfaces(connection, bars, &output->bars);
+			if (bars) {
+				sbar_json_parse_sbar_surfaces(connection, bars, &output->bars);
+			}
 		}
 	}
 }
@@ -980,6 +997,74 @@ static ATTRIB_PURE struct sbar_json_surface *sbar_json_find_surface(struct sbar_
 	return NULL;
 }
 
+static void sbar_json_pointer_process(struct sbar_json_connection *connection,
+		struct sbar_json_pointer *pointer, json_object *surface_userdata,
+		json_object *x_json, json_object *y_json, json_object *button, json_object *scroll) {
+	if (surface_userdata) {
+		assert(json_object_is_type(surface_userdata, json_type_int));
+		assert(json_object_is_type(x_json, json_type_double));
+		assert(json_object_is_type(y_json, json_type_double));
+
+		sbar_json_pointer_motion_callback_t motion_callback = NULL;
+		uint64_t focused_surface_id = json_object_get_uint64(surface_userdata);
+		if ((pointer->focused_surface == NULL) || (pointer->focused_surface->id != focused_surface_id)) {
+			if (pointer->focused_surface && pointer->focused_surface->pointer_leave_callback) {
+				pointer->focused_surface->pointer_leave_callback(pointer->focused_surface);
+			}
+			pointer->focused_surface = sbar_json_find_surface(connection, focused_surface_id);
+			assert(pointer->focused_surface != NULL);
+			assert(pointer->focused_surface->blocks.len == pointer->focused_surface->block_hotspots.len);
+			if (pointer->focused_surface) {
+				motion_callback = pointer->focused_surface->pointer_enter_callback;
+			}
+		} else {
+			motion_callback = pointer->focused_surface->pointer_motion_callback;
+		}
+
+		double x = json_object_get_double(x_json) * pointer->focused_surface->scale;
+		double y = json_object_get_double(y_json) * pointer->focused_surface->scale;
+		if (motion_callback) { // ? TODO: store prev x, y
+			motion_callback(pointer->focused_surface, x, y);
+		}
+
+		if (pointer->focused_surface) {
+			if (button && pointer->focused_surface->pointer_button_callback) {
+				json_object *code, *state, *serial;
+				json_object_object_get_ex(button, "code", &code);
+				json_object_object_get_ex(button, "state", &state);
+				json_object_object_get_ex(button, "serial", &serial);
+
+				assert(json_object_is_type(code, json_type_int));
+				assert(json_object_is_type(state, json_type_int));
+				assert(json_object_is_type(serial, json_type_int));
+
+				pointer->focused_surface->pointer_button_callback(pointer->focused_surface,
+					(uint32_t)json_object_get_int(code),
+					(uint32_t)json_object_get_int(state),
+					(uint32_t)json_object_get_int(serial), x, y);
+			} else if (scroll && pointer->focused_surface->pointer_scroll_callback) {
+				json_object *axis, *vector_length;
+				json_object_object_get_ex(scroll, "axis", &axis);
+				json_object_object_get_ex(scroll, "vector_length", &vector_length);
+
+				assert(json_object_is_type(axis, json_type_int));
+				assert(json_object_is_type(vector_length, json_type_double));
+
+				pointer->focused_surface->pointer_scroll_callback(pointer->focused_surface,
+					(uint32_t)json_object_get_int(axis),
+					json_object_get_double(vector_length),
+					x, y);
+			}
+		}
+
+	} else if (pointer->focused_surface) {
+		if (pointer->focused_surface->pointer_leave_callback) {
+			pointer->focused_surface->pointer_leave_callback(pointer->focused_surface);
+		}
+		pointer->focused_surface = NULL;
+	}
+}
+
 static void sbar_json_parse_sbar_pointer(struct sbar_json_connection *connection,
 		struct sbar_json_seat *seat, json_object *pointer_json) {
 	if (pointer_json) {
@@ -988,85 +1073,59 @@ static void sbar_json_parse_sbar_pointer(struct sbar_json_connection *connection
 			seat->pointer->focused_surface = NULL;
 		}
 
-		struct sbar_json_pointer *pointer = seat->pointer;
-		json_object *focus;
+		if (connection->pointer_events) {
+			return; // see sbar_json_parse_sbar_pointer_event
+		}
+
+		json_object *focus, *surface_userdata = NULL, *x_json = NULL, *y_json = NULL, *button, *scroll;
 		json_object_object_get_ex(pointer_json, "focus", &focus);
 		if (focus) {
-			json_object *surface_userdata, *x_json, *y_json;
 			json_object_object_get_ex(focus, "surface_userdata", &surface_userdata);
 			json_object_object_get_ex(focus, "x", &x_json);
 			json_object_object_get_ex(focus, "y", &y_json);
+		}
+		json_object_object_get_ex(pointer_json, "button", &button);
+		json_object_object_get_ex(pointer_json, "scroll", &scroll);
 
-			assert(json_object_is_type(surface_userdata, json_type_int));
-			assert(json_object_is_type(x_json, json_type_double));
-			assert(json_object_is_type(y_json, json_type_double));
-
-			sbar_json_pointer_motion_callback_t motion_callback = NULL;
-			uint64_t focused_surface_id = json_object_get_uint64(surface_userdata);
-			if ((pointer->focused_surface == NULL) || (pointer->focused_surface->id != focused_surface_id)) {
-				if (pointer->focused_surface && pointer->focused_surface->pointer_leave_callback) {
-					pointer->focused_surface->pointer_leave_callback(pointer->focused_surface);
-				}
-				pointer->focused_surface = sbar_json_find_surface(connection, focused_surface_id);
-				assert(pointer->focused_surface != NULL);
-				assert(pointer->focused_surface->blocks.len == pointer->focused_surface->block_hotspots.len);
-				if (pointer->focused_surface) {
-					motion_callback = pointer->focused_surface->pointer_enter_callback;
-				}
-			} else {
-				motion_callback = pointer->focused_surface->pointer_motion_callback;
-			}
+		sbar_json_pointer_process(connection, seat->pointer,
+			surface_userdata, x_json, y_json, button, scroll);
+	} else if (seat->pointer) {
+		free(seat->pointer);
+		seat->pointer = NULL;
+	}
+}
 
-			double x = json_object_get_double(x_json) * pointer->focused_surface->scale;
-			double y = json_object_get_double(y_json) * pointer->focused_surface->scale;
-			if (motion_callback) { // ? TODO: store prev x, y
-				motion_callback(pointer->focused_surface, x, y);
-			}
+static void sbar_json_parse_sbar_pointer_event(struct sbar_json_connection *connection,
+		json_object *pointer_json) {
+	assert(json_object_is_type(pointer_json, json_type_object));
 
-			if (pointer->focused_surface) {
-				json_object *button, *scroll;
-				json_object_object_get_ex(pointer_json, "button", &button);
-				json_object_object_get_ex(pointer_json, "scroll", &scroll);
-				if (button && pointer->focused_surface->pointer_button_callback) {
-					json_object *code, *state, *serial;
-					json_object_object_get_ex(button, "code", &code);
-					json_object_object_get_ex(button, "state", &state);
-					json_object_object_get_ex(button, "serial", &serial);
-
-					assert(json_object_is_type(code, json_type_int));
-					assert(json_object_is_type(state, json_type_int));
-					assert(json_object_is_type(serial, json_type_int));
-
-					pointer->focused_surface->pointer_button_callback(pointer->focused_surface,
-						(uint32_t)json_object_get_int(code),
-						(uint32_t)json_object_get_int(state),
-						(uint32_t)json_object_get_int(serial), x, y);
-				} else if (scroll && pointer->focused_surface->pointer_scroll_callback) {
-					json_object *axis, *vector_length;
-					json_object_object_get_ex(scroll, "axis", &axis);
-					json_object_object_get_ex(scroll, "vector_length", &vector_length);
-
-					assert(json_object_is_type(axis, json_type_int));
-					assert(json_object_is_type(vector_length, json_type_double));
-
-					pointer->focused_surface->pointer_scroll_callback(pointer->focused_surface,
-						(uint32_t)json_object_get_int(axis),
-						json_object_get_double(vector_length),
-						x, y);
-				}
-			}
+	json_object *seat_name;
+	json_object_object_get_ex(pointer_json, "seat", &seat_name);
+	assert(json_object_is_type(seat_name, json_type_string));
 
-		} else if (pointer->focused_surface) {
-			if (pointer->focused_surface->pointer_leave_callback) {
-				pointer->focused_surface->pointer_leave_callback(pointer->focused_surface);
+	struct sbar_json_seat *seat = NULL;
+	{
+		struct sbar_json_seat *seat_;
+		list_for_each(seat_, &connection->seats, link) {
+			if (strcmp(seat_->name, json_object_get_string(seat_name)) == 0) {
+				seat = seat_;
+				break;
 			}
-			pointer->focused_surface = NULL;
 		}
-
-	} else if (seat->pointer) {
-		free(seat->pointer);
-		seat->pointer = NULL;
 	}
+	if ((seat == NULL) || (seat->pointer == NULL)) {
+		return; // seats are updated in state events
+	}
+
+	json_object *surface_userdata, *x_json, *y_json, *button, *scroll;
+	json_object_object_get_ex(pointer_json, "surface_userdata", &surface_userdata);
+	json_object_object_get_ex(pointer_json, "x", &x_json);
+	json_object_object_get_ex(pointer_json, "y", &y_json);
+	json_object_object_get_ex(pointer_json, "button", &button);
+	json_object_object_get_ex(pointer_json, "scroll", &scroll);
+
+	sbar_json_pointer_process(connection, seat->pointer,
+		surface_userdata, x_json, y_json, button, scroll);
 }
 
 static void sbar_json_parse_sbar_seats(struct sbar_json_connection *connection,
@@ -1122,8 +1181,10 @@ static void sbar_json_parse_sbar_seats(struct sbar_json_connection *connection,
 		list_for_each(seat, &connection->seats, link) {
 			json_object *seat_json = json_object_array_get_idx(seats_array, i++);
 			json_object *pointer;
-			json_object_object_get_ex(seat_json, "pointer", &pointer);
-			sbar_json_parse_sbar_pointer(connection, seat, pointer);
+			// missing if seat did not change, delta
+			if (json_object_object_get_ex(seat_json, "pointer", &pointer)) {
+				sbar_json_parse_sbar_pointer(connection, seat, pointer);
+			}
 		}
 	}
 }
@@ -1140,12 +1201,34 @@ static void sbar_json_parse_sbar_state(struct sbar_json_connection *connection,
 		goto cleanup;
 	}
 
+	json_object *pointer;
+	if (json_object_object_get_ex(state, "pointer", &pointer)) {
+		sbar_json_parse_sbar_pointer_event(connection, pointer);
+		goto cleanup;
+	}
+
 	json_object *outputs, *seats;
 	json_object_object_get_ex(state, "outputs", &outputs);
 	json_object_object_get_ex(state, "seats", &seats);
 
-	sbar_json_parse_sbar_outputs(connection, outputs);
-	sbar_json_parse_sbar_seats(connection, seats);
+	// missing with state_events_mask
+	if (outputs) {
+		sbar_json_parse_sbar_outputs(connection, outputs);
+	}
+	if (seats) {
+		sbar_json_parse_sbar_seats(connection, seats);
+	}
+
+	json_object *generation;
+	if (connection->state_delta
+			&& json_object_object_get_ex(state, "generation", &generation)) {
+		assert(json_object_is_type(generation, json_type_int));
+		char ack[64];
+		int ack_len = snprintf(ack, sizeof(ack), "{\"state_ack\":%llu}",
+			(unsigned long long)json_object_get_uint64(generation));
+		sbar_json_connection_buffer_append(&connection->write_buffer,
+			ack, (size_t)ack_len);
+	}
 
 cleanup:
 	json_object_put(state);
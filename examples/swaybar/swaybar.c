@@ -700,28 +700,19 @@ static struct sbar_json_seat *seat_create_sbar_json(struct sbar_json_connection
 	return seat;
 }
 
-static char *bytes_to_shm(void *bytes, size_t nbytes) {
-	char *path = strdup("/dev/shm/sbar-XXXXXX");
-	int fd = mkstemp(path);
-	if (fd == -1) {
-		goto error_1;
+// sent inline, sbar uses premultiplied pixmaps in place only from sealed memfds
+static char *sni_item_pixmap_to_base64(struct sni_item_pixmap *pixmap) {
+	size_t nbytes = (size_t)pixmap->width * (size_t)pixmap->height * 4
+		+ sizeof(struct sni_item_pixmap);
+	struct sni_item_pixmap *premultiplied = malloc(nbytes);
+	memcpy(premultiplied, pixmap, nbytes);
+	for (size_t i = 0; i < ((size_t)pixmap->width * (size_t)pixmap->height); ++i) {
+		premultiply_alpha_argb32(&premultiplied->pixels[i]);
 	}
 
-	size_t total = 0;
-	while (total < nbytes) {
-		ssize_t written_bytes = write(fd, (char *)bytes + total, nbytes - total);
-		if (written_bytes == -1) {
-			goto error_2;
-		}
-		total += (size_t)written_bytes;
-	}
-
-	return path;
-error_2:
-	close(fd);
-error_1:
-	free(path);
-	return NULL;
+	char *data = base64_encode(premultiplied, nbytes);
+	free(premultiplied);
+	return data;
 }
 
 static struct block *tray_dbusmenu_menu_item_get_text_block(
@@ -750,16 +741,6 @@ static struct block *tray_dbusmenu_menu_item_get_text_block(
 	return block;
 }
 
-static void block_remove_image_path_and_destroy(struct block *block) {
-	if (block == NULL) {
-		return;
-	}
-
-	remove(block->_.image.path);
-
-	block_destroy(block);
-}
-
 static struct popup *tray_dbusmenu_menu_popup_create(struct sni_dbusmenu_menu *menu,
 		int32_t x, int32_t y, uint32_t grab_serial);
 
@@ -897,21 +878,18 @@ static void tray_dbusmenu_menu_popup_update(struct sni_dbusmenu_menu *menu, stru
 
 #if HAVE_PNG
 			if (menu_item->icon_data.nbytes > 0) {
-				char *path;
-				if ((path = bytes_to_shm(menu_item->icon_data.bytes, menu_item->icon_data.nbytes))) {
-					struct block *icon = block_create(block_remove_image_path_and_destroy);
-					icon->_.content_anchor = SBAR_BLOCK_CONTENT_ANCHOR_CENTER_CENTER;
-					for (size_t j = 0; j < LENGTH(icon->_.borders); ++j) {
-						icon->_.borders[j].width = config.tray_padding;
-					}
-					icon->_.type = SBAR_BLOCK_TYPE_IMAGE;
-					icon->_.image.path = path;
-					icon->_.image.type = SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PNG;
-					icon->_.content_width = SBAR_BLOCK_SIZE_OFFSET(SBAR_BLOCK_SIZE_PREV_BLOCK_HEIGHT_MINUS, config.tray_padding * 2);
-					icon->_.content_height = SBAR_BLOCK_SIZE_OFFSET(SBAR_BLOCK_SIZE_PREV_BLOCK_HEIGHT_MINUS, config.tray_padding * 2);
-
-					ptr_array_add(&block->_.composite.blocks, icon);
+				struct block *icon = block_create(block_destroy);
+				icon->_.content_anchor = SBAR_BLOCK_CONTENT_ANCHOR_CENTER_CENTER;
+				for (size_t j = 0; j < LENGTH(icon->_.borders); ++j) {
+					icon->_.borders[j].width = config.tray_padding;
 				}
+				icon->_.type = SBAR_BLOCK_TYPE_IMAGE;
+				icon->_.image.data = base64_encode(menu_item->icon_data.bytes, menu_item->icon_data.nbytes);
+				icon->_.image.type = SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PNG;
+				icon->_.content_width = SBAR_BLOCK_SIZE_OFFSET(SBAR_BLOCK_SIZE_PREV_BLOCK_HEIGHT_MINUS, config.tray_padding * 2);
+				icon->_.content_height = SBAR_BLOCK_SIZE_OFFSET(SBAR_BLOCK_SIZE_PREV_BLOCK_HEIGHT_MINUS, config.tray_padding * 2);
+
+				ptr_array_add(&block->_.composite.blocks, icon);
 			}
 #endif // HAVE_PNG
 
@@ -1051,15 +1029,11 @@ static struct popup *tray_dbusmenu_menu_popup_create(struct sni_dbusmenu_menu *m
 
 static void tray_item_update(struct tray_item *tray_item) {
 	struct block *block = tray_item->block;
-	if ((block->_.type == SBAR_BLOCK_TYPE_IMAGE)
-			&& (block->_.image.type == SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP)) {
-		remove(block->_.image.path);
-	}
 	free(block->_.image.path);
+	free(block->_.image.data);
 	memset(&block->_.image, 0, sizeof(struct sbar_json_block_type_image));
 
 	block->_.type = SBAR_BLOCK_TYPE_SPACER;
-	block->destroy = block_destroy;
 	block->_.content_width = SBAR_BLOCK_SIZE_OFFSET(SBAR_BLOCK_SIZE_SURFACE_HEIGHT_MINUS, config.tray_padding * 2);
 	block->_.content_height = SBAR_BLOCK_SIZE_OFFSET(SBAR_BLOCK_SIZE_SURFACE_HEIGHT_MINUS, config.tray_padding * 2);
 
@@ -1110,17 +1084,11 @@ static void tray_item_update(struct tray_item *tray_item) {
 #endif // HAVE_PNG || HAVE_SVG
 
 	if ((block->_.image.path == NULL) && icon_pixmap) {
-		char *path;
-		if ((path = bytes_to_shm(icon_pixmap,
-				(size_t)icon_pixmap->width * (size_t)icon_pixmap->height * 4
-					+ sizeof(struct sni_item_pixmap)))) {
-			block->_.image.path = path;
-			block->_.image.type = SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP;
-			block->destroy = block_remove_image_path_and_destroy;
-		}
+		block->_.image.data = sni_item_pixmap_to_base64(icon_pixmap);
+		block->_.image.type = SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED;
 	}
 
-	if (block->_.image.path) {
+	if (block->_.image.path || block->_.image.data) {
 		block->_.type = SBAR_BLOCK_TYPE_IMAGE;
 	}
 }
@@ -2746,6 +2714,8 @@ static void setup(int argc, char **argv) {
 		abort_(errno, "Failed to initialize sbar: %s", strerror(errno));
 	}
 	sbar->state_events = true;
+	sbar->pointer_events = true;
+	sbar->state_delta = true;
 	sbar_json_state_set_dirty(sbar);
 	pollfds[0].fd = sbar->read_fd;
 
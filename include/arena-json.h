@@ -0,0 +1,572 @@
+#if !defined(ARENA_JSON_H)
+#define ARENA_JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+// JSON parser that allocates the whole tree from an arena_t, so there is nothing
+// to free per value. Tree lives until arena_reset/arena_fini.
+
+enum arena_json_type {
+	ARENA_JSON_TYPE_NULL,
+	ARENA_JSON_TYPE_BOOLEAN,
+	ARENA_JSON_TYPE_INT,
+	ARENA_JSON_TYPE_DOUBLE,
+	ARENA_JSON_TYPE_STRING,
+	ARENA_JSON_TYPE_ARRAY,
+	ARENA_JSON_TYPE_OBJECT,
+};
+
+struct arena_json_member;
+
+struct arena_json {
+	enum arena_json_type type;
+	uint32_t len; // STRING: bytes without NUL, ARRAY: items, OBJECT: members
+	union {
+		bool boolean;
+		int64_t integer; // numbers without fraction or exponent that fit
+		double number;
+		const char *string; // NUL terminated
+		const struct arena_json *items;
+		const struct arena_json_member *members;
+	};
+};
+
+struct arena_json_member {
+	const char *key; // NUL terminated
+	uint32_t key_len;
+	struct arena_json value;
+};
+
+#define ARENA_JSON_MAX_DEPTH 32 // same as json-c
+
+struct arena_json_parser {
+	arena_t *arena;
+	const char *start, *p, *end;
+	uint32_t depth;
+	// children of unfinished containers, copied to arena when container ends
+	array_t items; // struct arena_json
+	array_t members; // struct arena_json_member
+	const char *error;
+	size_t error_offset;
+};
+
+static MAYBE_UNUSED void arena_json_parser_init(struct arena_json_parser *parser) {
+	*parser = (struct arena_json_parser){ 0 };
+	array_init(&parser->items, 64, sizeof(struct arena_json));
+	array_init(&parser->members, 64, sizeof(struct arena_json_member));
+}
+
+static MAYBE_UNUSED void arena_json_parser_fini(struct arena_json_parser *parser) {
+	array_fini(&parser->items);
+	array_fini(&parser->members);
+}
+
+static MAYBE_UNUSED bool arena_json_parse_error(struct arena_json_parser *parser, const char *error) {
+	parser->error = error;
+	parser->error_offset = (size_t)(parser->p - parser->start);
+	return false;
+}
+
+static MAYBE_UNUSED void arena_json_skip_whitespace(struct arena_json_parser *parser) {
+	while ((parser->p < parser->end) && ((*parser->p == ' ') || (*parser->p == '\t')
+			|| (*parser->p == '\n') || (*parser->p == '\r'))) {
+		parser->p++;
+	}
+}
+
+static MAYBE_UNUSED int arena_json_hex4(const char *p) {
+	int r = 0;
+	for (int i = 0; i < 4; ++i) {
+		char c = p[i];
+		r <<= 4;
+		if ((c >= '0') && (c <= '9')) {
+			r |= c - '0';
+		} else if ((c >= 'a') && (c <= 'f')) {
+			r |= c - 'a' + 10;
+		} else if ((c >= 'A') && (c <= 'F')) {
+			r |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+	return r;
+}
+
+static MAYBE_UNUSED char *arena_json_utf8_encode(char *dest, uint32_t c) {
+	if (c < 0x80) {
+		*dest++ = (char)c;
+	} else if (c < 0x800) {
+		*dest++ = (char)(0xC0 | (c >> 6));
+		*dest++ = (char)(0x80 | (c & 0x3F));
+	} else if (c < 0x10000) {
+		*dest++ = (char)(0xE0 | (c >> 12));
+		*dest++ = (char)(0x80 | ((c >> 6) & 0x3F));
+		*dest++ = (char)(0x80 | (c & 0x3F));
+	} else {
+		*dest++ = (char)(0xF0 | (c >> 18));
+		*dest++ = (char)(0x80 | ((c >> 12) & 0x3F));
+		*dest++ = (char)(0x80 | ((c >> 6) & 0x3F));
+		*dest++ = (char)(0x80 | (c & 0x3F));
+	}
+	return dest;
+}
+
+static MAYBE_UNUSED bool arena_json_parse_string(struct arena_json_parser *parser,
+		const char **dest, uint32_t *dest_len) {
+	const char *begin = ++parser->p; // skip '"'
+	const char *p = begin;
+	bool escaped = false;
+	while ((p < parser->end) && (*p != '"')) {
+		if (*p == '\\') {
+			escaped = true;
+			p++;
+		}
+		p++;
+	}
+	if (p >= parser->end) {
+		return arena_json_parse_error(parser, "unterminated string");
+	}
+
+	// decoded string is never longer than its escaped form
+	size_t raw_len = (size_t)(p - begin);
+	char *str = arena_alloc(parser->arena, raw_len + 1);
+	if (!escaped) {
+		memcpy(str, begin, raw_len);
+		str[raw_len] = '\0';
+		*dest = str;
+		*dest_len = (uint32_t)raw_len;
+		parser->p = p + 1;
+		return true;
+	}
+
+	char *out = str;
+	for (const char *in = begin; in < p; ) {
+		if (*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+		parser->p = in++;
+		switch (*in++) {
+		case '"': *out++ = '"'; break;
+		case '\\': *out++ = '\\'; break;
+		case '/': *out++ = '/'; break;
+		case 'b': *out++ = '\b'; break;
+		case 'f': *out++ = '\f'; break;
+		case 'n': *out++ = '\n'; break;
+		case 'r': *out++ = '\r'; break;
+		case 't': *out++ = '\t'; break;
+		case 'u': {
+			int c;
+			if (((p - in) < 4) || ((c = arena_json_hex4(in)) < 0)) {
+				return arena_json_parse_error(parser, "invalid \\u escape");
+			}
+			in += 4;
+			uint32_t codepoint = (uint32_t)c;
+			if ((codepoint >= 0xD800) && (codepoint <= 0xDBFF)) {
+				int low;
+				if (((p - in) >= 6) && (in[0] == '\\') && (in[1] == 'u')
+						&& ((low = arena_json_hex4(&in[2])) >= 0xDC00) && (low <= 0xDFFF)) {
+					codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + ((uint32_t)low - 0xDC00);
+					in += 6;
+				} else {
+					codepoint = 0xFFFD;
+				}
+			} else if ((codepoint >= 0xDC00) && (codepoint <= 0xDFFF)) {
+				codepoint = 0xFFFD;
+			}
+			out = arena_json_utf8_encode(out, codepoint);
+			break;
+		}
+		default:
+			return arena_json_parse_error(parser, "invalid escape");
+		}
+	}
+	*out = '\0';
+
+	*dest = str;
+	*dest_len = (uint32_t)(out - str);
+	parser->p = p + 1;
+	return true;
+}
+
+static MAYBE_UNUSED bool arena_json_parse_number(struct arena_json_parser *parser, struct arena_json *dest) {
+	const char *begin = parser->p, *p = begin;
+	bool negative = (*p == '-'), integer = true, overflow = false;
+	if (negative) {
+		p++;
+	}
+	if ((p >= parser->end) || (*p < '0') || (*p > '9')) {
+		return arena_json_parse_error(parser, "invalid number");
+	}
+
+	uint64_t magnitude = 0;
+	if (*p == '0') {
+		p++;
+	} else {
+		while ((p < parser->end) && (*p >= '0') && (*p <= '9')) {
+			uint64_t digit = (uint64_t)(*p - '0');
+			if (magnitude > ((UINT64_MAX - digit) / 10)) {
+				overflow = true;
+			} else {
+				magnitude = (magnitude * 10) + digit;
+			}
+			p++;
+		}
+	}
+	if ((p < parser->end) && (*p == '.')) {
+		integer = false;
+		p++;
+		if ((p >= parser->end) || (*p < '0') || (*p > '9')) {
+			return arena_json_parse_error(parser, "invalid number");
+		}
+		while ((p < parser->end) && (*p >= '0') && (*p <= '9')) {
+			p++;
+		}
+	}
+	if ((p < parser->end) && ((*p == 'e') || (*p == 'E'))) {
+		integer = false;
+		p++;
+		if ((p < parser->end) && ((*p == '+') || (*p == '-'))) {
+			p++;
+		}
+		if ((p >= parser->end) || (*p < '0') || (*p > '9')) {
+			return arena_json_parse_error(parser, "invalid number");
+		}
+		while ((p < parser->end) && (*p >= '0') && (*p <= '9')) {
+			p++;
+		}
+	}
+	parser->p = p;
+
+	if (integer && !overflow) {
+		if (negative && (magnitude <= ((uint64_t)INT64_MAX + 1))) {
+			dest->type = ARENA_JSON_TYPE_INT;
+			dest->integer = (magnitude == ((uint64_t)INT64_MAX + 1))
+				? INT64_MIN : -(int64_t)magnitude;
+			return true;
+		} else if (!negative && (magnitude <= INT64_MAX)) {
+			dest->type = ARENA_JSON_TYPE_INT;
+			dest->integer = (int64_t)magnitude;
+			return true;
+		}
+	}
+
+	// strtod needs NUL terminated string, input is not
+	char buf[128];
+	size_t len = (size_t)(p - begin);
+	if (len >= sizeof(buf)) {
+		return arena_json_parse_error(parser, "number too long");
+	}
+	memcpy(buf, begin, len);
+	buf[len] = '\0';
+	dest->type = ARENA_JSON_TYPE_DOUBLE;
+	dest->number = strtod(buf, NULL);
+	return true;
+}
+
+static MAYBE_UNUSED bool arena_json_parse_literal(struct arena_json_parser *parser,
+		const char *literal, size_t len) {
+	if (((size_t)(parser->end - parser->p) < len) || (memcmp(parser->p, literal, len) != 0)) {
+		return arena_json_parse_error(parser, "invalid literal");
+	}
+	parser->p += len;
+	return true;
+}
+
+static MAYBE_UNUSED bool arena_json_parse_value(struct arena_json_parser *parser, struct arena_json *dest);
+
+static MAYBE_UNUSED bool arena_json_parse_array(struct arena_json_parser *parser, struct arena_json *dest) {
+	parser->p++; // skip '['
+	size_t base = parser->items.len;
+	arena_json_skip_whitespace(parser);
+	if ((parser->p < parser->end) && (*parser->p == ']')) {
+		parser->p++;
+	} else {
+		for (;;) {
+			struct arena_json item;
+			if (!arena_json_parse_value(parser, &item)) {
+				return false;
+			}
+			array_add(&parser->items, &item);
+			arena_json_skip_whitespace(parser);
+			if (parser->p >= parser->end) {
+				return arena_json_parse_error(parser, "unterminated array");
+			} else if (*parser->p == ',') {
+				parser->p++;
+			} else if (*parser->p == ']') {
+				parser->p++;
+				break;
+			} else {
+				return arena_json_parse_error(parser, "expected ',' or ']'");
+			}
+		}
+	}
+
+	size_t len = parser->items.len - base;
+	struct arena_json *items = NULL;
+	if (len > 0) {
+		items = arena_alloc(parser->arena, len * sizeof(struct arena_json));
+		memcpy(items, (struct arena_json *)parser->items.items + base,
+			len * sizeof(struct arena_json));
+	}
+	parser->items.len = base;
+	dest->type = ARENA_JSON_TYPE_ARRAY;
+	dest->len = (uint32_t)len;
+	dest->items = items;
+	return true;
+}
+
+static MAYBE_UNUSED bool arena_json_parse_object(struct arena_json_parser *parser, struct arena_json *dest) {
+	parser->p++; // skip '{'
+	size_t base = parser->members.len;
+	arena_json_skip_whitespace(parser);
+	if ((parser->p < parser->end) && (*parser->p == '}')) {
+		parser->p++;
+	} else {
+		for (;;) {
+			struct arena_json_member member;
+			arena_json_skip_whitespace(parser);
+			if ((parser->p >= parser->end) || (*parser->p != '"')) {
+				return arena_json_parse_error(parser, "expected object key");
+			}
+			if (!arena_json_parse_string(parser, &member.key, &member.key_len)) {
+				return false;
+			}
+			arena_json_skip_whitespace(parser);
+			if ((parser->p >= parser->end) || (*parser->p != ':')) {
+				return arena_json_parse_error(parser, "expected ':'");
+			}
+			parser->p++;
+			if (!arena_json_parse_value(parser, &member.value)) {
+				return false;
+			}
+			array_add(&parser->members, &member);
+			arena_json_skip_whitespace(parser);
+			if (parser->p >= parser->end) {
+				return arena_json_parse_error(parser, "unterminated object");
+			} else if (*parser->p == ',') {
+				parser->p++;
+			} else if (*parser->p == '}') {
+				parser->p++;
+				break;
+			} else {
+				return arena_json_parse_error(parser, "expected ',' or '}'");
+			}
+		}
+	}
+
+	size_t len = parser->members.len - base;
+	struct arena_json_member *members = NULL;
+	if (len > 0) {
+		members = arena_alloc(parser->arena, len * sizeof(struct arena_json_member));
+		memcpy(members, (struct arena_json_member *)parser->members.items + base,
+			len * sizeof(struct arena_json_member));
+	}
+	parser->members.len = base;
+	dest->type = ARENA_JSON_TYPE_OBJECT;
+	dest->len = (uint32_t)len;
+	dest->members = members;
+	return true;
+}
+
+static MAYBE_UNUSED bool arena_json_parse_value(struct arena_json_parser *parser, struct arena_json *dest) {
+	*dest = (struct arena_json){ 0 };
+	arena_json_skip_whitespace(parser);
+	if (parser->p >= parser->end) {
+		return arena_json_parse_error(parser, "unexpected end of input");
+	}
+
+	bool r;
+	switch (*parser->p) {
+	case '{':
+	case '[':
+		if (parser->depth >= ARENA_JSON_MAX_DEPTH) {
+			return arena_json_parse_error(parser, "nesting too deep");
+		}
+		parser->depth++;
+		r = (*parser->p == '{')
+			? arena_json_parse_object(parser, dest)
+			: arena_json_parse_array(parser, dest);
+		parser->depth--;
+		return r;
+	case '"':
+		dest->type = ARENA_JSON_TYPE_STRING;
+		return arena_json_parse_string(parser, &dest->string, &dest->len);
+	case 't':
+		dest->type = ARENA_JSON_TYPE_BOOLEAN;
+		dest->boolean = true;
+		return arena_json_parse_literal(parser, "true", 4);
+	case 'f':
+		dest->type = ARENA_JSON_TYPE_BOOLEAN;
+		dest->boolean = false;
+		return arena_json_parse_literal(parser, "false", 5);
+	case 'n':
+		dest->type = ARENA_JSON_TYPE_NULL;
+		return arena_json_parse_literal(parser, "null", 4);
+	case '-':
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		return arena_json_parse_number(parser, dest);
+	default:
+		return arena_json_parse_error(parser, "unexpected character");
+	}
+}
+
+// Parses exactly one JSON value (surrounding whitespace is allowed) from data.
+// On failure parser->error and parser->error_offset describe the problem,
+// dest is undefined and memory already taken from arena stays there until arena_reset.
+static MAYBE_UNUSED bool arena_json_parse(struct arena_json_parser *parser, arena_t *arena,
+		const char *data, size_t len, struct arena_json *dest) {
+	parser->arena = arena;
+	parser->start = parser->p = data;
+	parser->end = data + len;
+	parser->depth = 0;
+	parser->error = NULL;
+	parser->error_offset = 0;
+
+	bool r = arena_json_parse_value(parser, dest);
+	if (r) {
+		arena_json_skip_whitespace(parser);
+		if (parser->p != parser->end) {
+			r = arena_json_parse_error(parser, "trailing characters");
+		}
+	}
+
+	parser->items.len = 0;
+	parser->members.len = 0;
+	return r;
+}
+
+static MAYBE_UNUSED bool arena_json_is_type(const struct arena_json *json,
+		enum arena_json_type type) {
+	return json && (json->type == type);
+}
+
+// NULL if json is not an object or has no such key
+static MAYBE_UNUSED const struct arena_json *arena_json_object_get(
+		const struct arena_json *json, const char *key) {
+	if (!arena_json_is_type(json, ARENA_JSON_TYPE_OBJECT)) {
+		return NULL;
+	}
+	for (uint32_t i = 0; i < json->len; ++i) {
+		if (strcmp(json->members[i].key, key) == 0) {
+			return &json->members[i].value;
+		}
+	}
+	return NULL;
+}
+
+// deep copy, all of dest's memory comes from arena
+static MAYBE_UNUSED void arena_json_copy(arena_t *arena, const struct arena_json *src,
+		struct arena_json *dest) {
+	*dest = *src;
+	switch (src->type) {
+	case ARENA_JSON_TYPE_STRING: {
+		char *string = arena_alloc(arena, src->len + 1);
+		memcpy(string, src->string, src->len + 1);
+		dest->string = string;
+		break;
+	}
+	case ARENA_JSON_TYPE_ARRAY: {
+		if (src->len == 0) {
+			break;
+		}
+		struct arena_json *items = arena_alloc(arena, src->len * sizeof(struct arena_json));
+		for (uint32_t i = 0; i < src->len; ++i) {
+			arena_json_copy(arena, &src->items[i], &items[i]);
+		}
+		dest->items = items;
+		break;
+	}
+	case ARENA_JSON_TYPE_OBJECT: {
+		if (src->len == 0) {
+			break;
+		}
+		struct arena_json_member *members = arena_alloc(arena,
+			src->len * sizeof(struct arena_json_member));
+		for (uint32_t i = 0; i < src->len; ++i) {
+			const struct arena_json_member *member = &src->members[i];
+			char *key = arena_alloc(arena, member->key_len + 1);
+			memcpy(key, member->key, member->key_len + 1);
+			members[i].key = key;
+			members[i].key_len = member->key_len;
+			arena_json_copy(arena, &member->value, &members[i].value);
+		}
+		dest->members = members;
+		break;
+	}
+	case ARENA_JSON_TYPE_NULL:
+	case ARENA_JSON_TYPE_BOOLEAN:
+	case ARENA_JSON_TYPE_INT:
+	case ARENA_JSON_TYPE_DOUBLE:
+	default:
+		break;
+	}
+}
+
+// arena_alloc'd bytes needed by arena_json_copy of json
+static MAYBE_UNUSED size_t arena_json_copy_size(const struct arena_json *json) {
+#define ARENA_JSON_ALIGN(size) (((size) + (_Alignof(max_align_t) - 1)) & ~(_Alignof(max_align_t) - 1))
+	size_t size = 0;
+	switch (json->type) {
+	case ARENA_JSON_TYPE_STRING:
+		size = ARENA_JSON_ALIGN((size_t)json->len + 1);
+		break;
+	case ARENA_JSON_TYPE_ARRAY:
+		if (json->len > 0) {
+			size = ARENA_JSON_ALIGN(json->len * sizeof(struct arena_json));
+			for (uint32_t i = 0; i < json->len; ++i) {
+				size += arena_json_copy_size(&json->items[i]);
+			}
+		}
+		break;
+	case ARENA_JSON_TYPE_OBJECT:
+		if (json->len > 0) {
+			size = ARENA_JSON_ALIGN(json->len * sizeof(struct arena_json_member));
+			for (uint32_t i = 0; i < json->len; ++i) {
+				size += ARENA_JSON_ALIGN((size_t)json->members[i].key_len + 1);
+				size += arena_json_copy_size(&json->members[i].value);
+			}
+		}
+		break;
+	case ARENA_JSON_TYPE_NULL:
+	case ARENA_JSON_TYPE_BOOLEAN:
+	case ARENA_JSON_TYPE_INT:
+	case ARENA_JSON_TYPE_DOUBLE:
+	default:
+		break;
+	}
+	return size;
+#undef ARENA_JSON_ALIGN
+}
+
+// members of patch replace members of base with the same key
+static MAYBE_UNUSED void arena_json_object_merge(arena_t *arena, const struct arena_json *base,
+		const struct arena_json *patch, struct arena_json *dest) {
+	assert(arena_json_is_type(base, ARENA_JSON_TYPE_OBJECT)
+		&& arena_json_is_type(patch, ARENA_JSON_TYPE_OBJECT));
+	*dest = (struct arena_json){ .type = ARENA_JSON_TYPE_OBJECT };
+	if ((base->len + patch->len) == 0) {
+		return;
+	}
+
+	struct arena_json_member *members = arena_alloc(arena,
+		(base->len + patch->len) * sizeof(struct arena_json_member));
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < base->len; ++i) {
+		if (!arena_json_object_get(patch, base->members[i].key)) {
+			members[len++] = base->members[i];
+		}
+	}
+	memcpy(&members[len], patch->members, patch->len * sizeof(struct arena_json_member));
+	dest->len = len + patch->len;
+	dest->members = members;
+}
+
+#endif // ARENA_JSON_H
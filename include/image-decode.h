@@ -0,0 +1,182 @@
+#if !defined(IMAGE_DECODE_H)
+#define IMAGE_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pixman.h>
+
+#if HAVE_PNG
+#include <png.h>
+#include <setjmp.h>
+#endif // HAVE_PNG
+
+#include "util.h"
+
+// decoders shared by sbar and tests/bench-image.c, images are premultiplied ARGB32
+
+static MAYBE_UNUSED pixman_image_t *decode_qoi(const uint8_t *data, size_t data_size) {
+	static const uint8_t padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	if ((data_size < (14 + sizeof(padding))) || (memcmp(data, "qoif", 4) != 0)) {
+		return NULL;
+	}
+
+	uint32_t width = (uint32_t)data[4] << 24 | (uint32_t)data[5] << 16
+		| (uint32_t)data[6] << 8 | (uint32_t)data[7];
+	uint32_t height = (uint32_t)data[8] << 24 | (uint32_t)data[9] << 16
+		| (uint32_t)data[10] << 8 | (uint32_t)data[11];
+	if ((width == 0) || (height == 0) || (width > INT32_MAX / 4)
+			|| (height > INT32_MAX / width / 4)) {
+		return NULL;
+	}
+
+	pixman_image_t *image = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
+		(int)width, (int)height, NULL, (int)width * 4);
+	if (image == NULL) {
+		return NULL;
+	}
+
+	uint32_t *pixels = pixman_image_get_data(image);
+	uint32_t index[64] = { 0 }; // non-premultiplied ARGB32
+	uint32_t px = 0xFF000000, px_premultiplied = px;
+	size_t p = 14, chunks_end = data_size - sizeof(padding), run = 0;
+	for (size_t i = 0, len = (size_t)width * height; i < len; ++i) {
+		if (run > 0) {
+			run--;
+		} else if (p < chunks_end) {
+			uint8_t b1 = data[p++];
+			uint8_t a = (uint8_t)(px >> 24), r = (uint8_t)(px >> 16);
+			uint8_t g = (uint8_t)(px >> 8), b = (uint8_t)px;
+			if (b1 == 0xFE) { // QOI_OP_RGB
+				r = data[p];
+				g = data[p + 1];
+				b = data[p + 2];
+				p += 3;
+			} else if (b1 == 0xFF) { // QOI_OP_RGBA
+				r = data[p];
+				g = data[p + 1];
+				b = data[p + 2];
+				a = data[p + 3];
+				p += 4;
+			} else {
+				switch (b1 & 0xC0) {
+				case 0x00: // QOI_OP_INDEX
+					px = index[b1];
+					goto write;
+				case 0x40: // QOI_OP_DIFF
+					r = (uint8_t)(r + ((b1 >> 4) & 0x03) - 2);
+					g = (uint8_t)(g + ((b1 >> 2) & 0x03) - 2);
+					b = (uint8_t)(b + (b1 & 0x03) - 2);
+					break;
+				case 0x80: { // QOI_OP_LUMA
+					uint8_t b2 = data[p++];
+					int vg = (b1 & 0x3F) - 32;
+					r = (uint8_t)(r + vg - 8 + ((b2 >> 4) & 0x0F));
+					g = (uint8_t)(g + vg);
+					b = (uint8_t)(b + vg - 8 + (b2 & 0x0F));
+					break;
+				}
+				case 0xC0: // QOI_OP_RUN
+				default:
+					run = b1 & 0x3F;
+					pixels[i] = px_premultiplied;
+					continue;
+				}
+			}
+			px = (uint32_t)a << 24 | (uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b;
+write:
+			index[(((px >> 16) & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5
+				+ (px & 0xFF) * 7 + (px >> 24) * 11) % 64] = px;
+			px_premultiplied = px;
+			premultiply_alpha_argb32(&px_premultiplied);
+		}
+		pixels[i] = px_premultiplied;
+	}
+
+	return image;
+}
+
+#if HAVE_PNG
+static MAYBE_UNUSED void premultiply_alpha_png(MAYBE_UNUSED png_structp png,
+		png_row_infop row_info, png_bytep data) {
+	for (size_t i = 0; i < row_info->rowbytes; i += 4) {
+		premultiply_alpha_argb32((uint32_t *)(void *)&data[i]);
+	}
+}
+
+struct png_memory {
+	const uint8_t *data;
+	size_t size;
+};
+
+static MAYBE_UNUSED void png_read_memory(png_structp png, png_bytep dest, size_t len) {
+	struct png_memory *memory = png_get_io_ptr(png);
+	if (len > memory->size) {
+		png_error(png, "unexpected end of data");
+	}
+	memcpy(dest, memory->data, len);
+	memory->data += len;
+	memory->size -= len;
+}
+
+// either file or memory must be set. name is used for logging
+static MAYBE_UNUSED pixman_image_t *decode_png(FILE *file, struct png_memory *memory,
+		const char *name) {
+	pixman_image_t *image = NULL;
+	png_bytepp row_pointers = NULL;
+	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+			NULL, NULL, NULL);
+	png_infop info = png_create_info_struct(png);
+
+	if (setjmp(png_jmpbuf(png))) {
+		log_stderr("%s: libpng error", name);
+		goto cleanup;
+	}
+
+	if (file) {
+		png_init_io(png, file);
+	} else {
+		png_set_read_fn(png, memory, png_read_memory);
+	}
+	png_read_info(png, info);
+
+	png_uint_32 width = png_get_image_width(png, info);
+	png_uint_32 height = png_get_image_height(png, info);
+	png_uint_32 stride = width * 4;
+	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, (int)width, (int)height,
+			NULL, (int)stride);
+	if (image == NULL) {
+		goto cleanup;
+	}
+
+	png_set_strip_16(png);
+	png_set_bgr(png);
+	png_set_palette_to_rgb(png);
+	png_set_expand_gray_1_2_4_to_8(png);
+	png_set_tRNS_to_alpha(png);
+	png_set_packing(png);
+	png_set_gray_to_rgb(png);
+	png_set_interlace_handling(png);
+	png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+
+	png_set_read_user_transform_fn(png, premultiply_alpha_png);
+
+	png_bytep image_data = (png_bytep)pixman_image_get_data(image);
+	row_pointers = malloc(height * sizeof(png_bytepp));
+    for (size_t i = 0; i < height; ++i) {
+		row_pointers[i] = &image_data[i * stride];
+	}
+
+    png_read_image(png, row_pointers);
+
+cleanup:
+	free(row_pointers);
+	png_destroy_read_struct(&png, &info, NULL);
+	return image;
+}
+#endif // HAVE_PNG
+
+#endif // IMAGE_DECODE_H
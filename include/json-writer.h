@@ -0,0 +1,267 @@
+#if !defined(JSON_WRITER_H)
+#define JSON_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "util.h"
+
+// Streaming JSON writer, appends directly to a growable buffer without building
+// a tree first. Callers are responsible for pairing begin/end and key/value.
+
+struct json_writer {
+	char *data;
+	size_t size, len;
+	bool comma; // next value or key needs a separator
+};
+
+static MAYBE_UNUSED void json_writer_init(struct json_writer *writer, size_t initial_size) {
+	writer->size = initial_size;
+	writer->data = malloc(initial_size);
+	writer->len = 0;
+	writer->comma = false;
+}
+
+static MAYBE_UNUSED void json_writer_fini(struct json_writer *writer) {
+	free(writer->data);
+}
+
+static MAYBE_UNUSED void json_writer_reset(struct json_writer *writer) {
+	writer->len = 0;
+	writer->comma = false;
+}
+
+// returns space for at least len bytes at the end of data, commit with writer->len += n
+static MAYBE_UNUSED char *json_writer_reserve(struct json_writer *writer, size_t len) {
+	if ((writer->len + len) > writer->size) {
+		do {
+			writer->size *= 2;
+		} while ((writer->len + len) > writer->size);
+		writer->data = realloc(writer->data, writer->size);
+	}
+
+	return &writer->data[writer->len];
+}
+
+static MAYBE_UNUSED void json_writer_char(struct json_writer *writer, char c) {
+	*json_writer_reserve(writer, 1) = c;
+	writer->len++;
+}
+
+static MAYBE_UNUSED void json_writer_separator(struct json_writer *writer) {
+	if (writer->comma) {
+		json_writer_char(writer, ',');
+	}
+	writer->comma = true;
+}
+
+// ends a top level value, e.g. with '\n'
+static MAYBE_UNUSED void json_writer_end_message(struct json_writer *writer, char c) {
+	json_writer_char(writer, c);
+	writer->comma = false;
+}
+
+static MAYBE_UNUSED void json_writer_object_begin(struct json_writer *writer) {
+	json_writer_separator(writer);
+	json_writer_char(writer, '{');
+	writer->comma = false;
+}
+
+static MAYBE_UNUSED void json_writer_object_end(struct json_writer *writer) {
+	json_writer_char(writer, '}');
+	writer->comma = true;
+}
+
+static MAYBE_UNUSED void json_writer_array_begin(struct json_writer *writer) {
+	json_writer_separator(writer);
+	json_writer_char(writer, '[');
+	writer->comma = false;
+}
+
+static MAYBE_UNUSED void json_writer_array_end(struct json_writer *writer) {
+	json_writer_char(writer, ']');
+	writer->comma = true;
+}
+
+static MAYBE_UNUSED void json_writer_string_len(struct json_writer *writer,
+		const char *str, size_t len) {
+	static const char hex[] = "0123456789abcdef";
+
+	json_writer_separator(writer);
+	// worst case every byte is \u00XX
+	char *p = json_writer_reserve(writer, (len * 6) + 2), *start = p;
+	*p++ = '"';
+	size_t run = 0;
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = (unsigned char)str[i];
+		if ((c >= 0x20) && (c != '"') && (c != '\\')) {
+			continue;
+		}
+		memcpy(p, &str[run], i - run);
+		p += i - run;
+		run = i + 1;
+		*p++ = '\\';
+		switch (c) {
+		case '"':
+		case '\\':
+			*p++ = (char)c;
+			break;
+		case '\n':
+			*p++ = 'n';
+			break;
+		case '\t':
+			*p++ = 't';
+			break;
+		case '\r':
+			*p++ = 'r';
+			break;
+		case '\b':
+			*p++ = 'b';
+			break;
+		case '\f':
+			*p++ = 'f';
+			break;
+		default:
+			memcpy(p, "u00", 3);
+			p[3] = hex[c >> 4];
+			p[4] = hex[c & 0xF];
+			p += 5;
+			break;
+		}
+	}
+	memcpy(p, &str[run], len - run);
+	p += len - run;
+	*p++ = '"';
+	writer->len += (size_t)(p - start);
+}
+
+static MAYBE_UNUSED void json_writer_string(struct json_writer *writer, const char *str) {
+	json_writer_string_len(writer, str, strlen(str));
+}
+
+static MAYBE_UNUSED void json_writer_key(struct json_writer *writer, const char *key) {
+	json_writer_string_len(writer, key, strlen(key));
+	json_writer_char(writer, ':');
+	writer->comma = false;
+}
+
+// already serialized json
+static MAYBE_UNUSED void json_writer_raw(struct json_writer *writer,
+		const char *json, size_t len) {
+	json_writer_separator(writer);
+	memcpy(json_writer_reserve(writer, len), json, len);
+	writer->len += len;
+}
+
+static MAYBE_UNUSED void json_writer_null(struct json_writer *writer) {
+	json_writer_raw(writer, "null", 4);
+}
+
+static MAYBE_UNUSED void json_writer_bool(struct json_writer *writer, bool value) {
+	if (value) {
+		json_writer_raw(writer, "true", 4);
+	} else {
+		json_writer_raw(writer, "false", 5);
+	}
+}
+
+static MAYBE_UNUSED const char json_writer_digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+// writes digits of value ending right before end, returns first digit
+static MAYBE_UNUSED char *json_writer_format_uint64(char *end, uint64_t value) {
+	char *p = end;
+	while (value >= 100) {
+		p -= 2;
+		memcpy(p, &json_writer_digit_pairs[(value % 100) * 2], 2);
+		value /= 100;
+	}
+	if (value >= 10) {
+		p -= 2;
+		memcpy(p, &json_writer_digit_pairs[value * 2], 2);
+	} else {
+		*--p = (char)('0' + value);
+	}
+
+	return p;
+}
+
+static MAYBE_UNUSED void json_writer_uint64(struct json_writer *writer, uint64_t value) {
+	char buf[20];
+	char *end = &buf[sizeof(buf)];
+	char *start = json_writer_format_uint64(end, value);
+	json_writer_raw(writer, start, (size_t)(end - start));
+}
+
+static MAYBE_UNUSED void json_writer_int64(struct json_writer *writer, int64_t value) {
+	char buf[21];
+	char *end = &buf[sizeof(buf)];
+	// negate in unsigned so INT64_MIN does not overflow
+	uint64_t magnitude = (value < 0) ? (0 - (uint64_t)value) : (uint64_t)value;
+	char *start = json_writer_format_uint64(end, magnitude);
+	if (value < 0) {
+		*--start = '-';
+	}
+	json_writer_raw(writer, start, (size_t)(end - start));
+}
+
+static MAYBE_UNUSED void json_writer_double(struct json_writer *writer, double value) {
+	if (!isfinite(value)) {
+		// NaN and Infinity are not valid json
+		json_writer_null(writer);
+		return;
+	}
+
+	char buf[32];
+	double magnitude = (value < 0) ? -value : value;
+	if (magnitude < 1e7) {
+		// values with up to 8 fraction digits, like wl_fixed_t coordinates,
+		// are printed without snprintf. scaled < 2^53 so the conversion is exact
+		// and the division check guarantees the output parses back to value
+		double scaled = magnitude * 1e8;
+		uint64_t n = (uint64_t)scaled;
+		if (!islessgreater((double)n, scaled) && !islessgreater((double)n / 1e8, magnitude)) {
+			char *end = &buf[sizeof(buf)];
+			char *p = end;
+			uint64_t fraction = n % 100000000;
+			if (fraction == 0) {
+				*--p = '0';
+			} else {
+				int digits = 8;
+				while ((fraction % 10) == 0) {
+					fraction /= 10;
+					digits--;
+				}
+				while (digits-- > 0) {
+					*--p = (char)('0' + (fraction % 10));
+					fraction /= 10;
+				}
+			}
+			*--p = '.';
+			p = json_writer_format_uint64(p, n / 100000000);
+			if (signbit(value)) {
+				*--p = '-';
+			}
+			json_writer_raw(writer, p, (size_t)(end - p));
+			return;
+		}
+	}
+
+	int len = snprintf(buf, sizeof(buf) - 2, "%.17g", value);
+	// keep it a double for the reader, same as json-c
+	if (strpbrk(buf, ".eE") == NULL) {
+		buf[len++] = '.';
+		buf[len++] = '0';
+	}
+	json_writer_raw(writer, buf, (size_t)len);
+}
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,413 @@
+#if !defined(SBAR_SCHEMA_H)
+#define SBAR_SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <json_object.h>
+
+#include "util.h"
+#include "arena-json.h"
+
+// Objects sent to sbar(see to_sbar in examples/python), described once.
+// X(struct_name, key, type), type is one of BOOL, INT, STRING, ARRAY, OBJECT, ANY
+
+#define SBAR_SCHEMA_BORDER(X, s) \
+	X(s, width, INT) \
+	X(s, color, INT)
+
+#define SBAR_SCHEMA_SPAN(X, s) \
+	X(s, text, STRING) \
+	X(s, color, INT) \
+	X(s, font, INT) \
+	X(s, underline, BOOL)
+
+#define SBAR_SCHEMA_BLOCK(X, s) \
+	X(s, id, INT) \
+	X(s, type, INT) \
+	X(s, anchor, INT) \
+	X(s, color, INT) \
+	X(s, render, BOOL) \
+	X(s, min_width, INT) \
+	X(s, max_width, INT) \
+	X(s, min_height, INT) \
+	X(s, max_height, INT) \
+	X(s, content_width, INT) \
+	X(s, content_height, INT) \
+	X(s, content_transform, INT) \
+	X(s, content_anchor, INT) \
+	X(s, border_left, OBJECT) \
+	X(s, border_right, OBJECT) \
+	X(s, border_bottom, OBJECT) \
+	X(s, border_top, OBJECT) \
+	/* text */ \
+	X(s, text, STRING) \
+	X(s, font_names, ARRAY) \
+	X(s, font_attributes, STRING) \
+	X(s, text_color, INT) \
+	X(s, short_text, STRING) \
+	X(s, text_ellipsize, INT) \
+	X(s, text_wrap, BOOL) \
+	X(s, spans, ARRAY) \
+	X(s, span_fonts, ARRAY) \
+	/* image */ \
+	X(s, path, STRING) \
+	X(s, data, STRING) \
+	X(s, fd, STRING) \
+	X(s, image_type, INT) \
+	/* composite */ \
+	X(s, blocks, ARRAY) \
+	/* position in composite */ \
+	X(s, x, INT) \
+	X(s, y, INT)
+
+#define SBAR_SCHEMA_SURFACE(X, s) \
+	X(s, id, INT) \
+	X(s, userdata, ANY) \
+	X(s, width, INT) \
+	X(s, height, INT) \
+	X(s, cursor_shape, INT) \
+	X(s, render, BOOL) \
+	X(s, input_regions, ARRAY) \
+	X(s, blocks, ARRAY) \
+	X(s, popups, ARRAY)
+
+#define SBAR_SCHEMA_BAR(X, s) \
+	SBAR_SCHEMA_SURFACE(X, s) \
+	X(s, exclusive_zone, INT) \
+	X(s, anchor, INT) \
+	X(s, layer, INT) \
+	X(s, margin_top, INT) \
+	X(s, margin_right, INT) \
+	X(s, margin_bottom, INT) \
+	X(s, margin_left, INT)
+
+#define SBAR_SCHEMA_POPUP(X, s) \
+	SBAR_SCHEMA_SURFACE(X, s) \
+	X(s, x, INT) \
+	X(s, y, INT) \
+	X(s, vertical, BOOL) \
+	X(s, gravity, INT) \
+	X(s, constraint_adjustment, INT) \
+	X(s, grab, INT)
+
+enum sbar_schema_type {
+	SBAR_SCHEMA_TYPE_BOOL,
+	SBAR_SCHEMA_TYPE_INT,
+	SBAR_SCHEMA_TYPE_STRING,
+	SBAR_SCHEMA_TYPE_ARRAY,
+	SBAR_SCHEMA_TYPE_OBJECT,
+	SBAR_SCHEMA_TYPE_ANY,
+};
+
+// set is false if key is missing or its value is of the wrong type
+struct sbar_schema_value_bool {
+	bool set;
+	bool value;
+};
+
+struct sbar_schema_value_int {
+	bool set;
+	int64_t value;
+};
+
+struct sbar_schema_value_string {
+	bool set;
+	const char *value;
+	size_t len; // sbar_schema_encode uses strlen(value) if 0
+};
+
+struct sbar_schema_value_json { // ARRAY, OBJECT, ANY
+	bool set;
+	union {
+		json_object *value; // sbar_schema_decode, sbar_schema_encode
+		const struct arena_json *arena; // sbar_schema_decode_arena
+	};
+};
+
+#define SBAR_SCHEMA_VALUE_BOOL struct sbar_schema_value_bool
+#define SBAR_SCHEMA_VALUE_INT struct sbar_schema_value_int
+#define SBAR_SCHEMA_VALUE_STRING struct sbar_schema_value_string
+#define SBAR_SCHEMA_VALUE_ARRAY struct sbar_schema_value_json
+#define SBAR_SCHEMA_VALUE_OBJECT struct sbar_schema_value_json
+#define SBAR_SCHEMA_VALUE_ANY struct sbar_schema_value_json
+
+#define SBAR_SCHEMA_GET(field, default_value) ((field).set ? (field).value : (default_value))
+#define SBAR_SCHEMA_SET(field, value_) do { (field).set = true; (field).value = (value_); } while (0)
+
+#define SBAR_SCHEMA_DECLARE_FIELD(s, key, type) SBAR_SCHEMA_VALUE_##type key;
+
+struct sbar_schema_border {
+	SBAR_SCHEMA_BORDER(SBAR_SCHEMA_DECLARE_FIELD, sbar_schema_border)
+};
+
+struct sbar_schema_span {
+	SBAR_SCHEMA_SPAN(SBAR_SCHEMA_DECLARE_FIELD, sbar_schema_span)
+};
+
+struct sbar_schema_block {
+	SBAR_SCHEMA_BLOCK(SBAR_SCHEMA_DECLARE_FIELD, sbar_schema_block)
+};
+
+// left, right, bottom, top
+static MAYBE_UNUSED void sbar_schema_block_borders(const struct sbar_schema_block *block,
+		const struct sbar_schema_value_json *borders[static 4]) {
+	borders[0] = &block->border_left;
+	borders[1] = &block->border_right;
+	borders[2] = &block->border_bottom;
+	borders[3] = &block->border_top;
+}
+
+struct sbar_schema_surface {
+	SBAR_SCHEMA_SURFACE(SBAR_SCHEMA_DECLARE_FIELD, sbar_schema_surface)
+};
+
+struct sbar_schema_bar {
+	SBAR_SCHEMA_BAR(SBAR_SCHEMA_DECLARE_FIELD, sbar_schema_bar)
+};
+
+struct sbar_schema_popup {
+	SBAR_SCHEMA_POPUP(SBAR_SCHEMA_DECLARE_FIELD, sbar_schema_popup)
+};
+
+struct sbar_schema_field {
+	const char *key;
+	enum sbar_schema_type type;
+	size_t offset;
+};
+
+#define SBAR_SCHEMA_INDEX_SIZE 128
+
+struct sbar_schema {
+	const struct sbar_schema_field *fields;
+	size_t fields_len;
+	// fnv1a_hash(key) -> fields index + 1, 0 if empty. Built on first use
+	uint8_t index[SBAR_SCHEMA_INDEX_SIZE];
+	bool index_built;
+};
+
+#define SBAR_SCHEMA_DEFINE_FIELD(s, key, type) \
+	{ #key, SBAR_SCHEMA_TYPE_##type, offsetof(struct s, key) },
+
+#define SBAR_SCHEMA_DEFINE(name, list) \
+	static const struct sbar_schema_field sbar_schema_##name##_fields[] = { \
+		list(SBAR_SCHEMA_DEFINE_FIELD, sbar_schema_##name) \
+	}; \
+	static MAYBE_UNUSED struct sbar_schema sbar_schema_##name = { \
+		.fields = sbar_schema_##name##_fields, \
+		.fields_len = LENGTH(sbar_schema_##name##_fields), \
+	};
+
+SBAR_SCHEMA_DEFINE(border, SBAR_SCHEMA_BORDER)
+SBAR_SCHEMA_DEFINE(span, SBAR_SCHEMA_SPAN)
+SBAR_SCHEMA_DEFINE(block, SBAR_SCHEMA_BLOCK)
+SBAR_SCHEMA_DEFINE(surface, SBAR_SCHEMA_SURFACE)
+SBAR_SCHEMA_DEFINE(bar, SBAR_SCHEMA_BAR)
+SBAR_SCHEMA_DEFINE(popup, SBAR_SCHEMA_POPUP)
+
+static MAYBE_UNUSED const struct sbar_schema_field *sbar_schema_find(struct sbar_schema *schema,
+		const char *key, size_t key_len) {
+	if (!schema->index_built) {
+		assert(schema->fields_len < (SBAR_SCHEMA_INDEX_SIZE / 2));
+		for (size_t i = 0; i < schema->fields_len; ++i) {
+			const char *k = schema->fields[i].key;
+			size_t slot = fnv1a_hash(k, strlen(k)) % SBAR_SCHEMA_INDEX_SIZE;
+			while (schema->index[slot] != 0) {
+				slot = (slot + 1) % SBAR_SCHEMA_INDEX_SIZE;
+			}
+			schema->index[slot] = (uint8_t)(i + 1);
+		}
+		schema->index_built = true;
+	}
+
+	size_t slot = fnv1a_hash(key, key_len) % SBAR_SCHEMA_INDEX_SIZE;
+	while (schema->index[slot] != 0) {
+		const struct sbar_schema_field *field = &schema->fields[schema->index[slot] - 1];
+		if ((strncmp(field->key, key, key_len) == 0) && (field->key[key_len] == '\0')) {
+			return field;
+		}
+		slot = (slot + 1) % SBAR_SCHEMA_INDEX_SIZE;
+	}
+
+	return NULL;
+}
+
+// Fills fields of dest that are present in json, dest should be zero initialized.
+// Unknown keys and values of the wrong type are skipped.
+// Strings and json values are owned by json.
+static MAYBE_UNUSED void sbar_schema_decode(struct sbar_schema *schema,
+		json_object *json, void *dest) {
+	if (!json_object_is_type(json, json_type_object)) {
+		return;
+	}
+
+	json_object_object_foreach(json, key, value) {
+		const struct sbar_schema_field *field = sbar_schema_find(schema, key, strlen(key));
+		if (field == NULL) {
+			continue;
+		}
+
+		void *dest_field = (char *)dest + field->offset;
+		switch (field->type) {
+		case SBAR_SCHEMA_TYPE_BOOL:
+			if (json_object_is_type(value, json_type_boolean)) {
+				SBAR_SCHEMA_SET(*(struct sbar_schema_value_bool *)dest_field,
+					json_object_get_boolean(value));
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_INT:
+			if (json_object_is_type(value, json_type_int)) {
+				SBAR_SCHEMA_SET(*(struct sbar_schema_value_int *)dest_field,
+					json_object_get_int64(value));
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_STRING:
+			if (json_object_is_type(value, json_type_string)) {
+				struct sbar_schema_value_string *string = dest_field;
+				string->set = true;
+				string->value = json_object_get_string(value);
+				string->len = (size_t)json_object_get_string_len(value);
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_ARRAY:
+			if (json_object_is_type(value, json_type_array)) {
+				SBAR_SCHEMA_SET(*(struct sbar_schema_value_json *)dest_field, value);
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_OBJECT:
+			if (json_object_is_type(value, json_type_object)) {
+				SBAR_SCHEMA_SET(*(struct sbar_schema_value_json *)dest_field, value);
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_ANY:
+			if (value != NULL) {
+				SBAR_SCHEMA_SET(*(struct sbar_schema_value_json *)dest_field, value);
+			}
+			break;
+		default:
+			assert(UNREACHABLE);
+			break;
+		}
+	}
+}
+
+// Same as sbar_schema_decode, strings and json values point into json.
+static MAYBE_UNUSED void sbar_schema_decode_arena(struct sbar_schema *schema,
+		const struct arena_json *json, void *dest) {
+	if (!arena_json_is_type(json, ARENA_JSON_TYPE_OBJECT)) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < json->len; ++i) {
+		const struct arena_json_member *member = &json->members[i];
+		const struct sbar_schema_field *field = sbar_schema_find(schema,
+			member->key, member->key_len);
+		if (field == NULL) {
+			continue;
+		}
+
+		const struct arena_json *value = &member->value;
+		void *dest_field = (char *)dest + field->offset;
+		switch (field->type) {
+		case SBAR_SCHEMA_TYPE_BOOL:
+			if (value->type == ARENA_JSON_TYPE_BOOLEAN) {
+				SBAR_SCHEMA_SET(*(struct sbar_schema_value_bool *)dest_field, value->boolean);
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_INT:
+			if (value->type == ARENA_JSON_TYPE_INT) {
+				SBAR_SCHEMA_SET(*(struct sbar_schema_value_int *)dest_field, value->integer);
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_STRING:
+			if (value->type == ARENA_JSON_TYPE_STRING) {
+				struct sbar_schema_value_string *string = dest_field;
+				string->set = true;
+				string->value = value->string;
+				string->len = value->len;
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_ARRAY:
+			if (value->type == ARENA_JSON_TYPE_ARRAY) {
+				struct sbar_schema_value_json *j = dest_field;
+				j->set = true;
+				j->arena = value;
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_OBJECT:
+			if (value->type == ARENA_JSON_TYPE_OBJECT) {
+				struct sbar_schema_value_json *j = dest_field;
+				j->set = true;
+				j->arena = value;
+			}
+			break;
+		case SBAR_SCHEMA_TYPE_ANY:
+			if (value->type != ARENA_JSON_TYPE_NULL) {
+				struct sbar_schema_value_json *j = dest_field;
+				j->set = true;
+				j->arena = value;
+			}
+			break;
+		default:
+			assert(UNREACHABLE);
+			break;
+		}
+	}
+}
+
+// Adds set fields of source to dest object, json values are moved to dest.
+static MAYBE_UNUSED void sbar_schema_encode(const struct sbar_schema *schema,
+		const void *source, json_object *dest) {
+	for (size_t i = 0; i < schema->fields_len; ++i) {
+		const struct sbar_schema_field *field = &schema->fields[i];
+		const void *source_field = (const char *)source + field->offset;
+		json_object *value;
+		switch (field->type) {
+		case SBAR_SCHEMA_TYPE_BOOL: {
+			const struct sbar_schema_value_bool *b = source_field;
+			if (!b->set) {
+				continue;
+			}
+			value = json_object_new_boolean(b->value);
+			break;
+		}
+		case SBAR_SCHEMA_TYPE_INT: {
+			const struct sbar_schema_value_int *n = source_field;
+			if (!n->set) {
+				continue;
+			}
+			value = json_object_new_int64(n->value);
+			break;
+		}
+		case SBAR_SCHEMA_TYPE_STRING: {
+			const struct sbar_schema_value_string *string = source_field;
+			if (!string->set) {
+				continue;
+			}
+			value = string->len
+				? json_object_new_string_len(string->value, (int)string->len)
+				: json_object_new_string(string->value);
+			break;
+		}
+		case SBAR_SCHEMA_TYPE_ARRAY:
+		case SBAR_SCHEMA_TYPE_OBJECT:
+		case SBAR_SCHEMA_TYPE_ANY: {
+			const struct sbar_schema_value_json *j = source_field;
+			if (!j->set) {
+				continue;
+			}
+			value = j->value;
+			break;
+		}
+		default:
+			assert(UNREACHABLE);
+			continue;
+		}
+		json_object_object_add_ex(dest, field->key, value,
+			JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_ADD_CONSTANT_KEY);
+	}
+}
+
+#endif // SBAR_SCHEMA_H
@@ -78,12 +78,24 @@ enum sbar_block_content_transform {
 	SBAR_BLOCK_CONTENT_TRANSFORM_FLIPPED_270,
 };
 
+enum sbar_block_type_text_ellipsize {
+	SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_DEFAULT,
+	SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE,
+	SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_START,
+	SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_MIDDLE,
+	SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_END,
+};
+
 enum sbar_block_type_image_image_type {
 	SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_DEFAULT,
 	SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP, // format: uint32_t width, uint32_t height, ARGB32 pixels
 	SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PNG,
-	SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_RESERVED,
+	// same format as PIXMAP, but pixels are already premultiplied.
+	// Only a memfd sealed with F_SEAL_SHRINK and F_SEAL_WRITE is used in place, without copying.
+	// Any other file, including one in /dev/shm, is copied when loaded
+	SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED,
 	SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_SVG,
+	SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_QOI, // https://qoiformat.org/qoi-specification.pdf
 };
 
 enum sbar_surface_cursor_shape {
@@ -175,4 +187,24 @@ enum sbar_output_transform {
 	SBAR_OUTPUT_TRANSFORM_FLIPPED_270,
 };
 
+// see "patch" in examples/python
+enum sbar_patch_op {
+	SBAR_PATCH_OP_DEFAULT,
+	SBAR_PATCH_OP_SET, // merge keys of "block" into the existing block
+	SBAR_PATCH_OP_REPLACE,
+	SBAR_PATCH_OP_INSERT,
+	SBAR_PATCH_OP_REMOVE,
+};
+
+// see "state_events_mask" in examples/python
+enum sbar_state_events_mask {
+	SBAR_STATE_EVENTS_MASK_OUTPUTS = 1,
+	SBAR_STATE_EVENTS_MASK_SURFACES = 2,
+	SBAR_STATE_EVENTS_MASK_BLOCKS = 4,
+	SBAR_STATE_EVENTS_MASK_POINTER_MOTION = 8, // also enter and leave
+	SBAR_STATE_EVENTS_MASK_POINTER_BUTTON = 16,
+	SBAR_STATE_EVENTS_MASK_POINTER_SCROLL = 32,
+	SBAR_STATE_EVENTS_MASK_ALL = 63,
+};
+
 #endif // SBAR_H
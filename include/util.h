@@ -11,6 +11,7 @@
 #include <stdnoreturn.h>
 #include <assert.h>
 #include <time.h>
+#include <uchar.h>
 
 #include "macros.h"
 
@@ -27,6 +28,20 @@ typedef struct {
     void *items;
 } array_t;
 
+// bump allocator, memory is released only by arena_reset/arena_fini
+typedef struct arena_chunk arena_chunk_t;
+struct arena_chunk {
+    arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+typedef struct {
+    arena_chunk_t *chunk; // current, older chunks follow
+    size_t initial_size;
+} arena_t;
+
 typedef struct list list_t;
 struct list {
 	list_t *prev;
@@ -246,6 +261,65 @@ static MAYBE_UNUSED void *array_put(array_t *array, size_t idx, void *item) {
 //    memmove(p, p + array->elm_size, array->elm_size * (array->len - idx));
 //}
 
+static MAYBE_UNUSED void arena_init(arena_t *arena, size_t initial_size) {
+    assert(initial_size > 0);
+    arena->chunk = NULL;
+    arena->initial_size = initial_size;
+}
+
+static MAYBE_UNUSED void arena_fini(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunk;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunk = NULL;
+}
+
+static MAYBE_UNUSED void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + (_Alignof(max_align_t) - 1)) & ~(_Alignof(max_align_t) - 1);
+    arena_chunk_t *chunk = arena->chunk;
+    if ((chunk == NULL) || ((chunk->size - chunk->used) < size)) {
+        size_t chunk_size = chunk ? (chunk->size * 2) : arena->initial_size;
+        while (chunk_size < size) {
+            chunk_size *= 2;
+        }
+        arena_chunk_t *new_chunk = malloc(sizeof(arena_chunk_t) + chunk_size);
+        new_chunk->next = chunk;
+        new_chunk->size = chunk_size;
+        new_chunk->used = 0;
+        arena->chunk = chunk = new_chunk;
+    }
+
+    void *p = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+// everything allocated since last reset will fit in one chunk next time
+static MAYBE_UNUSED void arena_reset(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunk;
+    if (chunk == NULL) {
+        return;
+    }
+    if (chunk->next == NULL) {
+        chunk->used = 0;
+        return;
+    }
+
+    size_t size = 0;
+    for (arena_chunk_t *c = chunk; c; c = c->next) {
+        size += c->size;
+    }
+    arena_fini(arena);
+    chunk = malloc(sizeof(arena_chunk_t) + size);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->chunk = chunk;
+}
+
 static MAYBE_UNUSED ATTRIB_FORMAT_PRINTF(1, 2) char *fstr_create(const char *fmt, ...) {
     va_list ap, aq;
     va_start(ap, fmt);
@@ -280,6 +354,88 @@ static MAYBE_UNUSED int nstrcmp(const char *s1, const char *s2) {
 //    return hash;
 //}
 
+static MAYBE_UNUSED ATTRIB_PURE uint64_t fnv1a_hash(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint64_t hash = 0xCBF29CE484222325;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ p[i]) * 0x100000001B3;
+    }
+
+    return hash;
+}
+
+// Locale independent, rejects overlong forms, surrogates and code points above U+10FFFF.
+// Unlike glibc's mbrtoc32 in a UTF-8 locale, which still accepts code points above U+10FFFF
+// (up to 6 byte sequences), text containing them is rejected here.
+// Stops at the first NUL.
+// dest must have room for len code points. Returns the number of code points
+// written or SIZE_MAX if src is not valid UTF-8.
+static MAYBE_UNUSED size_t utf8_to_utf32(char32_t *dest, const char *src, size_t len) {
+    const unsigned char *s = (const unsigned char *)src;
+    size_t i = 0, n = 0;
+    while (i < len) {
+        // 8 ASCII bytes at a time, the widening loop is vectorized by the compiler
+        if ((len - i) >= 8) {
+            uint64_t chunk;
+            memcpy(&chunk, &s[i], sizeof(chunk));
+            bool has_nul = ((chunk - 0x0101010101010101) & ~chunk & 0x8080808080808080) != 0;
+            if (((chunk & 0x8080808080808080) == 0) && !has_nul) {
+                for (size_t k = 0; k < 8; ++k) {
+                    dest[n + k] = s[i + k];
+                }
+                n += 8;
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            if (c == 0) {
+                break;
+            }
+            dest[n++] = c;
+            i++;
+            continue;
+        }
+
+        char32_t cp, min;
+        size_t need;
+        if ((c & 0xE0) == 0xC0) {
+            cp = c & 0x1F;
+            need = 1;
+            min = 0x80;
+        } else if ((c & 0xF0) == 0xE0) {
+            cp = c & 0x0F;
+            need = 2;
+            min = 0x800;
+        } else if ((c & 0xF8) == 0xF0) {
+            cp = c & 0x07;
+            need = 3;
+            min = 0x10000;
+        } else {
+            return SIZE_MAX;
+        }
+        if (need >= (len - i)) {
+            return SIZE_MAX;
+        }
+        for (size_t k = 1; k <= need; ++k) {
+            unsigned char b = s[i + k];
+            if ((b & 0xC0) != 0x80) {
+                return SIZE_MAX;
+            }
+            cp = (cp << 6) | (b & 0x3F);
+        }
+        if ((cp < min) || (cp > 0x10FFFF) || ((cp >= 0xD800) && (cp <= 0xDFFF))) {
+            return SIZE_MAX;
+        }
+        dest[n++] = cp;
+        i += need + 1;
+    }
+
+    return n;
+}
+
 static MAYBE_UNUSED void premultiply_alpha_argb32(uint32_t *p) {
 	uint8_t a = (uint8_t)(*p >> 24) & 0xFF;
 	if (a == 0xFF) {
@@ -300,62 +456,117 @@ static MAYBE_UNUSED void premultiply_alpha_argb32(uint32_t *p) {
 	}
 }
 
-//static MAYBE_UNUSED const uint8_t base64_reverse_lookup[] = {
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255, 62,255,255,255, 63,
-//     52, 53, 54, 55, 56, 57, 58, 59, 60, 61,255,255,255,  0,255,255,
-//    255,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
-//     15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,255,255,255,255,255,
-//    255, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-//     41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//    255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-//};
-
-//static MAYBE_UNUSED void *base64_decode(const char *text, size_t text_len) {
-//    if (text_len % 4 != 0) {
-//        return NULL;
-//    }
-//
-//    uint8_t *ret = malloc(text_len / 4 * 3);
-//
-//    for (size_t i = 0, o = 0; i < text_len; i += 4, o += 3) {
-//        uint32_t a = base64_reverse_lookup[(uint8_t)text[i + 0]];
-//        uint32_t b = base64_reverse_lookup[(uint8_t)text[i + 1]];
-//        uint32_t c = base64_reverse_lookup[(uint8_t)text[i + 2]];
-//        uint32_t d = base64_reverse_lookup[(uint8_t)text[i + 3]];
-//
-//        uint32_t u = a | b | c | d;
-//        if (u & 128) {
-//            goto error;
-//        }
-//
-//        if (u & 64) {
-//            if (i + 4 != text_len || (a | b) & 64 || (c & 64 && !(d & 64))) {
-//                goto error;
-//            }
-//            c &= 63;
-//            d &= 63;
-//        }
-//
-//        uint32_t v = a << 18 | b << 12 | c << 6 | d << 0;
-//        ret[o + 0] = (uint8_t)((v >> 16) & 0xFF);
-//        ret[o + 1] = (uint8_t)((v >> 8) & 0xFF);
-//        ret[o + 2] = (uint8_t)((v >> 0) & 0xFF);
-//    }
-//
-//    return ret;
-//error:
-//    free(ret);
-//    return NULL;
-//}
+// 0x80 - invalid, 0x40 - padding
+static MAYBE_UNUSED const uint8_t base64_reverse_lookup[] = {
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128, 62,128,128,128, 63,
+     52, 53, 54, 55, 56, 57, 58, 59, 60, 61,128,128,128, 64,128,128,
+    128,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+     15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,128,128,128,128,128,
+    128, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+     41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+    128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,128,
+};
+
+static MAYBE_UNUSED ATTRIB_CONST size_t base64_decoded_size(size_t text_len) {
+    return text_len / 4 * 3;
+}
+
+// dest must be at least base64_decoded_size(text_len) bytes.
+// returns the number of decoded bytes or SIZE_MAX on error
+static MAYBE_UNUSED size_t base64_decode(uint8_t *dest, const char *text, size_t text_len) {
+    if ((text_len % 4) != 0) {
+        return SIZE_MAX;
+    }
+
+    const uint8_t *t = (const uint8_t *)text;
+    size_t i = 0, o = 0;
+
+    // 8 characters -> 6 bytes per iteration, single error check for all of them.
+    // the last quad is left for the slow path, because it may contain padding
+    for (; (i + 12) <= text_len; i += 8, o += 6) {
+        uint64_t a = base64_reverse_lookup[t[i + 0]], b = base64_reverse_lookup[t[i + 1]];
+        uint64_t c = base64_reverse_lookup[t[i + 2]], d = base64_reverse_lookup[t[i + 3]];
+        uint64_t e = base64_reverse_lookup[t[i + 4]], f = base64_reverse_lookup[t[i + 5]];
+        uint64_t g = base64_reverse_lookup[t[i + 6]], h = base64_reverse_lookup[t[i + 7]];
+        if ((a | b | c | d | e | f | g | h) & 0xC0) {
+            return SIZE_MAX;
+        }
+
+        uint64_t v = a << 42 | b << 36 | c << 30 | d << 24 | e << 18 | f << 12 | g << 6 | h;
+        dest[o + 0] = (uint8_t)(v >> 40);
+        dest[o + 1] = (uint8_t)(v >> 32);
+        dest[o + 2] = (uint8_t)(v >> 24);
+        dest[o + 3] = (uint8_t)(v >> 16);
+        dest[o + 4] = (uint8_t)(v >> 8);
+        dest[o + 5] = (uint8_t)(v >> 0);
+    }
+
+    for (; i < text_len; i += 4) {
+        uint32_t a = base64_reverse_lookup[t[i + 0]], b = base64_reverse_lookup[t[i + 1]];
+        uint32_t c = base64_reverse_lookup[t[i + 2]], d = base64_reverse_lookup[t[i + 3]];
+
+        uint32_t u = a | b | c | d;
+        if (u & 128) {
+            return SIZE_MAX;
+        }
+
+        if (u & 64) {
+            if (((i + 4) != text_len) || ((a | b) & 64) || ((c & 64) && !(d & 64))) {
+                return SIZE_MAX;
+            }
+            uint32_t v = a << 18 | b << 12 | (c & 63) << 6;
+            dest[o++] = (uint8_t)((v >> 16) & 0xFF);
+            if (!(c & 64)) {
+                dest[o++] = (uint8_t)((v >> 8) & 0xFF);
+            }
+            break;
+        }
+
+        uint32_t v = a << 18 | b << 12 | c << 6 | d << 0;
+        dest[o + 0] = (uint8_t)((v >> 16) & 0xFF);
+        dest[o + 1] = (uint8_t)((v >> 8) & 0xFF);
+        dest[o + 2] = (uint8_t)((v >> 0) & 0xFF);
+        o += 3;
+    }
+
+    return o;
+}
+
+// returns NUL-terminated string
+static MAYBE_UNUSED char *base64_encode(const void *data, size_t len) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t *d = data;
+    char *ret = malloc((len + 2) / 3 * 4 + 1), *p = ret;
+
+    size_t i = 0;
+    for (; (i + 3) <= len; i += 3) {
+        uint32_t v = (uint32_t)d[i] << 16 | (uint32_t)d[i + 1] << 8 | (uint32_t)d[i + 2];
+        *p++ = alphabet[(v >> 18) & 63];
+        *p++ = alphabet[(v >> 12) & 63];
+        *p++ = alphabet[(v >> 6) & 63];
+        *p++ = alphabet[v & 63];
+    }
+    if (i < len) {
+        uint32_t v = (uint32_t)d[i] << 16 | (((i + 1) < len) ? (uint32_t)d[i + 1] << 8 : 0);
+        *p++ = alphabet[(v >> 18) & 63];
+        *p++ = alphabet[(v >> 12) & 63];
+        *p++ = ((i + 1) < len) ? alphabet[(v >> 6) & 63] : '=';
+        *p++ = '=';
+    }
+    *p = '\0';
+
+    return ret;
+}
 
 static MAYBE_UNUSED ATTRIB_FORMAT_PRINTF(1, 0) void log_stderr_va(const char *fmt, va_list args) {
     fputs(LOG_PREFIX, stderr);
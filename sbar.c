@@ -17,14 +17,17 @@
 #include <time.h>
 #include <limits.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include <wayland-client.h>
 #include <wayland-util.h>
 #include <fcft/fcft.h>
 #include <pixman.h>
 #include <json_object.h>
-#include <json_tokener.h>
 #include "wlr-layer-shell-unstable-v1-protocol.h"
 #include "xdg-shell-protocol.h"
 #include "cursor-shape-v1-protocol.h"
@@ -33,14 +36,23 @@
 #include <resvg.h>
 #endif // HAVE_SVG
 
-#if HAVE_PNG
-#include <png.h>
-#include <setjmp.h>
-#endif // HAVE_PNG
-
 #include "sbar.h"
 
 #include "util.h"
+#include "arena-json.h"
+#include "sbar-schema.h"
+#include "json-writer.h"
+#include "image-decode.h"
+
+// linux memfd seals, hidden behind _GNU_SOURCE in glibc
+#if !defined(F_GET_SEALS)
+#define F_GET_SEALS 1034
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_WRITE 0x0008
+#endif // !F_GET_SEALS
+#if !defined(MSG_CMSG_CLOEXEC)
+#define MSG_CMSG_CLOEXEC 0x40000000
+#endif // !MSG_CMSG_CLOEXEC
 
 struct output {
 	uint32_t wl_name;
@@ -48,8 +60,7 @@ struct output {
 	enum wl_output_transform transform;
 	struct wl_output *wl_output;
 	char *name;
-
-	ptr_array_t bars; // struct surface * , NULL
+	uint64_t state_generation;
 };
 
 struct box {
@@ -67,8 +78,10 @@ struct surface {
 	union {
 		struct { // bar
 			struct output *output;
+			struct client *client;
 			struct zwlr_layer_surface_v1 *layer_surface;
 			int32_t exclusive_zone;
+			int32_t config_exclusive_zone; // < 0 if auto
 			int32_t margins[4]; // top, right, bottom, left
 			enum zwlr_layer_surface_v1_anchor anchor;
 			enum zwlr_layer_shell_v1_layer layer;
@@ -92,6 +105,8 @@ struct surface {
 	struct buffer *buffer;
 	int32_t width, height;
 	int32_t wanted_width, wanted_height;
+	int32_t config_width, config_height; // 0 if computed from blocks
+	uint64_t id;
 	enum wp_cursor_shape_device_v1_shape cursor_shape;
 	int32_t scale;
 	bool vertical, render, dirty;
@@ -102,6 +117,7 @@ struct surface {
 	ptr_array_t popups; // struct surface * , NULL
 
 	json_object *userdata;
+	uint64_t state_generation; // geometry and block boxes, not popups
 };
 
 struct pointer {
@@ -121,17 +137,23 @@ struct pointer {
 		wl_fixed_t vector_length;
 		enum wl_pointer_axis axis;
 	} scroll;
+	struct {
+		struct client *left_client; // its surface lost focus in this frame
+		uint32_t changes; // enum sbar_state_events_mask
+	} frame;
+	uint64_t state_generation; // focus, button, scroll
 };
 
 struct seat {
 	struct wl_seat *wl_seat;
 	char *name;
-	uint32_t wl_name;
+	uint32_t wl_name, version;
 	struct pointer pointer;
 	struct {
 		uint8_t index;
 		array_t serials; // uint32_t  wl_pointer_button, TODO: wl_touch_down/up,
 	} popup_grab;
+	uint64_t state_generation;
 };
 
 struct buffer {
@@ -143,14 +165,42 @@ struct buffer {
 	struct surface *surface;
 };
 
+// layouts fitted to a width, shared blocks can be fitted to several widths at once
+#define TEXT_FIT_CACHE_LEN 4
+
+struct text_fit_entry {
+	int32_t width;
+	struct text_layout *layout;
+	pixman_image_t *image; // for scaled or transformed content, rendered if needed
+};
+
+// text that is fitted to the width available in block_get_size(), block->layout stays natural
+struct text_fit {
+	const char *text, *short_text; // in block json or following the struct, short_text may be NULL
+	size_t text_len, short_text_len;
+	uint32_t color;
+	enum sbar_block_type_text_ellipsize ellipsize;
+	bool wrap;
+	bool content_width_auto, content_height_auto;
+	size_t entries_len;
+	struct text_fit_entry entries[TEXT_FIT_CACHE_LEN]; // most recently used first
+};
+
 struct block {
 	enum sbar_block_type type;
 	union {
 		struct { // text
-			struct fcft_font *font; // fcft ref count
+			struct font_cache *font;
+			struct font_cache *placeholder_font; // lays out text while font is pending
+			struct text_layout *layout; // content_image is only rendered if needed
+			struct text_fit *fit; // NULL if text is never fitted
+			struct font_cache **span_fonts; // rich text, "span_fonts"
+			size_t span_fonts_len;
 		};
 		struct { // composite
 			ptr_array_t blocks; // struct block *
+			array_t block_boxes; // struct block_box , relative to top left of content
+			int32_t composite_width, composite_height;
 		};
 	};
 
@@ -170,6 +220,9 @@ struct block {
 
 	uint32_t ref_count;
 	uint64_t id;
+	struct client *client; // set if id > 0
+	arena_t json_arena;
+	const struct arena_json *json; // copy of source in json_arena, NULL unless top level
 };
 
 #define border_left borders[0]
@@ -181,17 +234,121 @@ struct block_box {
 	int32_t x, y;
 	int32_t width, height;
 	int32_t content_width, content_height;
+	int32_t fit_width; // text is fitted to this width, 0 if it is natural
 };
 
 struct image_cache {
-	char *path;
+	char *path; // NULL for inline data
 	struct timespec mtim_ts;
+	char *data; // base64, compared on hash match
+	uint64_t data_hash;
+	size_t data_len;
+	enum sbar_block_type_image_image_type image_type;
 	pixman_image_t *image;
 };
 
-static char *stdin_buffer, *stdout_buffer;
-static size_t stdin_buffer_size, stdin_buffer_index;
-static size_t stdout_buffer_size, stdout_buffer_index;
+struct font_cache {
+	uint64_t id; // unique, font_key for glyph_cache
+	char *key; // font names followed by attributes, each NUL terminated
+	size_t key_len, names_len;
+	uint64_t key_hash;
+	struct fcft_font *font; // NULL while pending or if resolving failed
+	bool pending; // font is being resolved by font_worker
+	bool queued; // owned by font_worker until font_worker_read(), entry must not be freed
+	struct fcft_font *resolved; // set by font_worker, protected by its mutex
+	uint32_t ref_count; // blocks using font
+	struct timespec unused_since; // CLOCK_MONOTONIC, set when ref_count drops to 0
+};
+
+struct text_glyph {
+	const struct fcft_glyph *glyph; // owned by the font
+	int32_t x, y; // pen position on the baseline, relative to top left of the layout
+};
+
+// consecutive glyphs of a text_layout drawn with the same font and color
+struct text_layout_run {
+	struct font_cache *font;
+	pixman_image_t *color; // solid fill
+	size_t glyphs_len;
+	int32_t x, width; // extent of the underline
+	int32_t underline_y, underline_thickness; // thickness is 0 if not underlined
+};
+
+// shaped text, composited from glyph_cache at render time
+struct text_layout {
+	uint32_t ref_count;
+	struct font_cache *font; // font of text, first span font for rich text
+	int32_t width, height;
+	size_t runs_len;
+	struct text_layout_run *runs;
+	size_t glyphs_len;
+	struct text_glyph *glyphs;
+	pixman_glyph_t *pixman_glyphs; // glyphs_len, filled by text_layout_draw()
+};
+
+struct text_cache {
+	list_t link; // text_cache_lru, most recently used first
+	struct text_cache *next; // same bucket
+	uint64_t hash;
+	struct font_cache *font;
+	uint32_t color; // argb32
+	enum fcft_subpixel subpixel;
+	char *text; // utf-8
+	size_t text_len;
+	struct text_layout *layout;
+};
+
+struct image_fd {
+	char *handle;
+	int fd;
+	enum sbar_block_type_image_image_type image_type;
+	pixman_image_t *image; // NULL until first used by a block
+};
+
+struct client_output {
+	struct output *output;
+	ptr_array_t bars; // struct surface * , NULL
+};
+
+enum client_message_type {
+	CLIENT_MESSAGE_TYPE_EVENT,
+	CLIENT_MESSAGE_TYPE_STATE_DELTA, // replaced by newer state while not being written
+	CLIENT_MESSAGE_TYPE_STATE, // full state, replaced only by newer full state
+	CLIENT_MESSAGE_TYPE_REPLY, // answer to a request, dropped like events
+};
+
+struct client_message {
+	struct json_writer writer;
+	enum client_message_type type;
+};
+
+struct client {
+	int read_fd, write_fd;
+	char *read_buffer; // incomplete line
+	size_t read_buffer_size, read_buffer_len;
+	arena_t parse_arena; // message being parsed
+	arena_t pending_arena; // messages in pending_json
+	array_t pending_json; // struct arena_json , read in current client_read()
+	// ring of messages waiting for client_flush(), buffers are reused
+	struct client_message *write_queue;
+	size_t write_queue_size, write_queue_head, write_queue_len; // size is a power of 2
+	size_t write_offset; // already written bytes of the first message
+	size_t write_queued; // bytes waiting to be written
+	size_t write_capacity; // allocated bytes of all write_queue buffers
+	bool write_dropping;
+
+	bool state_events;
+	bool pointer_events;
+	uint32_t state_events_mask; // enum sbar_state_events_mask, also applies to pointer events
+	bool state_delta;
+	bool state_snapshot; // next state event is not a delta
+	uint32_t state_deltas_since_snapshot;
+	uint64_t state_acked_generation;
+	json_object *userdata;
+
+	ptr_array_t outputs; // struct client_output *
+	ptr_array_t blocks_with_id; // struct block *
+};
 
 static struct wl_display *wl_display;
 static struct wl_registry *wl_registry;
@@ -203,20 +360,85 @@ static struct wp_cursor_shape_manager_v1 *wp_cursor_shape_manager_v1;
 
 static ptr_array_t outputs; // struct output *
 static ptr_array_t seats; // struct seat *
-static ptr_array_t blocks_with_id; // struct block *
-static ptr_array_t image_cache; // struct image_cache *
-
-static bool state_events = false;
-static json_object *state_userdata;
-static bool state_dirty = false;
+static ptr_array_t clients; // struct client * , first one is stdin/stdout
+static ptr_array_t image_cache; // struct image_cache * , most recently used first
+static size_t image_cache_data_size; // sum of image_cache data_len
+static ptr_array_t image_fds; // struct image_fd *
+static ptr_array_t font_cache; // struct font_cache *
+static struct {
+	uint64_t lookups, misses, evictions;
+} font_cache_stats;
+
+// unused fonts are destroyed after this many seconds
+#define FONT_CACHE_IDLE_SECONDS 60
+
+// resolves fonts off the main thread, fontconfig can take tens of ms per font
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	ptr_array_t requests; // struct font_cache *
+	ptr_array_t results; // struct font_cache *
+	int wake_fds[2]; // pipe, read end is polled by the main loop
+	bool stop;
+} font_worker;
+
+
+#define IMAGE_CACHE_MAX_LEN 64
+#define IMAGE_CACHE_MAX_DATA_SIZE (16 * 1024 * 1024)
+
+#define TEXT_CACHE_BUCKETS 256 // power of 2
+#define TEXT_CACHE_MAX_LEN 512
+
+// text layouts, shared with text blocks
+static struct {
+	struct text_cache *buckets[TEXT_CACHE_BUCKETS];
+	list_t lru; // struct text_cache::link
+	size_t len;
+	uint64_t lookups, misses;
+} text_cache;
+
+static pixman_glyph_cache_t *glyph_cache;
+static array_t text_scratch; // char32_t , decoded text of text_layout_create()
+
+static struct arena_json_parser json_parser;
+
+// bytes waiting to be written to a client above which unwritten events are dropped
+static size_t client_write_limit = 4 * 1024 * 1024;
+
+// write_capacity above client_write_limit times this drops unwritten events too,
+// so memory kept by large messages stays bounded
+#define CLIENT_WRITE_CAPACITY_FACTOR 2
+#define CLIENT_WRITE_QUEUE_MIN_LEN 4 // power of 2, ring is shrunk back to it once drained
+#define CLIENT_WRITE_QUEUE_MAX_LEN 256 // messages above which unwritten events are dropped
+#define CLIENT_MESSAGE_MIN_SIZE 4096 // larger buffers are released once written or dropped
+
+static char *image_socket_path;
+
+#define IMAGE_FDS_MAX_LEN 256 // fds kept for the image socket connection, more are rejected
+// rasterized for every new font, so first frames don't hit the rasterizer cold
+static char32_t *prewarm_glyphs;
+static size_t prewarm_glyphs_len;
+static char *server_socket_path;
+
+static uint32_t state_dirty = 0; // enum sbar_state_events_mask, changed parts of the state
+static uint64_t state_generation = 0;
+
+// full snapshot is sent after this many deltas, even if client did not ask for one
+#define STATE_SNAPSHOT_INTERVAL 256
+
+#define STATE_EVENTS_MASK_SURFACES \
+	(SBAR_STATE_EVENTS_MASK_SURFACES | SBAR_STATE_EVENTS_MASK_BLOCKS)
+#define STATE_EVENTS_MASK_SEATS (SBAR_STATE_EVENTS_MASK_POINTER_MOTION \
+	| SBAR_STATE_EVENTS_MASK_POINTER_BUTTON | SBAR_STATE_EVENTS_MASK_POINTER_SCROLL)
 
 static bool running = true;
 
-static struct pollfd poll_fds[] = {
-	{ .fd = STDIN_FILENO, .events = POLLIN },
-	{ .fd = -1, .events = POLLOUT }, // stdout
-	{ .fd = -1, .events = POLLIN }, // wayland
-};
+#define POLL_FDS_FIXED_LEN 7
+
+// fixed ones, followed by one for each socket client (same order as clients[1..])
+static struct pollfd *poll_fds;
+static nfds_t poll_fds_len;
 
 static ATTRIB_PURE struct surface *surface_get_bar(struct surface *surface) {
 	while (surface->type == SURFACE_TYPE_POPUP) {
@@ -228,9 +450,111 @@ static ATTRIB_PURE struct surface *surface_get_bar(struct surface *surface) {
 #if HAVE_SVG
 static pixman_image_t *render_svg(resvg_render_tree *tree, int32_t target_width, int32_t target_height);
 #endif // HAVE_SVG
+static void text_layout_draw(struct text_layout *layout, pixman_image_t *dest,
+	int32_t x, int32_t y);
+static pixman_image_t *text_layout_render_image(struct text_layout *layout);
+static struct text_fit_entry *block_fit_text(struct block *block, int32_t width);
+static void text_fit_clear(struct text_fit *fit);
+static bool block_relayout_text(struct block *block);
+
+// content_width/height from the content itself, before content_transform
+static bool block_get_natural_size(struct block *block, int32_t *width, int32_t *height) {
+	if (block->content_image) {
+		*width = pixman_image_get_width(block->content_image);
+		*height = pixman_image_get_height(block->content_image);
+		return true;
+	}
+	if ((block->type == SBAR_BLOCK_TYPE_TEXT) && block->layout) {
+		*width = block->layout->width;
+		*height = block->layout->height;
+		return true;
+	}
+	if (block->type == SBAR_BLOCK_TYPE_COMPOSITE) {
+		*width = block->composite_width;
+		*height = block->composite_height;
+		return true;
+	}
+
+	return false;
+}
+
+// top left corner of content in dest
+static bool block_get_content_position(struct block *block, struct block_box *box,
+		int32_t *x, int32_t *y) {
+	int32_t available_width = box->width - block->border_left.width - block->border_right.width;
+	int32_t available_height = box->height - block->border_bottom.width - block->border_top.width;
+	int32_t content_x = box->x + block->border_left.width;
+	int32_t content_y = box->y + block->border_top.width;
+	switch (block->content_anchor) {
+	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_TOP:
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_CENTER:
+		content_y += ((available_height - box->content_height) / 2);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_BOTTOM:
+		content_y += (available_height - box->content_height);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_TOP:
+		content_x += ((available_width - box->content_width) / 2);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_CENTER:
+		content_x += ((available_width - box->content_width) / 2);
+		content_y += ((available_height - box->content_height) / 2);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_BOTTOM:
+		content_x += ((available_width - box->content_width) / 2);
+		content_y += (available_height - box->content_height);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_TOP:
+		content_x += (available_width - box->content_width);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_CENTER:
+		content_x += (available_width - box->content_width);
+		content_y += ((available_height - box->content_height) / 2);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_BOTTOM:
+		content_x += (available_width - box->content_width);
+		content_y += (available_height - box->content_height);
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_DEFAULT:
+	default:
+		assert(UNREACHABLE);
+		return false;
+	}
+	if (content_x < block->border_left.width) {
+		content_x = block->border_left.width;
+	}
+	if (content_y < block->border_top.width) {
+		content_y = block->border_top.width;
+	}
+	*x = content_x;
+	*y = content_y;
+
+	return true;
+}
+
+static void block_render(pixman_image_t *dest, struct block *block,
+	struct block_box *box, pixman_region32_t *clip);
+
+static pixman_image_t *composite_render_image(struct block *block) {
+	if ((block->composite_width <= 0) || (block->composite_height <= 0)) {
+		return NULL;
+	}
+	pixman_image_t *image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+		block->composite_width, block->composite_height, NULL, block->composite_width * 4);
+	if (image) {
+		for (size_t i = 0; i < block->blocks.len; ++i) {
+			block_render(image, block->blocks.items[i],
+				&((struct block_box *)block->block_boxes.items)[i], NULL);
+		}
+	}
 
+	return image;
+}
+
+// clip is the clip region of dest, or NULL if there is none
 static void block_render(pixman_image_t *dest, struct block *block,
-		struct block_box *box) {
+		struct block_box *box, pixman_region32_t *clip) {
 	if (block->color) {
 		pixman_image_composite32(PIXMAN_OP_OVER, block->color, NULL, dest,
 			0, 0, 0, 0,
@@ -266,12 +590,78 @@ static void block_render(pixman_image_t *dest, struct block *block,
 			block->border_top.width);
 	}
 
-	if (block->content_image) {
+	pixman_image_t *content_image = block->content_image;
+	if (block->type == SBAR_BLOCK_TYPE_TEXT) {
+		struct text_layout *layout = block->layout;
+		pixman_image_t **image = &block->content_image;
+		if (block->fit && (box->fit_width > 0)) {
+			struct text_fit_entry *entry = block_fit_text(block, box->fit_width);
+			layout = entry->layout;
+			image = &entry->image;
+		}
+		if ((*image == NULL) && (block->content_transform == SBAR_BLOCK_CONTENT_TRANSFORM_NORMAL)
+				&& (box->content_width == layout->width)
+				&& (box->content_height == layout->height)) {
+			int32_t content_x, content_y;
+			if (!block_get_content_position(block, box, &content_x, &content_y)) {
+				return;
+			}
+			pixman_region32_t content_clip;
+			pixman_region32_init_rect(&content_clip, content_x, content_y,
+				(unsigned)box->content_width, (unsigned)box->content_height);
+			if (clip) {
+				pixman_region32_intersect(&content_clip, &content_clip, clip);
+			}
+			pixman_image_set_clip_region32(dest, &content_clip);
+			text_layout_draw(layout, dest, content_x, content_y);
+			pixman_image_set_clip_region32(dest, clip);
+			pixman_region32_fini(&content_clip);
+			return;
+		}
+		// scaled or transformed text goes through an image, rendered once
+		if (*image == NULL) {
+			*image = text_layout_render_image(layout);
+		}
+		content_image = *image;
+	}
+
+	if ((block->type == SBAR_BLOCK_TYPE_COMPOSITE) && (block->content_image == NULL)) {
+		if ((block->content_transform == SBAR_BLOCK_CONTENT_TRANSFORM_NORMAL)
+				&& (box->content_width == block->composite_width)
+				&& (box->content_height == block->composite_height)) {
+			// children are drawn straight into dest, clipped to the content box
+			int32_t content_x, content_y;
+			if (!block_get_content_position(block, box, &content_x, &content_y)) {
+				return;
+			}
+			pixman_region32_t content_clip;
+			pixman_region32_init_rect(&content_clip, content_x, content_y,
+				(unsigned)box->content_width, (unsigned)box->content_height);
+			if (clip) {
+				pixman_region32_intersect(&content_clip, &content_clip, clip);
+			}
+			pixman_image_set_clip_region32(dest, &content_clip);
+			for (size_t i = 0; i < block->blocks.len; ++i) {
+				struct block_box child_box = ((struct block_box *)block->block_boxes.items)[i];
+				child_box.x += content_x;
+				child_box.y += content_y;
+				block_render(dest, block->blocks.items[i], &child_box, &content_clip);
+			}
+			pixman_image_set_clip_region32(dest, clip);
+			pixman_region32_fini(&content_clip);
+			return;
+		}
+		// scaled or transformed composite is flattened once and kept as content_image
+		block->content_image = composite_render_image(block);
+		content_image = block->content_image;
+	}
+
+	if (content_image) {
 		pixman_transform_t transform;
 		pixman_transform_init_identity(&transform);
 
-		int content_image_width = pixman_image_get_width(block->content_image);
-		int content_image_height = pixman_image_get_height(block->content_image);
+		int content_image_width = pixman_image_get_width(content_image);
+		int content_image_height = pixman_image_get_height(content_image);
 		if ((block->content_transform % 2) == 0) {
 			int32_t tmp = content_image_width;
 			content_image_width = content_image_height;
@@ -281,12 +671,12 @@ static void block_render(pixman_image_t *dest, struct block *block,
 		if ((box->content_width != content_image_width)
 				|| (box->content_height != content_image_height)) {
 #if HAVE_SVG
-			resvg_render_tree *svg_tree = pixman_image_get_destroy_data(block->content_image);
+			resvg_render_tree *svg_tree = pixman_image_get_destroy_data(content_image);
 			if (svg_tree) {
 				pixman_image_t *image = render_svg(svg_tree, box->content_width, box->content_height);
 				if (image) {
 					pixman_image_unref(block->content_image);
-					block->content_image = image;
+					block->content_image = content_image = image;
 				}
 			} else
 #endif // HAVE_SVG
@@ -303,20 +693,20 @@ static void block_render(pixman_image_t *dest, struct block *block,
 		case SBAR_BLOCK_CONTENT_TRANSFORM_FLIPPED_90:
 			pixman_transform_rotate(&transform, NULL, 0, pixman_fixed_1);
 			pixman_transform_translate(&transform, NULL,
-				pixman_int_to_fixed(pixman_image_get_width(block->content_image)), 0);
+				pixman_int_to_fixed(pixman_image_get_width(content_image)), 0);
 			break;
 		case SBAR_BLOCK_CONTENT_TRANSFORM_180:
 		case SBAR_BLOCK_CONTENT_TRANSFORM_FLIPPED_180:
 			pixman_transform_rotate(&transform, NULL, pixman_fixed_minus_1, 0);
 			pixman_transform_translate(&transform, NULL,
-				pixman_int_to_fixed(pixman_image_get_width(block->content_image)),
-				pixman_int_to_fixed(pixman_image_get_height(block->content_image)));
+				pixman_int_to_fixed(pixman_image_get_width(content_image)),
+				pixman_int_to_fixed(pixman_image_get_height(content_image)));
 			break;
 		case SBAR_BLOCK_CONTENT_TRANSFORM_270:
 		case SBAR_BLOCK_CONTENT_TRANSFORM_FLIPPED_270:
 			pixman_transform_rotate(&transform, NULL, 0, pixman_fixed_minus_1);
 			pixman_transform_translate(&transform, NULL, 0,
-				pixman_int_to_fixed(pixman_image_get_height(block->content_image)));
+				pixman_int_to_fixed(pixman_image_get_height(content_image)));
 			break;
 		case SBAR_BLOCK_CONTENT_TRANSFORM_DEFAULT:
 		default:
@@ -325,59 +715,17 @@ static void block_render(pixman_image_t *dest, struct block *block,
 
 		if (block->content_transform >= SBAR_BLOCK_CONTENT_TRANSFORM_FLIPPED) {
 			pixman_transform_translate(&transform, NULL,
-				-pixman_int_to_fixed(pixman_image_get_width(block->content_image)), 0);
+				-pixman_int_to_fixed(pixman_image_get_width(content_image)), 0);
 			pixman_transform_scale(&transform, NULL, pixman_fixed_minus_1, pixman_fixed_1);
 		}
 
-		pixman_image_set_transform(block->content_image, &transform);
+		pixman_image_set_transform(content_image, &transform);
 
-		int32_t available_width = box->width - block->border_left.width - block->border_right.width;
-		int32_t available_height = box->height - block->border_bottom.width - block->border_top.width;
-		int32_t content_x = box->x + block->border_left.width;
-		int32_t content_y = box->y + block->border_top.width;
-		switch (block->content_anchor) {
-		case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_TOP:
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_CENTER:
-			content_y += ((available_height - box->content_height) / 2);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_BOTTOM:
-			content_y += (available_height - box->content_height);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_TOP:
-			content_x += ((available_width - box->content_width) / 2);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_CENTER:
-			content_x += ((available_width - box->content_width) / 2);
-			content_y += ((available_height - box->content_height) / 2);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_BOTTOM:
-			content_x += ((available_width - box->content_width) / 2);
-			content_y += (available_height - box->content_height);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_TOP:
-			content_x += (available_width - box->content_width);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_CENTER:
-			content_x += (available_width - box->content_width);
-			content_y += ((available_height - box->content_height) / 2);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_BOTTOM:
-			content_x += (available_width - box->content_width);
-			content_y += (available_height - box->content_height);
-			break;
-		case SBAR_BLOCK_CONTENT_ANCHOR_DEFAULT:
-		default:
-			assert(UNREACHABLE);
+		int32_t content_x, content_y;
+		if (!block_get_content_position(block, box, &content_x, &content_y)) {
 			return;
 		}
-		if (content_x < block->border_left.width) {
-			content_x = block->border_left.width;
-		}
-		if (content_y < block->border_top.width) {
-			content_y = block->border_top.width;
-		}
-		pixman_image_composite32(PIXMAN_OP_OVER, block->content_image, NULL, dest,
+		pixman_image_composite32(PIXMAN_OP_OVER, content_image, NULL, dest,
 			0, 0, 0, 0, content_x, content_y,
 			box->content_width, box->content_height);
 	}
@@ -492,6 +840,27 @@ static void block_get_size(struct block *block, struct surface *surface,
 		}
 	}
 
+	int32_t fit_width = 0;
+	if ((block->type == SBAR_BLOCK_TYPE_TEXT) && block->fit && block->fit->content_width_auto
+			&& ((block->content_transform % 2) == 1)) {
+		// text is fitted to max_width, or to the width of vertical surfaces
+		fit_width = max_width;
+		if ((fit_width <= 0) && surface && surface->vertical) {
+			fit_width = surface->width;
+		}
+		if (fit_width > 0) {
+			fit_width -= block->border_left.width + block->border_right.width;
+			if (fit_width <= 0) {
+				fit_width = 1;
+			}
+			struct text_layout *layout = block_fit_text(block, fit_width)->layout;
+			content_width = layout->width;
+			if (block->fit->content_height_auto) {
+				content_height = layout->height;
+			}
+		}
+	}
+
 	if ((block->content_transform % 2) == 0) {
 		int32_t tmp = content_width;
 		content_width = content_height;
@@ -532,9 +901,14 @@ static void block_get_size(struct block *block, struct surface *surface,
 		.height = height,
 		.content_width = content_width,
 		.content_height = content_height,
+		.fit_width = fit_width,
 	};
 }
 
+static void state_touch(uint64_t *generation) {
+	*generation = ++state_generation;
+}
+
 static void surface_render(struct surface *surface) {
 	if (surface->render) {
 		if (surface->buffer->busy) {
@@ -605,7 +979,7 @@ static void surface_render(struct surface *surface) {
 				return;
 			}
 			if (surface->render) {
-				block_render(surface->buffer->image, block, box);
+				block_render(surface->buffer->image, block, box, NULL);
 			}
 		}
 	}
@@ -619,166 +993,899 @@ static void surface_render(struct surface *surface) {
 	}
 
 	surface->dirty = false;
-	state_dirty = true;
+	state_touch(&surface->state_generation);
+	state_dirty |= STATE_EVENTS_MASK_SURFACES;
 }
 
-static void block_unref(struct block *block) {
-	if ((block == NULL) || (--block->ref_count > 0)) {
+static pixman_color_t parse_color_argb32(uint32_t color) {
+	premultiply_alpha_argb32(&color);
+	return (pixman_color_t) {
+			.alpha = (uint16_t)(((color >> 24) & 0xFF) * 257),
+			.red = (uint16_t)(((color >> 16) & 0xFF) * 257),
+			.green = (uint16_t)(((color >> 8) & 0xFF) * 257),
+			.blue = (uint16_t)(((color >> 0) & 0xFF) * 257),
+	};
+}
+
+static void text_layout_unref(struct text_layout *layout) {
+	if ((layout == NULL) || (--layout->ref_count > 0)) {
 		return;
 	}
 
-	switch (block->type) {
-	case SBAR_BLOCK_TYPE_TEXT:
-		fcft_destroy(block->font);
-		break;
-	case SBAR_BLOCK_TYPE_COMPOSITE:
-		for (size_t i = 0; i < block->blocks.len; ++i) {
-			block_unref(block->blocks.items[i]);
-		}
-		ptr_array_fini(&block->blocks);
-		break;
-	case SBAR_BLOCK_TYPE_IMAGE:
-	case SBAR_BLOCK_TYPE_DEFAULT:
-	case SBAR_BLOCK_TYPE_SPACER:
-	default:
-		break;
+	for (size_t i = 0; i < layout->runs_len; ++i) {
+		pixman_image_unref(layout->runs[i].color);
 	}
+	free(layout->runs);
+	free(layout->glyphs);
+	free(layout->pixman_glyphs);
 
-	if (block->content_image) {
-		pixman_image_unref(block->content_image);
+	free(layout);
+}
+
+// text wider than max_width is wrapped into lines at spaces if wrap is set,
+// otherwise it is ellipsized. max_width <= 0 means single line of any width
+static struct text_layout *text_layout_create(struct font_cache *font, const char *raw_text,
+		size_t raw_text_len, uint32_t color, enum fcft_subpixel subpixel,
+		int32_t max_width, enum sbar_block_type_text_ellipsize ellipsize, bool wrap) {
+	if (text_scratch.size < raw_text_len) {
+		array_resize(&text_scratch, raw_text_len);
+	}
+	char32_t *text = text_scratch.items;
+	size_t text_len = utf8_to_utf32(text, raw_text, raw_text_len);
+	if (text_len == SIZE_MAX) {
+		log_stderr("text is not valid UTF-8");
+		return NULL;
 	}
-	if (block->color) {
-		pixman_image_unref(block->color);
+
+	struct fcft_text_run *text_run = fcft_rasterize_text_run_utf32(
+			font->font, text_len, text, subpixel);
+	if (text_run == NULL) {
+		log_stderr("fcft_rasterize_text_run_utf32 failed");
+		return NULL;
 	}
 
-	for (size_t i = 0; i < LENGTH(block->borders); ++i) {
-		if (block->borders[i].color) {
-			pixman_image_unref(block->borders[i].color);
+	struct text_layout *layout = calloc(1, sizeof(struct text_layout));
+	layout->ref_count = 1;
+	layout->font = font;
+	layout->height = font->font->height;
+	// + ellipsis
+	layout->glyphs = malloc((text_run->count + 1) * sizeof(struct text_glyph));
+	layout->pixman_glyphs = malloc((text_run->count + 1) * sizeof(pixman_glyph_t));
+	pixman_color_t text_color = parse_color_argb32(color);
+	layout->runs_len = 1;
+	layout->runs = calloc(1, sizeof(struct text_layout_run));
+	layout->runs[0].font = font;
+	layout->runs[0].color = pixman_image_create_solid_fill(&text_color);
+
+	int32_t run_width = 0;
+	for (size_t i = 0; i < text_run->count; ++i) {
+		run_width += text_run->glyphs[i]->advance.x;
+	}
+	if ((max_width <= 0) || (run_width <= max_width)) {
+		wrap = false;
+		ellipsize = SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE;
+	}
+
+	int32_t x = 0, y = font->font->height - font->font->descent;
+	if (wrap) {
+		// greedy, glyphs after the last space move to the next line once a glyph does not fit
+		size_t line_start = 0, space = SIZE_MAX;
+		int32_t space_x = 0, width = 0;
+		for (size_t i = 0; i < text_run->count; ++i) {
+			const struct fcft_glyph *glyph = text_run->glyphs[i];
+			bool is_space = (text[text_run->cluster[i]] == U' ');
+			if (is_space) {
+				space = i;
+				space_x = x;
+			} else if (((x + glyph->advance.x) > max_width) && (i > line_start)) {
+				size_t next_line_start = i;
+				int32_t line_width = x;
+				if ((space != SIZE_MAX) && (space >= line_start)) {
+					next_line_start = space + 1;
+					line_width = space_x;
+				}
+				int32_t dx = (next_line_start < i) ? layout->glyphs[next_line_start].x : x;
+				for (size_t j = next_line_start; j < i; ++j) {
+					layout->glyphs[j].x -= dx;
+					layout->glyphs[j].y += font->font->height;
+				}
+				if (line_width > width) {
+					width = line_width;
+				}
+				x -= dx;
+				y += font->font->height;
+				layout->height += font->font->height;
+				line_start = next_line_start;
+				space = SIZE_MAX;
+			}
+			layout->glyphs[i] = (struct text_glyph){
+				.glyph = glyph,
+				.x = x,
+				.y = y,
+			};
+			x += glyph->advance.x;
+		}
+		layout->glyphs_len = text_run->count;
+		layout->width = (x > width) ? x : width;
+	} else if (ellipsize > SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE) {
+		const struct fcft_glyph *ellipsis = fcft_rasterize_char_utf32(font->font, U'\u2026', subpixel);
+		int32_t budget = max_width - (ellipsis ? ellipsis->advance.x : 0);
+		int32_t head_budget;
+		switch (ellipsize) {
+		case SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_START:
+			head_budget = 0;
+			break;
+		case SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_MIDDLE:
+			head_budget = budget / 2;
+			break;
+		case SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_END:
+			head_budget = budget;
+			break;
+		case SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_DEFAULT:
+		case SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE:
+		default:
+			assert(UNREACHABLE);
+			head_budget = budget;
 		}
-	}
 
-	if (block->id > 0) {
-		for (size_t i = 0; i < blocks_with_id.len; ++i) {
-			if (block == blocks_with_id.items[i]) {
-				ptr_array_pop(&blocks_with_id, i);
-				break;
+		size_t head_len = 0;
+		while ((head_len < text_run->count)
+				&& ((x + text_run->glyphs[head_len]->advance.x) <= head_budget)) {
+			x += text_run->glyphs[head_len++]->advance.x;
+		}
+		// ellipsis is subtracted once, in budget, head and tail share the rest
+		size_t tail_start = text_run->count;
+		int32_t tail_width = 0;
+		while ((ellipsize != SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_END) && (tail_start > head_len)
+				&& ((x + tail_width + text_run->glyphs[tail_start - 1]->advance.x) <= budget)) {
+			tail_width += text_run->glyphs[--tail_start]->advance.x;
+		}
+
+		x = 0;
+		size_t n = 0;
+		for (size_t i = 0; i < text_run->count; ++i) {
+			if (i == head_len) {
+				if (ellipsis) {
+					layout->glyphs[n++] = (struct text_glyph){ .glyph = ellipsis, .x = x, .y = y };
+					x += ellipsis->advance.x;
+				}
+				i = tail_start;
+				if (i == text_run->count) {
+					break;
+				}
 			}
+			layout->glyphs[n++] = (struct text_glyph){ .glyph = text_run->glyphs[i], .x = x, .y = y };
+			x += text_run->glyphs[i]->advance.x;
+		}
+		if ((head_len == text_run->count) && ellipsis) {
+			layout->glyphs[n++] = (struct text_glyph){ .glyph = ellipsis, .x = x, .y = y };
+			x += ellipsis->advance.x;
 		}
+		layout->glyphs_len = n;
+		layout->width = x;
+	} else {
+		for (size_t i = 0; i < text_run->count; ++i) {
+			const struct fcft_glyph *glyph = text_run->glyphs[i];
+			layout->glyphs[i] = (struct text_glyph){
+				.glyph = glyph,
+				.x = x,
+				.y = y,
+			};
+			x += glyph->advance.x;
+		}
+		layout->glyphs_len = text_run->count;
+		layout->width = x;
 	}
 
-	free(block);
+	layout->runs[0].glyphs_len = layout->glyphs_len;
+	layout->runs[0].width = layout->width;
+
+	// glyphs are owned by the font, not the run
+	fcft_text_run_destroy(text_run);
+
+	return layout;
 }
 
-static pixman_color_t parse_color_argb32(uint32_t color) {
-	premultiply_alpha_argb32(&color);
-	return (pixman_color_t) {
-			.alpha = (uint16_t)(((color >> 24) & 0xFF) * 257),
-			.red = (uint16_t)(((color >> 16) & 0xFF) * 257),
-			.green = (uint16_t)(((color >> 8) & 0xFF) * 257),
-			.blue = (uint16_t)(((color >> 0) & 0xFF) * 257),
-	};
+// composites layout with its top left corner at x, y. clipping is up to the caller
+static void text_layout_draw(struct text_layout *layout, pixman_image_t *dest,
+		int32_t x, int32_t y) {
+	pixman_glyph_cache_freeze(glyph_cache);
+	struct text_glyph *text_glyphs = layout->glyphs;
+	for (size_t r = 0; r < layout->runs_len; ++r) {
+		struct text_layout_run *run = &layout->runs[r];
+		void *font_key = (void *)(uintptr_t)run->font->id;
+		size_t glyphs_len = 0;
+		for (size_t i = 0; i < run->glyphs_len; ++i) {
+			struct text_glyph *text_glyph = &text_glyphs[i];
+			const struct fcft_glyph *glyph = text_glyph->glyph;
+			if (pixman_image_get_format(glyph->pix) == PIXMAN_a8r8g8b8) {
+				// color glyphs (emoji) are their own source, glyph cache only does masks
+				pixman_image_composite32(PIXMAN_OP_OVER, glyph->pix, NULL, dest,
+						0, 0, 0, 0, x + text_glyph->x + glyph->x, y + text_glyph->y - glyph->y,
+						glyph->width, glyph->height);
+				continue;
+			}
+			const void *cached = pixman_glyph_cache_lookup(glyph_cache, font_key, (void *)glyph);
+			if (cached == NULL) {
+				cached = pixman_glyph_cache_insert(glyph_cache, font_key, (void *)glyph,
+					-glyph->x, glyph->y, glyph->pix);
+				if (cached == NULL) {
+					continue;
+				}
+			}
+			layout->pixman_glyphs[glyphs_len++] = (pixman_glyph_t){
+				.x = text_glyph->x,
+				.y = text_glyph->y,
+				.glyph = cached,
+			};
+		}
+		pixman_composite_glyphs_no_mask(PIXMAN_OP_OVER, run->color, dest, 0, 0, x, y,
+			glyph_cache, (int)glyphs_len, layout->pixman_glyphs);
+		if (run->underline_thickness > 0) {
+			pixman_image_composite32(PIXMAN_OP_OVER, run->color, NULL, dest, 0, 0, 0, 0,
+				x + run->x, y + run->underline_y, run->width, run->underline_thickness);
+		}
+		text_glyphs += run->glyphs_len;
+	}
+	pixman_glyph_cache_thaw(glyph_cache);
 }
 
-static pixman_image_t *load_pixmap(const char *path) {
-	FILE *f = fopen(path, "r");
-	if (f == NULL) {
-		return NULL;
+// for scaled or transformed content, which needs a source image
+static pixman_image_t *text_layout_render_image(struct text_layout *layout) {
+	pixman_image_t *image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+		layout->width, layout->height, NULL, layout->width * 4);
+	if (image) {
+		text_layout_draw(layout, image, 0, 0);
 	}
 
+	return image;
+}
+
+static uint64_t text_cache_hash(struct font_cache *font, const char *text, size_t text_len,
+		uint32_t color, enum fcft_subpixel subpixel) {
 	struct {
-		uint32_t width;
-		uint32_t height;
-		uint32_t pixels[];
-	} size;
+		struct font_cache *font;
+		uint32_t color;
+		enum fcft_subpixel subpixel;
+	} key = { 0 };
+	key.font = font;
+	key.color = color;
+	key.subpixel = subpixel;
+	return fnv1a_hash(text, text_len) ^ fnv1a_hash(&key, sizeof(key));
+}
 
-	pixman_image_t *image = NULL;
-	if (fread(&size, 1, sizeof(size), f) != sizeof(size)) {
-		goto cleanup;
+static void text_cache_remove(struct text_cache *entry) {
+	struct text_cache **p = &text_cache.buckets[entry->hash & (TEXT_CACHE_BUCKETS - 1)];
+	while (*p != entry) {
+		p = &(*p)->next;
 	}
+	*p = entry->next;
+	list_pop(&entry->link);
+	text_cache.len--;
 
-	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, (int)size.width, (int)size.height,
-		NULL, (int)size.width * 4);
-	if (image == NULL) {
-		goto cleanup;
-	}
+	text_layout_unref(entry->layout);
+	free(entry->text);
+	free(entry);
+}
 
-    uint32_t *image_data = pixman_image_get_data(image);
-	if (fread(image_data, 1, (size.width * size.height * 4), f) != (size.width * size.height * 4)) {
-		pixman_image_unref(image);
-		image = NULL;
-		goto cleanup;
+// entries of a font must go before the font does, its address may be reused
+static void text_cache_remove_font(struct font_cache *font) {
+	struct text_cache *entry, *tmp;
+	list_for_each_safe(entry, tmp, &text_cache.lru, link) {
+		if (entry->font == font) {
+			text_cache_remove(entry);
+		}
 	}
-
-    for (uint32_t i = 0; i < size.width * size.height; ++i) {
-        premultiply_alpha_argb32(&image_data[i]);
-    }
-
-cleanup:
-	fclose(f);
-    return image;
 }
 
-#if HAVE_PNG
-static void premultiply_alpha_png(MAYBE_UNUSED png_structp png, png_row_infop row_info,
-		png_bytep data) {
-	for (size_t i = 0; i < row_info->rowbytes; i += 4) {
-		premultiply_alpha_argb32((uint32_t *)(void *)&data[i]);
+// returns a new reference. raw_text is utf-8
+static struct text_layout *text_cache_get(struct font_cache *font, const char *raw_text,
+		size_t raw_text_len, uint32_t color) {
+	enum fcft_subpixel subpixel = FCFT_SUBPIXEL_NONE;
+	uint64_t hash = text_cache_hash(font, raw_text, raw_text_len, color, subpixel);
+	struct text_cache **bucket = &text_cache.buckets[hash & (TEXT_CACHE_BUCKETS - 1)];
+
+	text_cache.lookups++;
+	for (struct text_cache *entry = *bucket; entry; entry = entry->next) {
+		if ((entry->hash == hash) && (entry->font == font) && (entry->color == color)
+				&& (entry->subpixel == subpixel) && (entry->text_len == raw_text_len)
+				&& (memcmp(entry->text, raw_text, raw_text_len) == 0)) {
+			list_pop(&entry->link);
+			list_insert(&text_cache.lru, &entry->link);
+			entry->layout->ref_count++;
+			return entry->layout;
+		}
 	}
-}
+	text_cache.misses++;
 
-static pixman_image_t *load_png(const char *path) {
-	FILE *file = fopen(path, "rb");
-	if (file == NULL) {
-		log_stderr("%s: fopen: %s", path, strerror(errno));
+	struct text_layout *layout = text_layout_create(font, raw_text, raw_text_len, color, subpixel,
+		0, SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE, false);
+	if (layout == NULL) {
 		return NULL;
 	}
 
+	if (text_cache.len >= TEXT_CACHE_MAX_LEN) {
+		struct text_cache *lru = container_of(text_cache.lru.prev, lru, link);
+		text_cache_remove(lru);
+	}
+
+	struct text_cache *entry = malloc(sizeof(struct text_cache));
+	entry->hash = hash;
+	entry->font = font;
+	entry->color = color;
+	entry->subpixel = subpixel;
+	entry->text = malloc(raw_text_len);
+	memcpy(entry->text, raw_text, raw_text_len);
+	entry->text_len = raw_text_len;
+	entry->layout = layout;
+	layout->ref_count++;
+	entry->next = *bucket;
+	*bucket = entry;
+	list_insert(&text_cache.lru, &entry->link);
+	text_cache.len++;
+
+	return layout;
+}
+
+// lays out single line layouts one after another on a common baseline
+static struct text_layout *text_layout_concat(struct font_cache *font,
+		struct text_layout **layouts, const bool *underline, size_t len) {
+	int32_t ascent = 0, descent = 0;
+	size_t runs_len = 0, glyphs_len = 0;
+	for (size_t i = 0; i < len; ++i) {
+		struct fcft_font *fcft_font = layouts[i]->font->font;
+		if ((fcft_font->height - fcft_font->descent) > ascent) {
+			ascent = fcft_font->height - fcft_font->descent;
+		}
+		if (fcft_font->descent > descent) {
+			descent = fcft_font->descent;
+		}
+		runs_len += layouts[i]->runs_len;
+		glyphs_len += layouts[i]->glyphs_len;
+	}
+
+	struct text_layout *layout = calloc(1, sizeof(struct text_layout));
+	layout->ref_count = 1;
+	layout->font = font;
+	layout->height = ascent + descent;
+	layout->runs_len = runs_len;
+	layout->runs = malloc(runs_len * sizeof(struct text_layout_run));
+	layout->glyphs_len = glyphs_len;
+	layout->glyphs = malloc(glyphs_len * sizeof(struct text_glyph));
+	layout->pixman_glyphs = malloc(glyphs_len * sizeof(pixman_glyph_t));
+
+	int32_t x = 0;
+	struct text_layout_run *run = layout->runs;
+	struct text_glyph *glyph = layout->glyphs;
+	for (size_t i = 0; i < len; ++i) {
+		struct text_layout *source = layouts[i];
+		struct fcft_font *fcft_font = source->font->font;
+		int32_t dy = ascent - (fcft_font->height - fcft_font->descent);
+		for (size_t j = 0; j < source->runs_len; ++j, ++run) {
+			*run = source->runs[j];
+			pixman_image_ref(run->color);
+			run->x += x;
+			run->underline_y += dy;
+			if (underline[i]) {
+				run->underline_thickness = (fcft_font->underline.thickness > 0)
+					? fcft_font->underline.thickness : 1;
+				run->underline_y = ascent - fcft_font->underline.position;
+				if ((run->underline_y + run->underline_thickness) > layout->height) {
+					run->underline_y = layout->height - run->underline_thickness;
+				}
+			}
+		}
+		for (size_t j = 0; j < source->glyphs_len; ++j, ++glyph) {
+			*glyph = source->glyphs[j];
+			glyph->x += x;
+			glyph->y += dy;
+		}
+		x += source->width;
+	}
+	layout->width = x;
+
+	return layout;
+}
+
+static void text_fit_clear(struct text_fit *fit) {
+	for (size_t i = 0; i < fit->entries_len; ++i) {
+		text_layout_unref(fit->entries[i].layout);
+		if (fit->entries[i].image) {
+			pixman_image_unref(fit->entries[i].image);
+		}
+	}
+	fit->entries_len = 0;
+}
+
+// text, then short_text if text is too wide, ellipsized or wrapped if that is still too wide.
+// block->layout is not changed, so blocks on several surfaces can be fitted to different widths
+static struct text_fit_entry *block_fit_text(struct block *block, int32_t width) {
+	struct text_fit *fit = block->fit;
+	struct text_fit_entry entry = { .width = width };
+	for (size_t i = 0; i < fit->entries_len; ++i) {
+		if (fit->entries[i].width == width) {
+			entry = fit->entries[i];
+			memmove(&fit->entries[1], &fit->entries[0], i * sizeof(struct text_fit_entry));
+			fit->entries[0] = entry;
+			return &fit->entries[0];
+		}
+	}
+
+	struct text_layout *natural = block->layout;
+	if (natural->width <= width) {
+		natural->ref_count++;
+		entry.layout = natural;
+	} else {
+		const char *text = fit->text;
+		size_t text_len = fit->text_len;
+		if (fit->short_text) {
+			struct text_layout *layout = text_cache_get(natural->font,
+				fit->short_text, fit->short_text_len, fit->color);
+			if (layout && ((layout->width <= width)
+					|| ((fit->ellipsize == SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE) && !fit->wrap))) {
+				entry.layout = layout;
+			} else {
+				text_layout_unref(layout);
+				text = fit->short_text;
+				text_len = fit->short_text_len;
+			}
+		}
+		if (entry.layout == NULL) {
+			entry.layout = text_layout_create(natural->font, text, text_len, fit->color,
+				FCFT_SUBPIXEL_NONE, width, fit->ellipsize, fit->wrap);
+		}
+		if (entry.layout == NULL) {
+			natural->ref_count++;
+			entry.layout = natural;
+		}
+	}
+
+	if (fit->entries_len == TEXT_FIT_CACHE_LEN) {
+		struct text_fit_entry *lru = &fit->entries[--fit->entries_len];
+		text_layout_unref(lru->layout);
+		if (lru->image) {
+			pixman_image_unref(lru->image);
+		}
+	}
+	memmove(&fit->entries[1], &fit->entries[0], fit->entries_len * sizeof(struct text_fit_entry));
+	fit->entries[0] = entry;
+	fit->entries_len++;
+
+	return &fit->entries[0];
+}
+
+static void free_font_cache(struct font_cache *cache) {
+	if (cache == NULL) {
+		return;
+	}
+
+	if (cache->font) {
+		fcft_destroy(cache->font);
+	}
+	free(cache->key);
+
+	free(cache);
+}
+
+static void font_cache_evict_idle(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (size_t i = 0; i < font_cache.len;) {
+		struct font_cache *cache = font_cache.items[i];
+		if ((cache->ref_count == 0) && !cache->queued
+				&& ((now.tv_sec - cache->unused_since.tv_sec) >= FONT_CACHE_IDLE_SECONDS)) {
+			log_debug("font cache: evicting %s", cache->font ? cache->font->name : cache->key);
+			text_cache_remove_font(cache);
+			free_font_cache(cache);
+			ptr_array_pop(&font_cache, i);
+			font_cache_stats.evictions++;
+		} else {
+			++i;
+		}
+	}
+}
+
+static struct fcft_font *font_cache_resolve(struct font_cache *cache) {
+	const char **names = malloc(cache->names_len * sizeof(char *));
+	const char *p = cache->key;
+	for (size_t i = 0; i < cache->names_len; ++i) {
+		names[i] = p;
+		p += strlen(p) + 1;
+	}
+	struct fcft_font *font = fcft_from_name(cache->names_len, names, (*p != '\0') ? p : NULL);
+	free(names);
+
+	if (font && (prewarm_glyphs_len > 0)) {
+		// glyphs of text runs are cached by the font, subpixel must match text_cache_get
+		struct fcft_text_run *text_run = fcft_rasterize_text_run_utf32(
+				font, prewarm_glyphs_len, prewarm_glyphs, FCFT_SUBPIXEL_NONE);
+		if (text_run) {
+			fcft_text_run_destroy(text_run);
+		}
+	}
+
+	return font;
+}
+
+// resolves a pending font without waiting for font_worker, its result is dropped by
+// font_worker_read()
+static void font_cache_resolve_pending(struct font_cache *cache) {
+	if (cache->pending) {
+		cache->font = font_cache_resolve(cache);
+		cache->pending = false;
+	}
+}
+
+static void *font_worker_run(void *data) {
+	(void)data;
+
+	pthread_mutex_lock(&font_worker.mutex);
+	for (;;) {
+		while (!font_worker.stop && (font_worker.requests.len == 0)) {
+			pthread_cond_wait(&font_worker.cond, &font_worker.mutex);
+		}
+		if (font_worker.stop) {
+			break;
+		}
+		struct font_cache *cache = font_worker.requests.items[0];
+		ptr_array_pop(&font_worker.requests, 0);
+		pthread_mutex_unlock(&font_worker.mutex);
+
+		// key and names_len do not change while the entry is queued
+		struct fcft_font *font = font_cache_resolve(cache);
+
+		pthread_mutex_lock(&font_worker.mutex);
+		cache->resolved = font;
+		ptr_array_add(&font_worker.results, cache);
+		ssize_t ret = write(font_worker.wake_fds[1], "", 1);
+		(void)ret; // pipe full means the main loop is woken up anyway
+	}
+	pthread_mutex_unlock(&font_worker.mutex);
+
+	return NULL;
+}
+
+// names are tried in order, attributes may be NULL. release with font_unref().
+// if async, a new font is resolved by font_worker and returned with font NULL and pending set
+static struct font_cache *font_get(const char **names, size_t names_len, const char *attributes,
+		bool async) {
+	if (attributes == NULL) {
+		attributes = "";
+	}
+
+	size_t key_len = strlen(attributes) + 1;
+	for (size_t i = 0; i < names_len; ++i) {
+		key_len += strlen(names[i]) + 1;
+	}
+	char *key = malloc(key_len), *p = key;
+	for (size_t i = 0; i < names_len; ++i) {
+		size_t len = strlen(names[i]) + 1;
+		memcpy(p, names[i], len);
+		p += len;
+	}
+	memcpy(p, attributes, strlen(attributes) + 1);
+	uint64_t key_hash = fnv1a_hash(key, key_len);
+
+	font_cache_evict_idle();
+	font_cache_stats.lookups++;
+
+	for (size_t i = 0; i < font_cache.len; ++i) {
+		struct font_cache *cache = font_cache.items[i];
+		if ((cache->key_hash == key_hash) && (cache->key_len == key_len)
+				&& (memcmp(cache->key, key, key_len) == 0)) {
+			free(key);
+			if (!async) {
+				font_cache_resolve_pending(cache);
+			}
+			if (!cache->pending && (cache->font == NULL)) {
+				return NULL;
+			}
+			cache->ref_count++;
+			return cache;
+		}
+	}
+
+	font_cache_stats.misses++;
+
+	static uint64_t next_id = 1;
+	struct font_cache *cache = calloc(1, sizeof(struct font_cache));
+	cache->id = next_id++;
+	cache->key = key;
+	cache->key_len = key_len;
+	cache->names_len = names_len;
+	cache->key_hash = key_hash;
+	cache->ref_count = 1;
+
+	if (async) {
+		cache->pending = true;
+		cache->queued = true;
+		pthread_mutex_lock(&font_worker.mutex);
+		ptr_array_add(&font_worker.requests, cache);
+		pthread_cond_signal(&font_worker.cond);
+		pthread_mutex_unlock(&font_worker.mutex);
+	} else {
+		cache->font = font_cache_resolve(cache);
+		if (cache->font == NULL) {
+			free_font_cache(cache);
+			return NULL;
+		}
+	}
+	ptr_array_add(&font_cache, cache);
+
+	return cache;
+}
+
+static void font_unref(struct font_cache *font) {
+	if (--font->ref_count == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &font->unused_since);
+	}
+}
+
+static void block_unref(struct block *block) {
+	if ((block == NULL) || (--block->ref_count > 0)) {
+		return;
+	}
+
+	switch (block->type) {
+	case SBAR_BLOCK_TYPE_TEXT:
+		text_layout_unref(block->layout);
+		for (size_t i = 0; i < block->span_fonts_len; ++i) {
+			if (block->span_fonts[i]) {
+				font_unref(block->span_fonts[i]);
+			}
+		}
+		free(block->span_fonts);
+		if (block->placeholder_font) {
+			font_unref(block->placeholder_font);
+		}
+		if (block->fit) {
+			text_fit_clear(block->fit);
+			free(block->fit);
+		}
+		if (block->font) {
+			font_unref(block->font);
+		}
+		break;
+	case SBAR_BLOCK_TYPE_COMPOSITE:
+		for (size_t i = 0; i < block->blocks.len; ++i) {
+			block_unref(block->blocks.items[i]);
+		}
+		ptr_array_fini(&block->blocks);
+		array_fini(&block->block_boxes);
+		break;
+	case SBAR_BLOCK_TYPE_IMAGE:
+	case SBAR_BLOCK_TYPE_DEFAULT:
+	case SBAR_BLOCK_TYPE_SPACER:
+	default:
+		break;
+	}
+
+	if (block->content_image) {
+		pixman_image_unref(block->content_image);
+	}
+	if (block->color) {
+		pixman_image_unref(block->color);
+	}
+
+	for (size_t i = 0; i < LENGTH(block->borders); ++i) {
+		if (block->borders[i].color) {
+			pixman_image_unref(block->borders[i].color);
+		}
+	}
+
+	arena_fini(&block->json_arena);
+
+	if (block->id > 0) {
+		ptr_array_t *blocks_with_id = &block->client->blocks_with_id;
+		for (size_t i = 0; i < blocks_with_id->len; ++i) {
+			if (block == blocks_with_id->items[i]) {
+				ptr_array_pop(blocks_with_id, i);
+				break;
+			}
+		}
+	}
+
+	free(block);
+}
+
+static pixman_image_t *load_pixmap(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return NULL;
+	}
+
+	struct {
+		uint32_t width;
+		uint32_t height;
+		uint32_t pixels[];
+	} size;
+
 	pixman_image_t *image = NULL;
-	png_bytepp row_pointers = NULL;
-	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
-			NULL, NULL, NULL);
-	png_infop info = png_create_info_struct(png);
+	if (fread(&size, 1, sizeof(size), f) != sizeof(size)) {
+		goto cleanup;
+	}
 
-	if (setjmp(png_jmpbuf(png))) {
-		log_stderr("%s: libpng error", path);
+	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, (int)size.width, (int)size.height,
+		NULL, (int)size.width * 4);
+	if (image == NULL) {
 		goto cleanup;
 	}
 
-	png_init_io(png, file);
-	png_read_info(png, info);
+    uint32_t *image_data = pixman_image_get_data(image);
+	if (fread(image_data, 1, (size.width * size.height * 4), f) != (size.width * size.height * 4)) {
+		pixman_image_unref(image);
+		image = NULL;
+		goto cleanup;
+	}
 
-	png_uint_32 width = png_get_image_width(png, info);
-	png_uint_32 height = png_get_image_height(png, info);
-	png_uint_32 stride = width * 4;
-	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, (int)width, (int)height,
-			NULL, (int)stride);
-	if (image == NULL) {
+    for (uint32_t i = 0; i < size.width * size.height; ++i) {
+        premultiply_alpha_argb32(&image_data[i]);
+    }
+
+cleanup:
+	fclose(f);
+    return image;
+}
+
+static void munmap_pixmap(pixman_image_t *image, MAYBE_UNUSED void *data) {
+	uint32_t *pixels = pixman_image_get_data(image);
+	size_t pixels_size = (size_t)pixman_image_get_width(image)
+		* (size_t)pixman_image_get_height(image) * 4;
+	munmap(pixels - 2, pixels_size + sizeof(uint32_t) * 2);
+}
+
+// sealed memfds can not be truncated or written to, so mapping them can not SIGBUS
+// and images in them can be used in place
+static bool fd_is_sealed(int fd) {
+	int seals = fcntl(fd, F_GET_SEALS);
+	return (seals != -1)
+		&& ((seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) == (F_SEAL_SHRINK | F_SEAL_WRITE));
+}
+
+// returns false on error or short read
+static bool pread_all(int fd, void *data, size_t size, size_t offset) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = pread(fd, (uint8_t *)data + done, size - done, (off_t)(offset + done));
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if (n == 0) {
+			return false;
+		}
+		done += (size_t)n;
+	}
+	return true;
+}
+
+// fd must be sealed, see fd_is_sealed()
+static pixman_image_t *map_pixmap_premultiplied(int fd, const char *name) {
+	uint32_t size[2]; // width, height
+	struct stat sb;
+	if ((pread(fd, size, sizeof(size), 0) != sizeof(size)) || (fstat(fd, &sb) == -1)
+			|| (size[0] == 0) || (size[1] == 0) || (size[0] > INT32_MAX / 4)
+			|| (size[1] > INT32_MAX / size[0] / 4)) {
+		return NULL;
+	}
+
+	size_t map_size = sizeof(size) + (size_t)size[0] * size[1] * 4;
+	if ((size_t)sb.st_size < map_size) {
+		return NULL;
+	}
+
+	uint32_t *map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		log_stderr("%s: mmap: %s", name, strerror(errno));
+		return NULL;
+	}
+
+	// pixman never writes to source images, so read-only mapping is fine here
+	pixman_image_t *image = pixman_image_create_bits(PIXMAN_a8r8g8b8, (int)size[0], (int)size[1],
+		&map[2], (int)size[0] * 4);
+	if (image) {
+		// destroy data is NULL, because it is used to identify svg images
+		pixman_image_set_destroy_function(image, munmap_pixmap, NULL);
+	} else {
+		munmap(map, map_size);
+	}
+
+	return image;
+}
+
+static pixman_image_t *load_pixmap_premultiplied(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		log_stderr("%s: open: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	pixman_image_t *image = NULL;
+	if (fd_is_sealed(fd)) {
+		image = map_pixmap_premultiplied(fd, path);
+		goto cleanup;
+	}
+
+	// file may be truncated or rewritten while mapped, so it is copied
+	uint32_t size[2]; // width, height
+	if ((pread(fd, size, sizeof(size), 0) != sizeof(size))
+			|| (size[0] == 0) || (size[1] == 0) || (size[0] > INT32_MAX / 4)
+			|| (size[1] > INT32_MAX / size[0] / 4)) {
 		goto cleanup;
 	}
+	image = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8, (int)size[0], (int)size[1],
+		NULL, (int)size[0] * 4);
+	if (image && !pread_all(fd, pixman_image_get_data(image), (size_t)size[0] * size[1] * 4,
+			sizeof(size))) {
+		pixman_image_unref(image);
+		image = NULL;
+	}
+
+cleanup:
+	close(fd);
+	return image;
+}
+
+static pixman_image_t *load_qoi(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		log_stderr("%s: open: %s", path, strerror(errno));
+		return NULL;
+	}
 
-	png_set_strip_16(png);
-	png_set_bgr(png);
-	png_set_palette_to_rgb(png);
-	png_set_expand_gray_1_2_4_to_8(png);
-	png_set_tRNS_to_alpha(png);
-	png_set_packing(png);
-	png_set_gray_to_rgb(png);
-	png_set_interlace_handling(png);
-	png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+	pixman_image_t *image = NULL;
+	struct stat sb;
+	if ((fstat(fd, &sb) == -1) || (sb.st_size <= 0)) {
+		goto cleanup;
+	}
 
-	png_set_read_user_transform_fn(png, premultiply_alpha_png);
+	size_t size = (size_t)sb.st_size;
+	bool sealed = fd_is_sealed(fd);
+	uint8_t *data;
+	if (sealed) {
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			log_stderr("%s: mmap: %s", path, strerror(errno));
+			goto cleanup;
+		}
+	} else {
+		// mapping a file that can be truncated risks SIGBUS
+		data = malloc(size);
+		if (!pread_all(fd, data, size, 0)) {
+			log_stderr("%s: read failed", path);
+			free(data);
+			goto cleanup;
+		}
+	}
 
-	png_bytep image_data = (png_bytep)pixman_image_get_data(image);
-	row_pointers = malloc(height * sizeof(png_bytepp));
-    for (size_t i = 0; i < height; ++i) {
-		row_pointers[i] = &image_data[i * stride];
+	image = decode_qoi(data, size);
+	if (image == NULL) {
+		log_stderr("%s: invalid qoi image", path);
 	}
 
-    png_read_image(png, row_pointers);
+	if (sealed) {
+		munmap(data, size);
+	} else {
+		free(data);
+	}
 
 cleanup:
-	free(row_pointers);
-	png_destroy_read_struct(&png, &info, NULL);
+	close(fd);
+	return image;
+}
+
+#if HAVE_PNG
+static pixman_image_t *load_png(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		log_stderr("%s: fopen: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	pixman_image_t *image = decode_png(file, NULL, path);
+
 	fclose(file);
 	return image;
 }
@@ -826,15 +1933,18 @@ static void destroy_resvg_render_tree(MAYBE_UNUSED pixman_image_t *image, void *
 	resvg_tree_destroy((resvg_render_tree *)tree);
 }
 
-static pixman_image_t *load_svg(const char *path) {
+// if data is NULL, path is loaded from disk. otherwise path is only used for logging
+static pixman_image_t *load_svg(const char *path, const uint8_t *data, size_t data_size) {
 	pixman_image_t *image = NULL;
 	resvg_render_tree *tree = NULL;
 	resvg_options *opt = resvg_options_create();
-	int32_t ret = resvg_parse_tree_from_file(path, opt, &tree);
+	int32_t ret = data
+		? resvg_parse_tree_from_data((const char *)data, data_size, opt, &tree)
+		: resvg_parse_tree_from_file(path, opt, &tree);
     if (ret == RESVG_OK) {
 		image = render_svg(tree, -1, -1);
     } else {
-		log_stderr("%s: resvg_parse_tree_from_file failed. code = %d", path, ret);
+		log_stderr("%s: resvg_parse_tree failed. code = %d", path, ret);
 	}
 
 	if (opt) {
@@ -852,22 +1962,310 @@ static pixman_image_t *load_svg(const char *path) {
 }
 #endif // HAVE_SVG
 
+static void free_pixmap_data(pixman_image_t *image, MAYBE_UNUSED void *data) {
+	free(pixman_image_get_data(image) - 2);
+}
+
+static pixman_image_t *decode_image(enum sbar_block_type_image_image_type type,
+		const uint8_t *data, size_t data_size, MAYBE_UNUSED const char *name) {
+	pixman_image_t *image = NULL;
+	switch (type) {
+	default:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_DEFAULT:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED: {
+		uint32_t size[2]; // width, height
+		if (data_size < sizeof(size)) {
+			break;
+		}
+		memcpy(size, data, sizeof(size));
+		if ((size[0] == 0) || (size[1] == 0) || (size[0] > INT32_MAX / 4)
+				|| (size[1] > INT32_MAX / size[0] / 4)
+				|| (data_size < ((size_t)size[0] * size[1] * 4 + sizeof(size)))) {
+			break;
+		}
+		image = pixman_image_create_bits(PIXMAN_a8r8g8b8, (int)size[0], (int)size[1],
+			NULL, (int)size[0] * 4);
+		if (image == NULL) {
+			break;
+		}
+		uint32_t *pixels = pixman_image_get_data(image);
+		memcpy(pixels, &data[sizeof(size)], (size_t)size[0] * size[1] * 4);
+		if (type != SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED) {
+			for (size_t i = 0; i < ((size_t)size[0] * size[1]); ++i) {
+				premultiply_alpha_argb32(&pixels[i]);
+			}
+		}
+		break;
+	}
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PNG:
+#if HAVE_PNG
+		image = decode_png(NULL, &(struct png_memory){
+			.data = data, .size = data_size }, name);
+#endif // HAVE_PNG
+		break;
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_SVG:
+#if HAVE_SVG
+		image = load_svg(name, data, data_size);
+#endif // HAVE_SVG
+		break;
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_QOI:
+		image = decode_qoi(data, data_size);
+		break;
+	}
+
+	return image;
+}
+
+static pixman_image_t *decode_image_base64(enum sbar_block_type_image_image_type type,
+		const char *text, size_t text_len) {
+	size_t data_size = base64_decoded_size(text_len);
+	if (data_size < (sizeof(uint32_t) * 2)) {
+		return NULL;
+	}
+
+	pixman_image_t *image = NULL;
+	switch (type) {
+	default:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_DEFAULT:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED: {
+		// decode header and pixels in one go, pixman image wraps the pixels without copying
+		uint32_t *data = malloc(data_size);
+		if ((data_size = base64_decode((uint8_t *)data, text, text_len)) == SIZE_MAX) {
+			free(data);
+			break;
+		}
+		uint32_t width = data[0], height = data[1];
+		if ((width == 0) || (height == 0) || (width > INT32_MAX / 4)
+				|| (height > INT32_MAX / width / 4)
+				|| (data_size < ((size_t)width * height * 4 + sizeof(uint32_t) * 2))) {
+			free(data);
+			break;
+		}
+		if (type != SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED) {
+			for (size_t i = 2; i < ((size_t)width * height + 2); ++i) {
+				premultiply_alpha_argb32(&data[i]);
+			}
+		}
+		image = pixman_image_create_bits(PIXMAN_a8r8g8b8, (int)width, (int)height,
+			&data[2], (int)width * 4);
+		if (image) {
+			// destroy data is NULL, because it is used to identify svg images
+			pixman_image_set_destroy_function(image, free_pixmap_data, NULL);
+		} else {
+			free(data);
+		}
+		break;
+	}
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PNG:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_SVG:
+	case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_QOI: {
+		uint8_t *data = malloc(data_size);
+		if ((data_size = base64_decode(data, text, text_len)) != SIZE_MAX) {
+			image = decode_image(type, data, data_size, "data");
+		}
+		free(data);
+		break;
+	}
+	}
+
+	return image;
+}
+
 static void free_image_cache(struct image_cache *cache) {
 	if (cache == NULL) {
 		return;
 	}
 
-	free(cache->path);
-	pixman_image_unref(cache->image);
+	free(cache->path);
+	free(cache->data);
+	pixman_image_unref(cache->image);
+
+	free(cache);
+}
+
+static void image_cache_remove(size_t idx) {
+	struct image_cache *cache = image_cache.items[idx];
+	image_cache_data_size -= cache->data_len;
+	free_image_cache(cache);
+	ptr_array_pop(&image_cache, idx);
+}
+
+static pixman_image_t *image_cache_hit(size_t idx) {
+	struct image_cache *cache = image_cache.items[idx];
+	ptr_array_pop(&image_cache, idx);
+	ptr_array_insert(&image_cache, 0, cache);
+	return pixman_image_ref(cache->image);
+}
+
+static void image_cache_add(struct image_cache *cache) {
+	ptr_array_insert(&image_cache, 0, cache);
+	image_cache_data_size += cache->data_len;
+	while ((image_cache.len > IMAGE_CACHE_MAX_LEN)
+			|| ((image_cache.len > 1) && (image_cache_data_size > IMAGE_CACHE_MAX_DATA_SIZE))) {
+		image_cache_remove(image_cache.len - 1);
+	}
+}
+
+static void image_fd_free(struct image_fd *image_fd) {
+	if (image_fd == NULL) {
+		return;
+	}
+
+	free(image_fd->handle);
+	close(image_fd->fd);
+	if (image_fd->image) {
+		pixman_image_unref(image_fd->image);
+	}
+
+	free(image_fd);
+}
+
+static pixman_image_t *image_fd_get_image(struct image_fd *image_fd,
+		enum sbar_block_type_image_image_type image_type) {
+	if (image_fd->image) {
+		if (image_fd->image_type == image_type) {
+			return pixman_image_ref(image_fd->image);
+		}
+		pixman_image_unref(image_fd->image);
+		image_fd->image = NULL;
+	}
+
+	// sealed memfds can not change under us, so premultiplied pixmaps are used in place.
+	// anything else is decoded (copied) once, client must pass new fd to update the image
+	bool sealed = fd_is_sealed(image_fd->fd);
+	if ((image_type == SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED) && sealed) {
+		image_fd->image = map_pixmap_premultiplied(image_fd->fd, image_fd->handle);
+	} else {
+		struct stat sb;
+		if ((fstat(image_fd->fd, &sb) == -1) || (sb.st_size <= 0)) {
+			return NULL;
+		}
+		size_t size = (size_t)sb.st_size;
+		if (sealed) {
+			uint8_t *map = mmap(NULL, size, PROT_READ, MAP_SHARED, image_fd->fd, 0);
+			if (map == MAP_FAILED) {
+				log_stderr("%s: mmap: %s", image_fd->handle, strerror(errno));
+				return NULL;
+			}
+			image_fd->image = decode_image(image_type, map, size, image_fd->handle);
+			munmap(map, size);
+		} else {
+			// mapping an fd that can be truncated risks SIGBUS
+			uint8_t *data = malloc(size);
+			if (pread_all(image_fd->fd, data, size, 0)) {
+				image_fd->image = decode_image(image_type, data, size, image_fd->handle);
+			} else {
+				log_stderr("%s: read failed", image_fd->handle);
+			}
+			free(data);
+		}
+	}
+
+	if (image_fd->image == NULL) {
+		return NULL;
+	}
+
+	pixman_image_set_filter(image_fd->image, PIXMAN_FILTER_BEST, NULL, 0);
+	image_fd->image_type = image_type;
+	return pixman_image_ref(image_fd->image);
+}
+
+static uint64_t block_decoded_id(const struct sbar_schema_block *decoded) {
+	return (decoded->id.set && (decoded->id.value > 0)) ? (uint64_t)decoded->id.value : 0;
+}
+
+// rich text, spans are laid out with block->font or one of "span_fonts"
+static struct text_layout *block_layout_spans(struct block *block,
+		const struct sbar_schema_block *decoded, const char **font_names, size_t font_names_len,
+		uint32_t text_color) {
+	const struct arena_json *span_fonts = decoded->span_fonts.set ? decoded->span_fonts.arena : NULL;
+	if (span_fonts && (span_fonts->len > 0)) {
+		block->span_fonts = calloc(span_fonts->len, sizeof(struct font_cache *));
+		block->span_fonts_len = span_fonts->len;
+		for (uint32_t i = 0; i < span_fonts->len; ++i) {
+			// attributes applied to "font_names"
+			const struct arena_json *attributes = &span_fonts->items[i];
+			block->span_fonts[i] = font_get(font_names, font_names_len,
+				(attributes->type == ARENA_JSON_TYPE_STRING) ? attributes->string : NULL, false);
+			if (block->span_fonts[i] == NULL) {
+				log_stderr("fcft_from_name failed");
+				return NULL;
+			}
+		}
+	}
+
+	const struct arena_json *spans = decoded->spans.arena;
+	struct text_layout **layouts = malloc(spans->len * sizeof(struct text_layout *));
+	bool *underline = malloc(spans->len * sizeof(bool));
+	size_t len = 0;
+	struct text_layout *layout = NULL;
+	for (uint32_t i = 0; i < spans->len; ++i) {
+		struct sbar_schema_span span = { 0 };
+		sbar_schema_decode_arena(&sbar_schema_span, &spans->items[i], &span);
+		if (!span.text.set || (span.text.len == 0)) {
+			continue;
+		}
+		int64_t font_index = SBAR_SCHEMA_GET(span.font, -1);
+		struct font_cache *font = ((font_index >= 0) && ((uint64_t)font_index < block->span_fonts_len))
+			? block->span_fonts[font_index] : block->font;
+		layouts[len] = text_cache_get(font, span.text.value, span.text.len,
+			(uint32_t)SBAR_SCHEMA_GET(span.color, text_color));
+		if (layouts[len] == NULL) {
+			goto out;
+		}
+		underline[len++] = SBAR_SCHEMA_GET(span.underline, false);
+	}
+	if (len > 0) {
+		layout = text_layout_concat(block->font, layouts, underline, len);
+	}
+out:
+	for (size_t i = 0; i < len; ++i) {
+		text_layout_unref(layouts[i]);
+	}
+	free(layouts);
+	free(underline);
+
+	return layout;
+}
 
-	free(cache);
+// copy of block_json for SBAR_PATCH_OP_SET and block_relayout_text()
+static void block_keep_json(struct block *block, const struct arena_json *block_json) {
+	arena_init(&block->json_arena, sizeof(struct arena_json) + arena_json_copy_size(block_json));
+	struct arena_json *json = arena_alloc(&block->json_arena, sizeof(struct arena_json));
+	arena_json_copy(&block->json_arena, block_json, json);
+	block->json = json;
 }
 
-static struct block *block_get(json_object *block_json, uint64_t id) {
+enum block_get_mode {
+	// keeps its json, text may be laid out with a placeholder font until its font is resolved
+	BLOCK_GET_SURFACE,
+	BLOCK_GET_CHILD, // of a composite, fonts are resolved now
+	// like BLOCK_GET_CHILD, ids are ignored in the whole tree since content may differ
+	BLOCK_GET_MEASURE,
+};
+
+static struct block *block_get(const struct arena_json *block_json,
+		const struct sbar_schema_block *decoded, struct client *client, enum block_get_mode mode) {
+	bool top_level = (mode == BLOCK_GET_SURFACE);
+	uint64_t id = (mode == BLOCK_GET_MEASURE) ? 0 : block_decoded_id(decoded);
 	if (id > 0) {
-		for (size_t i = 0; i < blocks_with_id.len; ++i) {
-			struct block *block = blocks_with_id.items[i];
+		for (size_t i = 0; i < client->blocks_with_id.len; ++i) {
+			struct block *block = client->blocks_with_id.items[i];
 			if (block->id == id) {
+				if (top_level && (block->json == NULL)) {
+					// first used as a composite child
+					block_keep_json(block, block_json);
+				}
+				if (!top_level && (block->type == SBAR_BLOCK_TYPE_TEXT)
+						&& block->placeholder_font) {
+					// font_worker_read() only relays out blocks of surfaces, not composite children
+					font_cache_resolve_pending(block->font);
+					if (block->font->font) {
+						block_relayout_text(block);
+					}
+				}
 				block->ref_count++;
 				return block;
 			}
@@ -876,169 +2274,214 @@ static struct block *block_get(json_object *block_json, uint64_t id) {
 
 	struct block *block = calloc(1, sizeof(struct block));
 	block->id = id;
+	block->client = (id > 0) ? client : NULL;
 	block->ref_count = 1;
+	struct sbar_schema_block decoded_json;
+	if (top_level) {
+		// strings kept by the block point into its copy
+		block_keep_json(block, block_json);
+		memset(&decoded_json, 0, sizeof(decoded_json));
+		sbar_schema_decode_arena(&sbar_schema_block, block->json, &decoded_json);
+		decoded_json.id = decoded->id;
+		decoded = &decoded_json;
+	}
 
-	json_object *type, *anchor, *color_json, *render, *borders[4];
-	json_object *min_width, *max_width, *min_height, *max_height;
-	json_object *content_width, *content_height, *content_transform, *content_anchor;
-	json_object_object_get_ex(block_json, "type", &type);
-	json_object_object_get_ex(block_json, "anchor", &anchor);
-	json_object_object_get_ex(block_json, "color", &color_json);
-	json_object_object_get_ex(block_json, "render", &render);
-	json_object_object_get_ex(block_json, "min_width", &min_width);
-	json_object_object_get_ex(block_json, "max_width", &max_width);
-	json_object_object_get_ex(block_json, "min_height", &min_height);
-	json_object_object_get_ex(block_json, "max_height", &max_height);
-	json_object_object_get_ex(block_json, "content_width", &content_width);
-	json_object_object_get_ex(block_json, "content_height", &content_height);
-	json_object_object_get_ex(block_json, "content_transform", &content_transform);
-	json_object_object_get_ex(block_json, "content_anchor", &content_anchor);
-
-	switch ((enum sbar_block_type)(json_object_is_type(type, json_type_int)
-			? json_object_get_int(type)
-			: SBAR_BLOCK_TYPE_SPACER)) {
+	switch ((enum sbar_block_type)SBAR_SCHEMA_GET(decoded->type, SBAR_BLOCK_TYPE_SPACER)) {
 	default:
 	case SBAR_BLOCK_TYPE_DEFAULT:
 	case SBAR_BLOCK_TYPE_SPACER:
 		block->type = SBAR_BLOCK_TYPE_SPACER;
 		break;
 	case SBAR_BLOCK_TYPE_TEXT: {
-		json_object *text_json;
-		json_object_object_get_ex(block_json, "text", &text_json);
-		int len;
-		if ((len = json_object_get_string_len(text_json)) <= 0) {
+		bool spans = decoded->spans.set && (decoded->spans.arena->len > 0);
+		if (!spans && (!decoded->text.set || (decoded->text.len == 0))) {
 			goto error;
 		}
 
-		const char *raw_text = json_object_get_string(text_json);
-		size_t raw_text_len = (size_t)len + 1, text_len = 0, end = (size_t)raw_text + raw_text_len;
-		char32_t *text = malloc(raw_text_len * sizeof(char32_t));
-		mbstate_t ps = { 0 };
-		size_t ret;
-		while ((ret = mbrtoc32(&text[text_len], raw_text, end - (size_t)raw_text, &ps)) != 0) {
-			switch (ret) {
-			case (size_t)-1:
-			case (size_t)-2:
-			case (size_t)-3:
-				free(text);
-				log_stderr("mbrtoc32 failed. code = %zu", ret);
-				goto error;
-			default:
-				raw_text += ret;
-				++text_len;
-				break;
-			}
-		}
-
-		json_object *font_names_array, *font_attributes_json, *text_color_json;
-		json_object_object_get_ex(block_json, "font_names", &font_names_array);
-		json_object_object_get_ex(block_json, "font_attributes", &font_attributes_json);
-		json_object_object_get_ex(block_json, "text_color", &text_color_json);
-
 		ptr_array_t font_names; // char *
 		ptr_array_init(&font_names, 4);
-		if (json_object_is_type(font_names_array, json_type_array)) {
-			for (size_t f = 0; f < json_object_array_length(font_names_array); ++f) {
-				json_object *font_name = json_object_array_get_idx(font_names_array, f);
-				if (json_object_is_type(font_name, json_type_string)) {
-					ptr_array_add(&font_names, (char *)json_object_get_string(font_name));
+		if (decoded->font_names.set) {
+			const struct arena_json *font_names_array = decoded->font_names.arena;
+			for (uint32_t f = 0; f < font_names_array->len; ++f) {
+				const struct arena_json *font_name = &font_names_array->items[f];
+				if ((font_name->type == ARENA_JSON_TYPE_STRING) && (font_name->len > 0)) {
+					ptr_array_add(&font_names, (char *)font_name->string);
 				}
 			}
 		}
 		ptr_array_add(&font_names, (char *)"monospace:size=16");
-		const char *font_attributes = json_object_is_type(font_attributes_json, json_type_string)
-				? json_object_get_string(font_attributes_json)
-				: NULL;
-		block->font = fcft_from_name(font_names.len,
-				(const char **)font_names.items, font_attributes);
-		ptr_array_fini(&font_names);
+		// so that block_unref() releases the font on error
+		block->type = SBAR_BLOCK_TYPE_TEXT;
+		// rich text is laid out once, with all of its fonts
+		block->font = font_get((const char **)font_names.items, font_names.len,
+				SBAR_SCHEMA_GET(decoded->font_attributes, NULL), top_level && !spans);
 		if (block->font == NULL) {
-			free(text);
+			ptr_array_fini(&font_names);
 			log_stderr("fcft_from_name failed");
 			goto error;
 		}
-
-		struct fcft_text_run *text_run = fcft_rasterize_text_run_utf32(
-				block->font, text_len, text, FCFT_SUBPIXEL_NONE);
-		free(text);
-		if (text_run == NULL) {
-			log_stderr("fcft_rasterize_text_run_utf32 failed");
-			goto error;
+		uint32_t text_color = (uint32_t)SBAR_SCHEMA_GET(decoded->text_color, 0xFFFFFFFF);
+		if (spans) {
+			block->layout = block_layout_spans(block, decoded,
+				(const char **)font_names.items, font_names.len, text_color);
+			ptr_array_fini(&font_names);
+			if (block->layout == NULL) {
+				goto error;
+			}
+			break;
 		}
 
-		pixman_color_t color = parse_color_argb32(
-				json_object_is_type(text_color_json, json_type_int)
-				? (uint32_t)json_object_get_uint64(text_color_json)
-				: 0xFFFFFFFF);
-		pixman_image_t *text_color = pixman_image_create_solid_fill(&color);
-
-		int image_width = 0, image_height;
-		for (size_t i = 0; i < text_run->count; i++) {
-			image_width += text_run->glyphs[i]->advance.x;
+		// relaid out by font_worker_read() once the font is resolved
+		struct font_cache *layout_font = block->font;
+		if (block->font->pending) {
+			// monospace with the pattern attributes of the requested font, so metrics are close
+			const char *pattern_attributes = strchr(font_names.items[0], ':');
+			if (pattern_attributes == NULL) {
+				pattern_attributes = "";
+			}
+			size_t placeholder_len = strlen("monospace") + strlen(pattern_attributes) + 1;
+			char *placeholder_name = malloc(placeholder_len);
+			snprintf(placeholder_name, placeholder_len, "monospace%s", pattern_attributes);
+			block->placeholder_font = font_get((const char **)&placeholder_name, 1,
+				SBAR_SCHEMA_GET(decoded->font_attributes, NULL), false);
+			free(placeholder_name);
+			if (block->placeholder_font == NULL) {
+				ptr_array_fini(&font_names);
+				log_stderr("fcft_from_name failed");
+				goto error;
+			}
+			layout_font = block->placeholder_font;
 		}
-		image_height = block->font->height;
-		block->content_image = pixman_image_create_bits(PIXMAN_a8r8g8b8, image_width,
-				image_height, NULL, image_width * 4);
-		if (block->content_image == NULL) {
+		ptr_array_fini(&font_names);
+		block->layout = text_cache_get(layout_font, decoded->text.value, decoded->text.len,
+				text_color);
+		if (block->layout == NULL) {
 			goto error;
 		}
 
-		int x = 0, y = block->font->height - block->font->descent;
-		for (size_t i = 0; i < text_run->count; ++i) {
-			const struct fcft_glyph *glyph = text_run->glyphs[i];
-			if (pixman_image_get_format(glyph->pix) == PIXMAN_a8r8g8b8) {
-				pixman_image_composite32(PIXMAN_OP_OVER, glyph->pix, NULL, block->content_image,
-						0, 0, 0, 0, x + glyph->x, y - glyph->y,
-						glyph->width, glyph->height);
-			} else {
-				pixman_image_composite32(PIXMAN_OP_OVER, text_color, glyph->pix, block->content_image,
-						0, 0, 0, 0, x + glyph->x, y - glyph->y,
-						glyph->width, glyph->height);
+		enum sbar_block_type_text_ellipsize ellipsize = (enum sbar_block_type_text_ellipsize)
+			SBAR_SCHEMA_GET(decoded->text_ellipsize, SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE);
+		if ((ellipsize < SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE)
+				|| (ellipsize > SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_END)) {
+			ellipsize = SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE;
+		}
+		bool wrap = SBAR_SCHEMA_GET(decoded->text_wrap, false);
+		bool short_text = decoded->short_text.set && (decoded->short_text.len > 0);
+		if ((ellipsize != SBAR_BLOCK_TYPE_TEXT_ELLIPSIZE_NONE) || wrap || short_text) {
+			size_t text_size = block->json ? 0
+				: (decoded->text.len + (short_text ? decoded->short_text.len : 0));
+			struct text_fit *fit = calloc(1, sizeof(struct text_fit) + text_size);
+			fit->text = decoded->text.value;
+			fit->text_len = decoded->text.len;
+			if (short_text) {
+				fit->short_text = decoded->short_text.value;
+				fit->short_text_len = decoded->short_text.len;
 			}
-			x += glyph->advance.x;
+			if (block->json == NULL) {
+				char *p = (char *)(fit + 1);
+				memcpy(p, fit->text, fit->text_len);
+				fit->text = p;
+				if (short_text) {
+					memcpy(p + fit->text_len, fit->short_text, fit->short_text_len);
+					fit->short_text = p + fit->text_len;
+				}
+			}
+			fit->color = text_color;
+			fit->ellipsize = ellipsize;
+			fit->wrap = wrap;
+			fit->content_width_auto =
+				(SBAR_SCHEMA_GET(decoded->content_width, 0) == SBAR_BLOCK_SIZE_AUTO);
+			fit->content_height_auto =
+				(SBAR_SCHEMA_GET(decoded->content_height, 0) == SBAR_BLOCK_SIZE_AUTO);
+			block->fit = fit;
 		}
-
-		pixman_image_unref(text_color);
-		fcft_text_run_destroy(text_run);
-		block->type = SBAR_BLOCK_TYPE_TEXT;
 		break;
 	}
 	case SBAR_BLOCK_TYPE_IMAGE: {
-		json_object *path_json;
-		json_object_object_get_ex(block_json, "path", &path_json);
-		const char *path;
+		enum sbar_block_type_image_image_type image_type = (enum sbar_block_type_image_image_type)
+			SBAR_SCHEMA_GET(decoded->image_type, SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP);
+
+		if (decoded->fd.set) {
+			const char *handle = decoded->fd.value;
+			for (size_t i = 0; i < image_fds.len; ++i) {
+				struct image_fd *image_fd = image_fds.items[i];
+				if (strcmp(image_fd->handle, handle) == 0) {
+					block->content_image = image_fd_get_image(image_fd, image_type);
+					break;
+				}
+			}
+			if (block->content_image == NULL) {
+				log_stderr("%s: no such image fd or failed to decode it", handle);
+				goto error;
+			}
+			block->type = SBAR_BLOCK_TYPE_IMAGE;
+			break;
+		}
+
+		if (decoded->data.set && (decoded->data.len > 0)) {
+			const char *data = decoded->data.value;
+			size_t data_len = decoded->data.len;
+			uint64_t data_hash = fnv1a_hash(data, data_len);
+			for (size_t i = 0; i < image_cache.len; ++i) {
+				struct image_cache *cache = image_cache.items[i];
+				if ((cache->path == NULL) && (cache->data_hash == data_hash)
+						&& (cache->data_len == data_len) && (cache->image_type == image_type)
+						&& (memcmp(cache->data, data, data_len) == 0)) {
+					block->content_image = image_cache_hit(i);
+					break;
+				}
+			}
+			if (block->content_image == NULL) {
+				block->content_image = decode_image_base64(image_type, data, data_len);
+				if (block->content_image == NULL) {
+					log_stderr("failed to decode image data");
+					goto error;
+				}
+				struct image_cache *cache = calloc(1, sizeof(struct image_cache));
+				cache->data = malloc(data_len);
+				memcpy(cache->data, data, data_len);
+				cache->data_hash = data_hash;
+				cache->data_len = data_len;
+				cache->image_type = image_type;
+				cache->image = pixman_image_ref(block->content_image);
+				image_cache_add(cache);
+
+				pixman_image_set_filter(block->content_image, PIXMAN_FILTER_BEST, NULL, 0);
+			}
+			block->type = SBAR_BLOCK_TYPE_IMAGE;
+			break;
+		}
+
+		const char *path = SBAR_SCHEMA_GET(decoded->path, "");
 		struct stat sb;
-		if (!json_object_is_type(path_json, json_type_string)
-				|| !*(path = json_object_get_string(path_json))
+		if (!*path
 				|| (stat(path, &sb) == -1)) {
 			goto error;
 		}
 
-		for (size_t i = 0; i < image_cache.len; ++i) { // ? TODO: limit cache size
+		for (size_t i = 0; i < image_cache.len; ++i) {
 			struct image_cache *cache = image_cache.items[i];
-			if (strcmp(path, cache->path) == 0) {
+			if (cache->path && (cache->image_type == image_type)
+					&& (strcmp(path, cache->path) == 0)) {
 				if (memcmp(&sb.st_mtim, &cache->mtim_ts, sizeof(struct timespec)) == 0) {
-					block->content_image = pixman_image_ref(cache->image);
+					block->content_image = image_cache_hit(i);
 				} else {
-					free_image_cache(cache);
-					ptr_array_pop(&image_cache, i);
+					image_cache_remove(i);
 				}
 				break;
 			}
 		}
 
 		if (block->content_image == NULL) {
-			json_object *image_type;
-			json_object_object_get_ex(block_json, "image_type", &image_type);
-			switch ((enum sbar_block_type_image_image_type)(
-					json_object_is_type(image_type, json_type_int) ? json_object_get_int(image_type)
-					: SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP)) {
+			switch (image_type) {
 			default:
 			case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_DEFAULT:
-			case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_RESERVED:
 			case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP:
 				block->content_image = load_pixmap(path);
 				break;
+			case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PIXMAP_PREMULTIPLIED:
+				block->content_image = load_pixmap_premultiplied(path);
+				break;
 			case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_PNG:
 #if HAVE_PNG
 				block->content_image = load_png(path);
@@ -1046,16 +2489,20 @@ static struct block *block_get(json_object *block_json, uint64_t id) {
 				break;
 			case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_SVG:
 #if HAVE_SVG
-				block->content_image = load_svg(path);
+				block->content_image = load_svg(path, NULL, 0);
 #endif // HAVE_SVG
 				break;
+			case SBAR_BLOCK_TYPE_IMAGE_IMAGE_TYPE_QOI:
+				block->content_image = load_qoi(path);
+				break;
 			}
 			if (block->content_image) {
-				struct image_cache *cache = malloc(sizeof(struct image_cache));
+				struct image_cache *cache = calloc(1, sizeof(struct image_cache));
 				cache->path = strdup(path);
 				cache->mtim_ts = sb.st_mtim;
+				cache->image_type = image_type;
 				cache->image = pixman_image_ref(block->content_image);
-				ptr_array_add(&image_cache, cache);
+				image_cache_add(cache);
 
 				pixman_image_set_filter(block->content_image, PIXMAN_FILTER_BEST, NULL, 0);
 				}
@@ -1068,26 +2515,26 @@ static struct block *block_get(json_object *block_json, uint64_t id) {
 		break;
 	}
 	case SBAR_BLOCK_TYPE_COMPOSITE: {
-		json_object *blocks_array;
-		json_object_object_get_ex(block_json, "blocks", &blocks_array);
+		const struct arena_json *blocks_array = decoded->blocks.arena;
 		size_t blocks_len;
-		if (!json_object_is_type(blocks_array, json_type_array)
-				|| ((blocks_len = json_object_array_length(blocks_array)) == 0)) {
+		if (!blocks_array || ((blocks_len = blocks_array->len) == 0)) {
 			goto error;
 		}
 
+		// so that block_unref() releases children on error
+		block->type = SBAR_BLOCK_TYPE_COMPOSITE;
 		ptr_array_init(&block->blocks, blocks_len);
-		array_t block_boxes; // struct block_box
-		array_init(&block_boxes, blocks_len, sizeof(struct block_box));
+		array_t *block_boxes = &block->block_boxes;
+		array_init(block_boxes, blocks_len, sizeof(struct block_box));
 
 		struct block_box *prev_block_box = NULL;
 		for (size_t i = 0; i < blocks_len; ++i) {
-			json_object *blk_json = json_object_array_get_idx(blocks_array, i);
-			json_object *id_json;
-			json_object_object_get_ex(blk_json, "id", &id_json);
-			struct block *blk = block_get(blk_json,
-				json_object_is_type(id_json, json_type_int) ?
-					json_object_get_uint64(id_json) : 0);
+			const struct arena_json *blk_json = &blocks_array->items[i];
+			struct sbar_schema_block blk_decoded = { 0 };
+			sbar_schema_decode_arena(&sbar_schema_block, blk_json, &blk_decoded);
+			// boxes of children are fixed now, so they need their fonts
+			struct block *blk = block_get(blk_json, &blk_decoded, client,
+				(mode == BLOCK_GET_MEASURE) ? BLOCK_GET_MEASURE : BLOCK_GET_CHILD);
 			struct block_box box;
 			block_get_size(blk, NULL, prev_block_box, &box);
 			if ((box.width == 0) || (box.height == 0)) {
@@ -1095,12 +2542,9 @@ static struct block *block_get(json_object *block_json, uint64_t id) {
 				continue;
 			}
 
-			json_object *x, *y;
-			json_object_object_get_ex(blk_json, "x", &x);
-			json_object_object_get_ex(blk_json, "y", &y);
-			if (json_object_is_type(x, json_type_int) && json_object_is_type(y, json_type_int)) {
-				box.x = (int32_t)json_object_get_uint64(x);
-				box.y = (int32_t)json_object_get_uint64(y);
+			if (blk_decoded.x.set && blk_decoded.y.set) {
+				box.x = (int32_t)blk_decoded.x.value;
+				box.y = (int32_t)blk_decoded.y.value;
 			} else if (prev_block_box) {
 				switch (blk->anchor) {
 				case SBAR_BLOCK_ANCHOR_LEFT:
@@ -1128,61 +2572,49 @@ static struct block *block_get(json_object *block_json, uint64_t id) {
 			}
 
 			if (box.x < 0) {
-				for (size_t j = 0; j < block_boxes.len; ++j) {
-					struct block_box *block_box = &((struct block_box *)block_boxes.items)[j];
+				for (size_t j = 0; j < block_boxes->len; ++j) {
+					struct block_box *block_box = &((struct block_box *)block_boxes->items)[j];
 					block_box->x += -box.x;
 				}
 				box.x = 0;
 			}
 			if (box.y < 0) {
-				for (size_t j = 0; j < block_boxes.len; ++j) {
-					struct block_box *block_box = &((struct block_box *)block_boxes.items)[j];
+				for (size_t j = 0; j < block_boxes->len; ++j) {
+					struct block_box *block_box = &((struct block_box *)block_boxes->items)[j];
 					block_box->y += -box.y;
 				}
 				box.y = 0;
 			}
 
-			prev_block_box = array_add(&block_boxes, &box);
+			prev_block_box = array_add(block_boxes, &box);
 			ptr_array_add(&block->blocks, blk);
 		}
 
-		int content_image_width = 0, content_image_height = 0;
-		for (size_t i = 0; i < block_boxes.len; ++i) {
-			struct block_box *block_box = &((struct block_box *)block_boxes.items)[i];
-			if ((block_box->x + block_box->width) > content_image_width) {
-				content_image_width = (block_box->x + block_box->width);
+		// children are rendered by block_render(), directly into the destination
+		for (size_t i = 0; i < block_boxes->len; ++i) {
+			struct block_box *block_box = &((struct block_box *)block_boxes->items)[i];
+			if ((block_box->x + block_box->width) > block->composite_width) {
+				block->composite_width = (block_box->x + block_box->width);
 			}
-			if ((block_box->y + block_box->height) > content_image_height) {
-				content_image_height = (block_box->y + block_box->height);
+			if ((block_box->y + block_box->height) > block->composite_height) {
+				block->composite_height = (block_box->y + block_box->height);
 			}
 		}
-		block->content_image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
-			content_image_width, content_image_height, NULL, content_image_width * 4);
-		if (block->content_image == NULL) {
+		if ((block->composite_width == 0) || (block->composite_height == 0)) {
 			goto error;
 		}
-
-		for (size_t i = 0; i < block->blocks.len; ++i) {
-			block_render(block->content_image, block->blocks.items[i],
-					&((struct block_box *)block_boxes.items)[i]);
-		}
-
-		array_fini(&block_boxes);
-		block->type = SBAR_BLOCK_TYPE_COMPOSITE;
 		break;
 	}
 	}
 
-	block->content_width = json_object_is_type(content_width, json_type_int)
-		? json_object_get_int(content_width) : 0;
-	block->content_height = json_object_is_type(content_height, json_type_int)
-		? json_object_get_int(content_height) : 0;
+	block->content_width = (int32_t)SBAR_SCHEMA_GET(decoded->content_width, 0);
+	block->content_height = (int32_t)SBAR_SCHEMA_GET(decoded->content_height, 0);
 
 	int32_t tmp;
-	if (block->content_image) {
-		tmp = json_object_is_type(content_transform, json_type_int)
-				? (int32_t)json_object_get_uint64(content_transform)
-				: SBAR_BLOCK_CONTENT_TRANSFORM_NORMAL;
+	int32_t natural_width, natural_height;
+	if (block_get_natural_size(block, &natural_width, &natural_height)) {
+		tmp = (int32_t)SBAR_SCHEMA_GET(decoded->content_transform,
+				SBAR_BLOCK_CONTENT_TRANSFORM_NORMAL);
 		switch ((enum sbar_block_content_transform)tmp) {
 		case SBAR_BLOCK_CONTENT_TRANSFORM_NORMAL:
 		case SBAR_BLOCK_CONTENT_TRANSFORM_FLIPPED:
@@ -1201,275 +2633,677 @@ static struct block *block_get(json_object *block_json, uint64_t id) {
 		}
 
 		if (block->content_width == SBAR_BLOCK_SIZE_AUTO) {
-			block->content_width = pixman_image_get_width(block->content_image);
+			block->content_width = natural_width;
 		}
 		if (block->content_height == SBAR_BLOCK_SIZE_AUTO) {
-			block->content_height = pixman_image_get_height(block->content_image);
+			block->content_height = natural_height;
 		}
 	}
 
+	const struct sbar_schema_value_json *borders[LENGTH(block->borders)];
+	sbar_schema_block_borders(decoded, borders);
 	for (size_t i = 0; i < LENGTH(block->borders); ++i) {
-		static const char *keys[] = {
-			"border_left",
-			"border_right",
-			"border_bottom",
-			"border_top",
-		};
-		json_object_object_get_ex(block_json, keys[i], &borders[i]);
-		json_object *border_width;
-		json_object_object_get_ex(borders[i], "width", &border_width);
-		tmp = json_object_is_type(border_width, json_type_int)
-				? json_object_get_int(border_width) : -1;
+		struct sbar_schema_border border = { 0 };
+		sbar_schema_decode_arena(&sbar_schema_border, borders[i]->arena, &border);
+		tmp = (int32_t)SBAR_SCHEMA_GET(border.width, -1);
 		block->borders[i].width = (tmp >= 0) ? tmp : 0;
 		if (block->borders[i].width > 0) {
-			json_object *border_color_json;
-			json_object_object_get_ex(borders[i], "color", &border_color_json);
 			pixman_color_t border_color = parse_color_argb32(
-					json_object_is_type(border_color_json, json_type_int)
-					? (uint32_t)json_object_get_uint64(border_color_json)
-					: 0);
+					(uint32_t)SBAR_SCHEMA_GET(border.color, 0));
 			block->borders[i].color = pixman_image_create_solid_fill(&border_color);
 		}
 	}
 
-	block->min_width = json_object_is_type(min_width, json_type_int)
-		? json_object_get_int(min_width) : 0;
-	block->max_width = json_object_is_type(max_width, json_type_int)
-		? json_object_get_int(max_width) : 0;
-	if ((block->min_width > 0) && (block->max_width > 0)
-			&& (block->max_width < block->min_width)) {
-		block->min_width = block->max_width = 0;
+	block->min_width = (int32_t)SBAR_SCHEMA_GET(decoded->min_width, 0);
+	block->max_width = (int32_t)SBAR_SCHEMA_GET(decoded->max_width, 0);
+	if ((block->min_width > 0) && (block->max_width > 0)
+			&& (block->max_width < block->min_width)) {
+		block->min_width = block->max_width = 0;
+	}
+
+	block->min_height = (int32_t)SBAR_SCHEMA_GET(decoded->min_height, 0);
+	block->max_height = (int32_t)SBAR_SCHEMA_GET(decoded->max_height, 0);
+	if ((block->min_height > 0) && (block->max_height > 0)
+			&& (block->max_height < block->min_height)) {
+		block->min_height = block->max_height = 0;
+	}
+
+	tmp = (int32_t)SBAR_SCHEMA_GET(decoded->anchor, -1);
+	switch ((enum sbar_block_anchor)tmp) {
+	default:
+	case SBAR_BLOCK_ANCHOR_DEFAULT:
+		block->anchor = SBAR_BLOCK_ANCHOR_LEFT;
+		break;
+	case SBAR_BLOCK_ANCHOR_TOP:
+	case SBAR_BLOCK_ANCHOR_RIGHT:
+	case SBAR_BLOCK_ANCHOR_BOTTOM:
+	case SBAR_BLOCK_ANCHOR_LEFT:
+	case SBAR_BLOCK_ANCHOR_CENTER:
+	case SBAR_BLOCK_ANCHOR_NONE:
+		block->anchor = (enum sbar_block_anchor)tmp;
+	}
+
+	tmp = (int32_t)SBAR_SCHEMA_GET(decoded->content_anchor, -1);
+	switch ((enum sbar_block_content_anchor)tmp) {
+	default:
+	case SBAR_BLOCK_CONTENT_ANCHOR_DEFAULT:
+		block->content_anchor = SBAR_BLOCK_CONTENT_ANCHOR_LEFT_CENTER;
+		break;
+	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_TOP:
+	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_CENTER:
+	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_BOTTOM:
+	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_TOP:
+	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_CENTER:
+	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_BOTTOM:
+	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_TOP:
+	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_CENTER:
+	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_BOTTOM:
+		block->content_anchor = (enum sbar_block_content_anchor)tmp;
+		break;
+	}
+
+	if (decoded->color.set) {
+		pixman_color_t color = parse_color_argb32((uint32_t)decoded->color.value);
+		block->color = pixman_image_create_solid_fill(&color);
+	}
+
+	block->render = SBAR_SCHEMA_GET(decoded->render, true);
+
+	if (id > 0) {
+		ptr_array_add(&client->blocks_with_id, block);
+	}
+	return block;
+error:
+	block_unref(block);
+	return NULL;
+}
+
+// for userdata, which is echoed back in events
+static json_object *arena_json_to_json_object(const struct arena_json *json) {
+	if (json == NULL) {
+		return NULL;
+	}
+
+	switch (json->type) {
+	case ARENA_JSON_TYPE_BOOLEAN:
+		return json_object_new_boolean(json->boolean);
+	case ARENA_JSON_TYPE_INT:
+		return json_object_new_int64(json->integer);
+	case ARENA_JSON_TYPE_DOUBLE:
+		return json_object_new_double(json->number);
+	case ARENA_JSON_TYPE_STRING:
+		return json_object_new_string_len(json->string, (int)json->len);
+	case ARENA_JSON_TYPE_ARRAY: {
+		json_object *array = json_object_new_array_ext((int)json->len);
+		for (uint32_t i = 0; i < json->len; ++i) {
+			json_object_array_add(array, arena_json_to_json_object(&json->items[i]));
+		}
+		return array;
+	}
+	case ARENA_JSON_TYPE_OBJECT: {
+		json_object *object = json_object_new_object();
+		for (uint32_t i = 0; i < json->len; ++i) {
+			json_object_object_add(object, json->members[i].key,
+				arena_json_to_json_object(&json->members[i].value));
+		}
+		return object;
+	}
+	case ARENA_JSON_TYPE_NULL:
+	default:
+		return NULL;
+	}
+}
+
+static void json_writer_userdata(struct json_writer *writer, json_object *userdata) {
+	if (userdata == NULL) {
+		json_writer_null(writer);
+		return;
+	}
+
+	size_t len;
+	const char *str = json_object_to_json_string_length(
+		userdata, JSON_C_TO_STRING_PLAIN, &len);
+	json_writer_raw(writer, str, len);
+}
+
+static void describe_blocks(struct json_writer *writer, ptr_array_t *blocks, // struct block * , NULL
+		array_t *boxes) { // struct block_box
+	json_writer_key(writer, "blocks");
+	json_writer_array_begin(writer);
+	for (size_t i = 0; i < blocks->len; ++i) {
+		struct block *block = blocks->items[i];
+		if (block == NULL) {
+			json_writer_null(writer);
+			continue;
+		}
+		struct block_box *box = &((struct block_box *)boxes->items)[i];
+		json_writer_object_begin(writer);
+		json_writer_key(writer, "x");
+		json_writer_int64(writer, box->x);
+		json_writer_key(writer, "y");
+		json_writer_int64(writer, box->y);
+		json_writer_key(writer, "width");
+		json_writer_int64(writer, box->width);
+		json_writer_key(writer, "height");
+		json_writer_int64(writer, box->height);
+		json_writer_object_end(writer);
+	}
+	json_writer_array_end(writer);
+}
+
+static bool surfaces_changed(ptr_array_t *surfaces, // struct surface * , NULL
+		uint64_t since_generation) {
+	for (size_t i = 0; i < surfaces->len; ++i) {
+		struct surface *surface = surfaces->items[i];
+		if (surface && ((surface->state_generation > since_generation)
+				|| surfaces_changed(&surface->popups, since_generation))) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// writes array items. since_generation is 0 for full state
+static void describe_surfaces(struct json_writer *writer, ptr_array_t *source, // struct surface * , NULL
+		uint64_t since_generation, uint32_t mask) { // enum sbar_state_events_mask
+	for (size_t i = 0; i < source->len; ++i) {
+		struct surface *surface = source->items[i];
+		if (surface == NULL) {
+			json_writer_null(writer);
+			continue;
+		}
+		bool changed = (surface->state_generation > since_generation);
+		if (!changed && !surfaces_changed(&surface->popups, since_generation)) {
+			json_writer_bool(writer, true);
+			continue;
+		}
+		json_writer_object_begin(writer);
+		//json_writer_key(writer, "userdata");
+		//json_writer_userdata(writer, surface->userdata);
+		if (changed && (mask & SBAR_STATE_EVENTS_MASK_SURFACES)) {
+			json_writer_key(writer, "width");
+			json_writer_int64(writer, surface->width);
+			json_writer_key(writer, "height");
+			json_writer_int64(writer, surface->height);
+			json_writer_key(writer, "scale");
+			json_writer_int64(writer, surface->scale);
+		}
+		if (changed && (mask & SBAR_STATE_EVENTS_MASK_BLOCKS)) {
+			describe_blocks(writer, &surface->blocks, &surface->block_boxes);
+		}
+		json_writer_key(writer, "popups");
+		json_writer_array_begin(writer);
+		describe_surfaces(writer, &surface->popups, since_generation, mask);
+		json_writer_array_end(writer);
+		json_writer_object_end(writer);
+	}
+}
+
+static struct client_output *client_get_output(struct client *client,
+		struct output *output, bool create) {
+	for (size_t i = 0; i < client->outputs.len; ++i) {
+		struct client_output *client_output = client->outputs.items[i];
+		if (client_output->output == output) {
+			return client_output;
+		}
+	}
+
+	if (!create) {
+		return NULL;
+	}
+
+	struct client_output *client_output = malloc(sizeof(struct client_output));
+	client_output->output = output;
+	ptr_array_init(&client_output->bars, 4);
+	ptr_array_add(&client->outputs, client_output);
+
+	return client_output;
+}
+
+static void describe_outputs(struct json_writer *writer, struct client *client,
+		uint64_t since_generation) {
+	uint32_t mask = client->state_events_mask;
+	if (!(mask & (SBAR_STATE_EVENTS_MASK_OUTPUTS | STATE_EVENTS_MASK_SURFACES))) {
+		return;
+	}
+
+	json_writer_key(writer, "outputs");
+	json_writer_array_begin(writer);
+	for (size_t i = 0; i < outputs.len; ++i) {
+		struct output *output = outputs.items[i];
+		if (output->name == NULL) {
+			continue;
+		}
+		json_writer_object_begin(writer);
+		json_writer_key(writer, "name");
+		json_writer_string(writer, output->name);
+		if ((output->state_generation > since_generation)
+				&& (mask & SBAR_STATE_EVENTS_MASK_OUTPUTS)) {
+			json_writer_key(writer, "width");
+			json_writer_int64(writer, output->width);
+			json_writer_key(writer, "height");
+			json_writer_int64(writer, output->height);
+			json_writer_key(writer, "scale");
+			json_writer_int64(writer, output->scale);
+			json_writer_key(writer, "transform");
+			json_writer_int64(writer, output->transform);
+		}
+		if (mask & STATE_EVENTS_MASK_SURFACES) {
+			struct client_output *client_output = client_get_output(client, output, false);
+			json_writer_key(writer, "bars");
+			json_writer_array_begin(writer);
+			if (client_output) {
+				describe_surfaces(writer, &client_output->bars, since_generation, mask);
+			}
+			json_writer_array_end(writer);
+		}
+		json_writer_object_end(writer);
+	}
+	json_writer_array_end(writer);
+}
+
+// writes the "button" member, returns false if there is none
+static bool describe_pointer_button(struct json_writer *writer, struct pointer *pointer) {
+	if (pointer->button.code == 0) {
+		return false;
+	}
+
+	json_writer_key(writer, "button");
+	json_writer_object_begin(writer);
+	json_writer_key(writer, "code");
+	json_writer_int64(writer, pointer->button.code);
+	json_writer_key(writer, "state");
+	json_writer_int64(writer, pointer->button.state);
+	json_writer_key(writer, "serial");
+	json_writer_int64(writer, pointer->button.serial);
+	json_writer_object_end(writer);
+
+	return true;
+}
+
+// writes the "scroll" member, returns false if there is none
+static bool describe_pointer_scroll(struct json_writer *writer, struct pointer *pointer) {
+	if (pointer->scroll.vector_length == 0) {
+		return false;
+	}
+
+	json_writer_key(writer, "scroll");
+	json_writer_object_begin(writer);
+	json_writer_key(writer, "axis");
+	json_writer_int64(writer, pointer->scroll.axis);
+	json_writer_key(writer, "vector_length");
+	json_writer_double(writer, wl_fixed_to_double(pointer->scroll.vector_length));
+	json_writer_object_end(writer);
+
+	return true;
+}
+
+static void describe_seats(struct json_writer *writer, struct client *client,
+		uint64_t since_generation) {
+	uint32_t mask = client->state_events_mask;
+	if (!(mask & STATE_EVENTS_MASK_SEATS)) {
+		return;
+	}
+
+	json_writer_key(writer, "seats");
+	json_writer_array_begin(writer);
+	for (size_t i = 0; i < seats.len; ++i) {
+		struct seat *seat = seats.items[i];
+		if (seat->name == NULL) {
+			continue;
+		}
+		json_writer_object_begin(writer);
+		json_writer_key(writer, "name");
+		json_writer_string(writer, seat->name);
+		if ((seat->state_generation <= since_generation) && (client->pointer_events
+				|| (seat->pointer.state_generation <= since_generation))) {
+			json_writer_object_end(writer);
+			continue;
+		}
+		json_writer_key(writer, "pointer");
+		if ((seat->pointer.wl_pointer != NULL) && client->pointer_events) {
+			// focus, button and scroll are sent in pointer events
+			json_writer_object_begin(writer);
+			json_writer_object_end(writer);
+		} else if (seat->pointer.wl_pointer != NULL) {
+			struct pointer *pointer = &seat->pointer;
+			json_writer_object_begin(writer);
+			json_writer_key(writer, "focus");
+			// other clients' surfaces are not visible
+			if ((pointer->focus.surface != NULL)
+					&& (surface_get_bar(pointer->focus.surface)->client == client)
+					&& (mask & SBAR_STATE_EVENTS_MASK_POINTER_MOTION)) {
+				json_writer_object_begin(writer);
+				json_writer_key(writer, "surface_userdata");
+				json_writer_userdata(writer, pointer->focus.surface->userdata);
+				json_writer_key(writer, "x");
+				json_writer_double(writer, pointer->focus.x);
+				json_writer_key(writer, "y");
+				json_writer_double(writer, pointer->focus.y);
+				json_writer_object_end(writer);
+			} else {
+				json_writer_null(writer);
+			}
+			if (!(mask & SBAR_STATE_EVENTS_MASK_POINTER_BUTTON)
+					|| !describe_pointer_button(writer, pointer)) {
+				json_writer_key(writer, "button");
+				json_writer_null(writer);
+			}
+			if (!(mask & SBAR_STATE_EVENTS_MASK_POINTER_SCROLL)
+					|| !describe_pointer_scroll(writer, pointer)) {
+				json_writer_key(writer, "scroll");
+				json_writer_null(writer);
+			}
+			json_writer_object_end(writer);
+		} else {
+			json_writer_null(writer);
+		}
+		json_writer_object_end(writer);
+	}
+	json_writer_array_end(writer);
+}
+
+static struct client_message *client_write_queue_at(struct client *client, size_t idx) {
+	return &client->write_queue[(client->write_queue_head + idx) & (client->write_queue_size - 1)];
+}
+
+static void client_message_shrink(struct client *client, struct client_message *message) {
+	if (message->writer.size > CLIENT_MESSAGE_MIN_SIZE) {
+		client->write_capacity -= message->writer.size;
+		json_writer_fini(&message->writer);
+		json_writer_init(&message->writer, CLIENT_MESSAGE_MIN_SIZE);
+		client->write_capacity += message->writer.size;
+	}
+}
+
+static void client_write_queue_resize(struct client *client, size_t size) {
+	struct client_message *queue = malloc(size * sizeof(struct client_message));
+	for (size_t i = 0; i < client->write_queue_len; ++i) {
+		queue[i] = *client_write_queue_at(client, i);
+	}
+	for (size_t i = client->write_queue_len; i < client->write_queue_size; ++i) {
+		// idle
+		struct client_message *message = client_write_queue_at(client, i);
+		if (i < size) {
+			queue[i] = *message;
+		} else {
+			client->write_capacity -= message->writer.size;
+			json_writer_fini(&message->writer);
+		}
+	}
+	for (size_t i = client->write_queue_size; i < size; ++i) {
+		json_writer_init(&queue[i].writer, CLIENT_MESSAGE_MIN_SIZE);
+		client->write_capacity += queue[i].writer.size;
+	}
+	free(client->write_queue);
+	client->write_queue = queue;
+	client->write_queue_size = size;
+	client->write_queue_head = 0;
+}
+
+static struct json_writer *client_begin_message(struct client *client,
+		enum client_message_type type) {
+	if (client->write_queue_len == client->write_queue_size) {
+		client_write_queue_resize(client, client->write_queue_size * 2);
+	}
+
+	struct client_message *message = client_write_queue_at(client, client->write_queue_len++);
+	json_writer_reset(&message->writer);
+	message->type = type;
+	// buffer may grow until client_end_message()
+	client->write_capacity -= message->writer.size;
+
+	return &message->writer;
+}
+
+static void client_end_message(struct client *client) {
+	struct client_message *message = client_write_queue_at(client, client->write_queue_len - 1);
+	json_writer_end_message(&message->writer, '\n');
+	client->write_capacity += message->writer.size;
+	client->write_queued += message->writer.len;
+
+	log_debug("sending:\n%.*s", (int)message->writer.len - 1, message->writer.data);
+
+	// older states that were not written yet are replaced by this one,
+	// other events are dropped oldest first if the client does not keep up.
+	// first message can not be dropped once it is partially written
+	size_t kept = (client->write_offset > 0) ? 1 : 0;
+	size_t queue_len = client->write_queue_len;
+	bool dropped = false;
+	for (size_t i = kept; i < (client->write_queue_len - 1); ++i) {
+		struct client_message *queued = client_write_queue_at(client, i);
+		bool drop;
+		switch (queued->type) {
+		case CLIENT_MESSAGE_TYPE_EVENT:
+		case CLIENT_MESSAGE_TYPE_REPLY:
+			drop = (client->write_queued > client_write_limit)
+				|| (client->write_capacity > (client_write_limit * CLIENT_WRITE_CAPACITY_FACTOR))
+				|| (queue_len > CLIENT_WRITE_QUEUE_MAX_LEN);
+			dropped |= drop;
+			break;
+		case CLIENT_MESSAGE_TYPE_STATE_DELTA:
+			drop = ((message->type == CLIENT_MESSAGE_TYPE_STATE_DELTA)
+				|| (message->type == CLIENT_MESSAGE_TYPE_STATE));
+			break;
+		case CLIENT_MESSAGE_TYPE_STATE:
+			drop = (message->type == CLIENT_MESSAGE_TYPE_STATE);
+			break;
+		default:
+			assert(UNREACHABLE);
+			drop = false;
+		}
+		if (drop) {
+			client->write_queued -= queued->writer.len;
+			client_message_shrink(client, queued);
+			queue_len--;
+			continue;
+		}
+		struct client_message *dest = client_write_queue_at(client, kept++);
+		struct client_message tmp = *dest;
+		*dest = *queued;
+		*queued = tmp;
+	}
+	struct client_message *dest = client_write_queue_at(client, kept++);
+	struct client_message tmp = *dest;
+	*dest = *message;
+	*message = tmp;
+	client->write_queue_len = kept;
+
+	if (dropped && !client->write_dropping) {
+		log_stderr("client is not reading, dropping events");
+		client->write_dropping = true;
 	}
+}
 
-	block->min_height = json_object_is_type(min_height, json_type_int)
-		? json_object_get_int(min_height) : 0;
-	block->max_height = json_object_is_type(max_height, json_type_int)
-		? json_object_get_int(max_height) : 0;
-	if ((block->min_height > 0) && (block->max_height > 0)
-			&& (block->max_height < block->min_height)) {
-		block->min_height = block->max_height = 0;
+static void client_clear_write_queue(struct client *client) {
+	client->write_queue_len = 0;
+	client->write_offset = 0;
+	client->write_queued = 0;
+	client->write_dropping = false;
+	for (size_t i = 0; i < client->write_queue_size; ++i) {
+		client_message_shrink(client, &client->write_queue[i]);
 	}
-
-	tmp = json_object_is_type(anchor, json_type_int)
-		? json_object_get_int(anchor) : -1;
-	switch ((enum sbar_block_anchor)tmp) {
-	default:
-	case SBAR_BLOCK_ANCHOR_DEFAULT:
-		block->anchor = SBAR_BLOCK_ANCHOR_LEFT;
-		break;
-	case SBAR_BLOCK_ANCHOR_TOP:
-	case SBAR_BLOCK_ANCHOR_RIGHT:
-	case SBAR_BLOCK_ANCHOR_BOTTOM:
-	case SBAR_BLOCK_ANCHOR_LEFT:
-	case SBAR_BLOCK_ANCHOR_CENTER:
-	case SBAR_BLOCK_ANCHOR_NONE:
-		block->anchor = (enum sbar_block_anchor)tmp;
+	if (client->write_queue_size > CLIENT_WRITE_QUEUE_MIN_LEN) {
+		client_write_queue_resize(client, CLIENT_WRITE_QUEUE_MIN_LEN);
 	}
+	client->write_queue_head = 0;
+}
 
-	tmp = json_object_is_type(content_anchor, json_type_int)
-		? json_object_get_int(content_anchor) : -1;
-	switch ((enum sbar_block_content_anchor)tmp) {
-	default:
-	case SBAR_BLOCK_CONTENT_ANCHOR_DEFAULT:
-		block->content_anchor = SBAR_BLOCK_CONTENT_ANCHOR_LEFT_CENTER;
-		break;
-	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_TOP:
-	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_CENTER:
-	case SBAR_BLOCK_CONTENT_ANCHOR_LEFT_BOTTOM:
-	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_TOP:
-	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_CENTER:
-	case SBAR_BLOCK_CONTENT_ANCHOR_CENTER_BOTTOM:
-	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_TOP:
-	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_CENTER:
-	case SBAR_BLOCK_CONTENT_ANCHOR_RIGHT_BOTTOM:
-		block->content_anchor = (enum sbar_block_content_anchor)tmp;
-		break;
+static void client_send_state(struct client *client) {
+	if (!client->state_events) {
+		return;
 	}
 
-	if (json_object_is_type(color_json, json_type_int)) {
-		pixman_color_t color = parse_color_argb32(
-			(uint32_t)json_object_get_uint64(color_json));
-		block->color = pixman_image_create_solid_fill(&color);
+	uint64_t since_generation = 0;
+	bool delta = false;
+	if (client->state_delta) {
+		if (client->state_snapshot
+				|| (client->state_deltas_since_snapshot >= STATE_SNAPSHOT_INTERVAL)) {
+			client->state_snapshot = false;
+			client->state_deltas_since_snapshot = 0;
+		} else {
+			since_generation = client->state_acked_generation;
+			client->state_deltas_since_snapshot++;
+			delta = true;
+		}
 	}
 
-	block->render = json_object_is_type(render, json_type_boolean)
-		? json_object_get_boolean(render) : true;
+	struct json_writer *writer = client_begin_message(client,
+		delta ? CLIENT_MESSAGE_TYPE_STATE_DELTA : CLIENT_MESSAGE_TYPE_STATE);
 
-	if (id > 0) {
-		ptr_array_add(&blocks_with_id, block);
+	json_writer_object_begin(writer);
+	json_writer_key(writer, "userdata");
+	json_writer_userdata(writer, client->userdata);
+	if (client->state_delta) {
+		if (delta) {
+			json_writer_key(writer, "delta");
+			json_writer_bool(writer, true);
+		}
+		json_writer_key(writer, "generation");
+		json_writer_uint64(writer, state_generation);
 	}
-	return block;
-error:
-	block_unref(block);
-	return NULL;
-}
 
-static const unsigned jso_add_flags =
-	JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_ADD_CONSTANT_KEY;
+	describe_outputs(writer, client, since_generation);
+	describe_seats(writer, client, since_generation);
 
-static void describe_blocks(json_object *dest, ptr_array_t *blocks, // struct block * , NULL
-		array_t *boxes) { // struct block_box
-	json_object *blocks_array = json_object_new_array_ext((int)blocks->len);
-	json_object_object_add_ex(dest, "blocks", blocks_array, jso_add_flags);
-	for (size_t i = 0; i < blocks->len; ++i) {
-		struct block *block = blocks->items[i];
-		if (block == NULL) {
-			json_object_array_add(blocks_array, NULL);
-			continue;
-		}
-		struct block_box *box = &((struct block_box *)boxes->items)[i];
-		json_object *block_json = json_object_new_object();
-		json_object_array_add(blocks_array, block_json);
-		json_object_object_add_ex(block_json, "x",
-			json_object_new_int64(box->x), jso_add_flags);
-		json_object_object_add_ex(block_json, "y",
-			json_object_new_int64(box->y), jso_add_flags);
-		json_object_object_add_ex(block_json, "width",
-			json_object_new_int64(box->width), jso_add_flags);
-		json_object_object_add_ex(block_json, "height",
-			json_object_new_int64(box->height), jso_add_flags);
-	}
+	//struct timespec ts;
+	//clock_gettime(CLOCK_MONOTONIC, &ts);
+	//json_writer_key(writer, "time");
+	//json_writer_int64(writer, ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+
+	json_writer_object_end(writer);
+	client_end_message(client);
 }
 
-static void describe_surfaces(json_object *dest_array, ptr_array_t *source) { // struct surface * , NULL
-	for (size_t i = 0; i < source->len; ++i) {
-		struct surface *surface = source->items[i];
-		if (surface == NULL) {
-			json_object_array_add(dest_array, NULL);
-			continue;
-		}
-		json_object *surface_json = json_object_new_object();
-		json_object_array_add(dest_array, surface_json);
-		//json_object_object_add_ex(surface_json, "userdata",
-		//	json_object_get(surface->userdata), jso_add_flags);
-		json_object_object_add_ex(surface_json, "width",
-			json_object_new_int64(surface->width), jso_add_flags);
-		json_object_object_add_ex(surface_json, "height",
-			json_object_new_int64(surface->height), jso_add_flags);
-		json_object_object_add_ex(surface_json, "scale",
-			json_object_new_int64(surface->scale), jso_add_flags);
-		describe_blocks(surface_json, &surface->blocks, &surface->block_boxes);
-		json_object *popups_array = json_object_new_array_ext((int)surface->popups.len);
-		json_object_object_add_ex(surface_json, "popups", popups_array, jso_add_flags);
-		describe_surfaces(popups_array, &surface->popups);
-	}
-}
-
-static void describe_outputs(json_object *dest) {
-	json_object *outputs_array = json_object_new_array_ext((int)outputs.len);
-	json_object_object_add_ex(dest, "outputs", outputs_array, jso_add_flags);
-	for (size_t i = 0; i < outputs.len; ++i) {
-		struct output *output = outputs.items[i];
-		if (output->name == NULL) {
+static size_t surface_get_block_at(struct surface *surface, double x, double y) {
+	// boxes are in buffer coordinates
+	int32_t bx = (int32_t)(x * surface->scale), by = (int32_t)(y * surface->scale);
+	for (size_t i = surface->blocks.len; i-- > 0;) {
+		if (surface->blocks.items[i] == NULL) {
 			continue;
 		}
-		json_object *output_json = json_object_new_object();
-		json_object_array_add(outputs_array, output_json);
-		json_object_object_add_ex(output_json, "name",
-			json_object_new_string(output->name), jso_add_flags);
-		json_object_object_add_ex(output_json, "width",
-			json_object_new_int64(output->width), jso_add_flags);
-		json_object_object_add_ex(output_json, "height",
-			json_object_new_int64(output->height), jso_add_flags);
-		json_object_object_add_ex(output_json, "scale",
-			json_object_new_int64(output->scale), jso_add_flags);
-		json_object_object_add_ex(output_json, "transform",
-			json_object_new_int64(output->transform), jso_add_flags);
-		json_object *bars_array = json_object_new_array_ext((int)output->bars.len);
-		json_object_object_add_ex(output_json, "bars", bars_array, jso_add_flags);
-		describe_surfaces(bars_array, &output->bars);
-	}
-}
-
-static void describe_seats(json_object *dest) {
-	json_object *seats_array = json_object_new_array_ext((int)seats.len);
-	json_object_object_add_ex(dest, "seats", seats_array, jso_add_flags);
-	for (size_t i = 0; i < seats.len; ++i) {
-		struct seat *seat = seats.items[i];
-		if (seat->name == NULL) {
-			continue;
+		struct block_box *box = &((struct block_box *)surface->block_boxes.items)[i];
+		if ((bx >= box->x) && (bx < (box->x + box->width))
+				&& (by >= box->y) && (by < (box->y + box->height))) {
+			return i;
 		}
-		json_object *seat_json = json_object_new_object();
-		json_object_array_add(seats_array, seat_json);
-		json_object_object_add_ex(seat_json, "name",
-			json_object_new_string(seat->name), jso_add_flags);
-		json_object *pointer_json = NULL;
-		if (seat->pointer.wl_pointer != NULL) {
-			struct pointer *pointer = &seat->pointer;
-			pointer_json = json_object_new_object();
-			json_object *focus = NULL, *button = NULL, *scroll = NULL;
-			if (pointer->focus.surface != NULL) {
-				focus = json_object_new_object();
-				json_object_object_add_ex(focus, "surface_userdata",
-					json_object_get(pointer->focus.surface->userdata),
-					jso_add_flags);
-				json_object_object_add_ex(focus, "x",
-					json_object_new_double(pointer->focus.x), jso_add_flags);
-				json_object_object_add_ex(focus, "y",
-					json_object_new_double(pointer->focus.y), jso_add_flags);
-			}
-			if (pointer->button.code != 0) {
-				button = json_object_new_object();
-				json_object_object_add_ex(button, "code",
-					json_object_new_int64(pointer->button.code), jso_add_flags);
-				json_object_object_add_ex(button, "state",
-					json_object_new_int64(pointer->button.state), jso_add_flags);
-				json_object_object_add_ex(button, "serial",
-					json_object_new_int64(pointer->button.serial), jso_add_flags);
-			}
-			if (pointer->scroll.vector_length != 0) {
-				scroll = json_object_new_object();
-				json_object_object_add_ex(scroll, "axis",
-					json_object_new_int64(pointer->scroll.axis), jso_add_flags);
-				json_object_object_add_ex(scroll, "vector_length",
-					json_object_new_double(wl_fixed_to_double(pointer->scroll.vector_length)),
-					jso_add_flags);
-			}
-			json_object_object_add_ex(pointer_json, "focus", focus, jso_add_flags);
-			json_object_object_add_ex(pointer_json, "button", button, jso_add_flags);
-			json_object_object_add_ex(pointer_json, "scroll", scroll, jso_add_flags);
-		}
-		json_object_object_add_ex(seat_json, "pointer", pointer_json, jso_add_flags);
-	}
-}
-
-static void send_state(bool force) {
-	if (!state_events || (!state_dirty && !force)) {
+	}
+
+	return SIZE_MAX;
+}
+
+static void client_send_pointer(struct client *client, struct seat *seat,
+		uint32_t changes) { // enum sbar_state_events_mask
+	if (!(client->state_events_mask & changes)) {
 		return;
 	}
 
-	json_object *state_json = json_object_new_object();
+	if (!client->pointer_events) {
+		client_send_state(client);
+		return;
+	}
 
-	json_object_object_add_ex(state_json, "userdata",
-		json_object_get(state_userdata), jso_add_flags);
+	uint32_t mask = client->state_events_mask;
 
-	describe_outputs(state_json);
-	describe_seats(state_json);
+	struct pointer *pointer = &seat->pointer;
+	struct json_writer *writer = client_begin_message(client, CLIENT_MESSAGE_TYPE_EVENT);
+
+	json_writer_object_begin(writer);
+	json_writer_key(writer, "userdata");
+	json_writer_userdata(writer, client->userdata);
+	json_writer_key(writer, "pointer");
+	json_writer_object_begin(writer);
+	json_writer_key(writer, "seat");
+	json_writer_string(writer, seat->name ? seat->name : "");
+	// focus on other clients' surfaces is reported as leave
+	if ((pointer->focus.surface != NULL)
+			&& (surface_get_bar(pointer->focus.surface)->client == client)) {
+		struct surface *surface = pointer->focus.surface;
+		json_writer_key(writer, "surface_userdata");
+		json_writer_userdata(writer, surface->userdata);
+		size_t block_index = surface_get_block_at(surface, pointer->focus.x, pointer->focus.y);
+		if (block_index != SIZE_MAX) {
+			json_writer_key(writer, "block");
+			json_writer_uint64(writer, block_index);
+		}
+		json_writer_key(writer, "x");
+		json_writer_double(writer, pointer->focus.x);
+		json_writer_key(writer, "y");
+		json_writer_double(writer, pointer->focus.y);
+		if (mask & SBAR_STATE_EVENTS_MASK_POINTER_BUTTON) {
+			describe_pointer_button(writer, pointer);
+		}
+		if (mask & SBAR_STATE_EVENTS_MASK_POINTER_SCROLL) {
+			describe_pointer_scroll(writer, pointer);
+		}
+	}
+	json_writer_object_end(writer);
+	json_writer_object_end(writer);
 
-	//struct timespec ts;
-	//clock_gettime(CLOCK_MONOTONIC, &ts);
-	//json_object_object_add_ex(state_json, "time",
-	//	json_object_new_int64(ts.tv_sec * 1000 + ts.tv_nsec / 1000000),
-	//	jso_add_flags);
+	client_end_message(client);
+}
 
-	size_t state_len;
-	const char *state = json_object_to_json_string_length(
-		state_json, JSON_C_TO_STRING_PLAIN, &state_len);
+// blocks are laid out one after another like in a bar, but nothing is rendered
+static void client_send_measure(struct client *client, const struct arena_json *blocks_array) {
+	struct json_writer *writer = client_begin_message(client, CLIENT_MESSAGE_TYPE_REPLY);
+
+	json_writer_object_begin(writer);
+	json_writer_key(writer, "userdata");
+	json_writer_userdata(writer, client->userdata);
+	json_writer_key(writer, "measure");
+	json_writer_array_begin(writer);
+	struct block_box prev_box, *prev_block_box = NULL;
+	for (uint32_t i = 0; i < blocks_array->len; ++i) {
+		const struct arena_json *block_json = &blocks_array->items[i];
+		struct block *block = NULL;
+		if (arena_json_is_type(block_json, ARENA_JSON_TYPE_OBJECT)) {
+			struct sbar_schema_block decoded = { 0 };
+			sbar_schema_decode_arena(&sbar_schema_block, block_json, &decoded);
+			block = block_get(block_json, &decoded, client, BLOCK_GET_MEASURE);
+		}
+		if (block == NULL) {
+			json_writer_null(writer);
+			continue;
+		}
 
-	log_debug("sending state:\n%s", state);
+		struct block_box box;
+		block_get_size(block, NULL, prev_block_box, &box);
+		block_unref(block);
+
+		json_writer_object_begin(writer);
+		json_writer_key(writer, "width");
+		json_writer_int64(writer, box.width);
+		json_writer_key(writer, "height");
+		json_writer_int64(writer, box.height);
+		json_writer_key(writer, "content_width");
+		json_writer_int64(writer, box.content_width);
+		json_writer_key(writer, "content_height");
+		json_writer_int64(writer, box.content_height);
+		json_writer_object_end(writer);
+
+		prev_box = box;
+		prev_block_box = &prev_box;
+	}
+	json_writer_array_end(writer);
+	json_writer_object_end(writer);
+
+	client_end_message(client);
+}
 
-	if ((state_len + stdout_buffer_index + 1) > stdout_buffer_size) {
-		stdout_buffer_size = (state_len + stdout_buffer_index + 1) * 2;
-		stdout_buffer = realloc(stdout_buffer, stdout_buffer_size);
+static void send_state(void) {
+	if (state_dirty == 0) {
+		return;
 	}
 
-	memcpy(&stdout_buffer[stdout_buffer_index], state, state_len);
-	stdout_buffer_index += state_len;
-	stdout_buffer[stdout_buffer_index++] = '\n';
-
-	json_object_put(state_json);
+	for (size_t i = 0; i < clients.len; ++i) {
+		struct client *client = clients.items[i];
+		if (client->state_events_mask & state_dirty) {
+			client_send_state(client);
+		}
+	}
 
-	state_dirty = false;
+	state_dirty = 0;
 }
 
 static void wl_buffer_release(void *data, MAYBE_UNUSED struct wl_buffer *wl_buffer) {
@@ -1569,6 +3403,7 @@ static void surface_init(struct surface *surface) {
 	ptr_array_init(&surface->popups, 4);
 	array_init(&surface->block_boxes, 20, sizeof(struct block_box));
 	array_init(&surface->input_regions, 4, sizeof(struct box));
+	state_touch(&surface->state_generation);
 }
 
 static void popup_destroy(struct surface *popup);
@@ -1644,8 +3479,9 @@ static void xdg_popup_done(void *data, MAYBE_UNUSED struct xdg_popup *xdg_popup)
 	for (size_t i = 0; i < popup->parent->popups.len; ++i) {
 		if (popup->parent->popups.items[i] == popup) {
 			ptr_array_put(&popup->parent->popups, i, NULL);
+			state_touch(&popup->parent->state_generation);
 			popup_destroy(popup);
-			state_dirty = true;
+			state_dirty |= STATE_EVENTS_MASK_SURFACES;
 			return;
 		}
 	}
@@ -1679,9 +3515,9 @@ static const struct xdg_surface_listener popup_xdg_surface_listener = {
 	.configure = popup_xdg_surface_configure,
 };
 
-static void parse_cursor_shape(json_object *cursor_shape_json, struct surface *surface) {
-	int32_t tmp = json_object_is_type(cursor_shape_json, json_type_int)
-			? json_object_get_int(cursor_shape_json) : -1;
+static void parse_cursor_shape(struct sbar_schema_value_int cursor_shape_json,
+		struct surface *surface) {
+	int32_t tmp = (int32_t)SBAR_SCHEMA_GET(cursor_shape_json, -1);
 	enum wp_cursor_shape_device_v1_shape cursor_shape;
 	switch ((enum wp_cursor_shape_device_v1_shape)tmp) {
 	case WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_DEFAULT:
@@ -1737,21 +3573,42 @@ static void parse_cursor_shape(json_object *cursor_shape_json, struct surface *s
 	}
 }
 
-static bool parse_blocks(json_object *blocks_array, struct surface *surface) {
+// max (or sum if sum is true) of visible block widths (or heights if height is true)
+static int32_t surface_get_blocks_size(struct surface *surface, bool height, bool sum) {
+	int32_t size = 0;
+	struct block_box box;
+	for (size_t i = 0; i < surface->blocks.len; ++i) {
+		struct block *block = surface->blocks.items[i];
+		block_get_size(block, surface, (i > 0) ? &box : NULL, &box);
+		if (block && block->render && (block->anchor != SBAR_BLOCK_ANCHOR_NONE)) {
+			int32_t block_size = height ? box.height : box.width;
+			if (sum) {
+				size += block_size;
+			} else if (block_size > size) {
+				size = block_size;
+			}
+		}
+	}
+
+	return size;
+}
+
+static bool parse_blocks(const struct arena_json *blocks_array, struct surface *surface) {
 	bool r = false;
 
 	size_t _blocks_len = 0;
-	if (json_object_is_type(blocks_array, json_type_array)) {
-		_blocks_len = json_object_array_length(blocks_array);
+	if (arena_json_is_type(blocks_array, ARENA_JSON_TYPE_ARRAY)) {
+		_blocks_len = blocks_array->len;
 		for (size_t i = 0; i < _blocks_len; ++i) {
-			json_object *block_json = json_object_array_get_idx(blocks_array, i);
-			json_object *id_json;
-			json_object_object_get_ex(block_json, "id", &id_json);
-			uint64_t id = json_object_is_type(id_json, json_type_int)
-					? json_object_get_uint64(id_json) : 0;
+			const struct arena_json *block_json = &blocks_array->items[i];
+			struct sbar_schema_block decoded = { 0 };
+			sbar_schema_decode_arena(&sbar_schema_block, block_json, &decoded);
+			uint64_t id = block_decoded_id(&decoded);
 			struct block *block = (i < surface->blocks.len) ? surface->blocks.items[i] : NULL;
 			if ((block == NULL) || (id == 0) || (block->id != id)) {
-				ptr_array_insert(&surface->blocks, i, block_get(block_json, id));
+				ptr_array_insert(&surface->blocks, i,
+					block_get(block_json, &decoded, surface_get_bar(surface)->client,
+						BLOCK_GET_SURFACE));
 				r = true;
 			}
 		}
@@ -1795,29 +3652,23 @@ static void popup_configure_xdg_positioner(struct surface *popup) {
 	//xdg_positioner_set_parent_configure(popup->xdg_positioner, );
 }
 
-static bool parse_input_regions(struct surface *surface, json_object *input_regions_array) {
+static int32_t arena_json_get_int32(const struct arena_json *json) {
+	return arena_json_is_type(json, ARENA_JSON_TYPE_INT) ? (int32_t)json->integer : 0;
+}
+
+static bool parse_input_regions(struct surface *surface, const struct arena_json *input_regions_array) {
 	array_t new_input_regions = { 0 };
-	if (json_object_is_type(input_regions_array, json_type_array)) {
-		size_t len = json_object_array_length(input_regions_array);
+	if (arena_json_is_type(input_regions_array, ARENA_JSON_TYPE_ARRAY)) {
+		size_t len = input_regions_array->len;
 		if (len > 0) {
 			array_init(&new_input_regions, len, sizeof(struct box));
 			for (size_t i = 0; i < len; ++i) {
-				json_object *box_json = json_object_array_get_idx(input_regions_array, i);
-				json_object *x, *y, *width, *height;
-				json_object_object_get_ex(box_json, "x", &x);
-				json_object_object_get_ex(box_json, "y", &y);
-				json_object_object_get_ex(box_json, "width", &width);
-				json_object_object_get_ex(box_json, "height", &height);
-
+				const struct arena_json *box_json = &input_regions_array->items[i];
 				struct box box = {
-					.x = json_object_is_type(x, json_type_int) ?
-						json_object_get_int(x) : 0,
-					.y = json_object_is_type(y, json_type_int) ?
-						json_object_get_int(y) : 0,
-					.width = json_object_is_type(width, json_type_int) ?
-						json_object_get_int(width) : 0,
-					.height = json_object_is_type(height, json_type_int) ?
-						json_object_get_int(height) : 0,
+					.x = arena_json_get_int32(arena_json_object_get(box_json, "x")),
+					.y = arena_json_get_int32(arena_json_object_get(box_json, "y")),
+					.width = arena_json_get_int32(arena_json_object_get(box_json, "width")),
+					.height = arena_json_get_int32(arena_json_object_get(box_json, "height")),
 				};
 				array_add(&new_input_regions, &box);
 			}
@@ -1848,82 +3699,36 @@ static bool parse_input_regions(struct surface *surface, json_object *input_regi
 	}
 }
 
-static void parse_popups(json_object *popups_array, ptr_array_t *dest, // struct surface * , NULL
+static void parse_popups(const struct arena_json *popups_array, ptr_array_t *dest, // struct surface * , NULL
 		struct surface *parent);
 
-static bool popup_configure(struct surface *popup, json_object *popup_json) {
-	json_object *x_json, *y_json, *width, *height, *vertical_json;
-	json_object *gravity_json, *constraint_adjustment_json, *render_json;
-	json_object *input_regions_array, *cursor_shape, *blocks_array, *userdata;
-	json_object_object_get_ex(popup_json, "x", &x_json);
-	json_object_object_get_ex(popup_json, "y", &y_json);
-	json_object_object_get_ex(popup_json, "width", &width);
-	json_object_object_get_ex(popup_json, "height", &height);
-	json_object_object_get_ex(popup_json, "vertical", &vertical_json);
-	json_object_object_get_ex(popup_json, "gravity", &gravity_json);
-	json_object_object_get_ex(
-		popup_json, "constraint_adjustment", &constraint_adjustment_json);
-	json_object_object_get_ex(popup_json, "render", &render_json);
-	json_object_object_get_ex(popup_json, "cursor_shape", &cursor_shape);
-	json_object_object_get_ex(popup_json, "input_regions", &input_regions_array);
-	json_object_object_get_ex(popup_json, "blocks", &blocks_array);
-	json_object_object_get_ex(popup_json, "userdata", &userdata);
-
-	if ((!json_object_is_type(x_json, json_type_int))
-			|| (!json_object_is_type(y_json, json_type_int))) {
+static bool popup_configure(struct surface *popup, const struct sbar_schema_popup *decoded) {
+	if (!decoded->x.set || !decoded->y.set) {
 		return false;
 	}
 
 	bool render = false, reposition = false;
-	bool vertical = json_object_is_type(vertical_json, json_type_boolean)
-			? json_object_get_boolean(vertical_json) : true;
+	bool vertical = SBAR_SCHEMA_GET(decoded->vertical, true);
 	if (popup->vertical != vertical) {
 		popup->vertical = vertical;
 		render = true;
 	}
 
-	if (parse_blocks(blocks_array, popup)) {
+	if (parse_blocks(decoded->blocks.arena, popup)) {
 		render = true;
 	}
-	int32_t wanted_width = json_object_is_type(width, json_type_int)
-			? (int32_t)json_object_get_uint64(width) : 0;
-	if (wanted_width == 0) {
-		struct block_box box;
-		for (size_t i = 0; i < popup->blocks.len; ++i) {
-			struct block *block = popup->blocks.items[i];
-			block_get_size(block, popup, (i > 0) ? &box : NULL, &box);
-			if (block && block->render && (block->anchor != SBAR_BLOCK_ANCHOR_NONE)) {
-				if (vertical) {
-					if (box.width > wanted_width) {
-						wanted_width = box.width;
-					}
-				} else {
-					wanted_width += box.width;
-				}
-			}
-		}
-	}
-	int32_t wanted_height = json_object_is_type(height, json_type_int)
-			? (int32_t)json_object_get_uint64(height) : 0;
-	if (wanted_height == 0) {
-		struct block_box box;
-		for (size_t i = 0; i < popup->blocks.len; ++i) {
-			struct block *block = popup->blocks.items[i];
-			block_get_size(block, popup, (i > 0) ? &box : NULL, &box);
-			if (block && block->render && (block->anchor != SBAR_BLOCK_ANCHOR_NONE)) {
-				if (vertical) {
-					wanted_height += box.height;
-				} else if (box.height > wanted_height) {
-					wanted_height = box.height;
-				}
-			}
-		}
-	}
+	popup->id = (uint64_t)SBAR_SCHEMA_GET(decoded->id, 0);
+	popup->config_width = (int32_t)SBAR_SCHEMA_GET(decoded->width, 0);
+	popup->config_height = (int32_t)SBAR_SCHEMA_GET(decoded->height, 0);
+	int32_t wanted_width = (popup->config_width != 0) ? popup->config_width
+		: surface_get_blocks_size(popup, false, !vertical);
+	int32_t wanted_height = (popup->config_height != 0) ? popup->config_height
+		: surface_get_blocks_size(popup, true, vertical);
 	if ((wanted_width == 0) || (wanted_height == 0)) {
 		return false;
 	}
 
-	int32_t x = json_object_get_int(x_json), y = json_object_get_int(y_json);
+	int32_t x = (int32_t)decoded->x.value, y = (int32_t)decoded->y.value;
 	if ((x != popup->wanted_x) || (y != popup->wanted_y)
 			|| (popup->wanted_width != wanted_width)
 			|| (popup->wanted_height != wanted_height)) {
@@ -1934,10 +3739,9 @@ static bool popup_configure(struct surface *popup, json_object *popup_json) {
 		reposition = true;
 	}
 
-	parse_cursor_shape(cursor_shape, popup);
+	parse_cursor_shape(decoded->cursor_shape, popup);
 
-	int32_t tmp = json_object_is_type(gravity_json, json_type_int)
-		? json_object_get_int(gravity_json) : -1;
+	int32_t tmp = (int32_t)SBAR_SCHEMA_GET(decoded->gravity, -1);
 	enum xdg_positioner_gravity gravity;
 	switch ((enum sbar_popup_gravity)tmp) {
 	default:
@@ -1975,8 +3779,7 @@ static bool popup_configure(struct surface *popup, json_object *popup_json) {
 		reposition = true;
 	}
 
-	tmp = json_object_is_type(constraint_adjustment_json, json_type_int)
-		? (int32_t)json_object_get_uint64(constraint_adjustment_json) : 0;
+	tmp = (int32_t)SBAR_SCHEMA_GET(decoded->constraint_adjustment, 0);
 	enum xdg_positioner_constraint_adjustment constraint_adjustment = // TODO: proper error check
 		(tmp > 0) ? (enum xdg_positioner_constraint_adjustment)tmp
 		: XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_NONE;
@@ -1985,17 +3788,16 @@ static bool popup_configure(struct surface *popup, json_object *popup_json) {
 		reposition = true;
 	}
 
-	tmp = json_object_is_type(render_json, json_type_boolean)
-		? json_object_get_boolean(render_json) : true;
+	tmp = SBAR_SCHEMA_GET(decoded->render, true);
 	if (tmp != popup->render) {
 		popup->render = tmp;
 		render = true;
 	}
 
-	bool commit = parse_input_regions(popup, input_regions_array);
+	bool commit = parse_input_regions(popup, decoded->input_regions.arena);
 
 	json_object_put(popup->userdata);
-	popup->userdata = json_object_get(userdata);
+	popup->userdata = arena_json_to_json_object(decoded->userdata.arena);
 
 	if (reposition) {
 		popup_configure_xdg_positioner(popup);
@@ -2009,9 +3811,7 @@ static bool popup_configure(struct surface *popup, json_object *popup_json) {
 		} else if (commit) {
 			wl_surface_commit(popup->wl_surface);
 		}
-		json_object *popups_array;
-		json_object_object_get_ex(popup_json, "popups", &popups_array);
-		parse_popups(popups_array, &popup->popups, popup);
+		parse_popups(decoded->popups.arena, &popup->popups, popup);
 	}
 
 	return true;
@@ -2049,7 +3849,8 @@ static const struct wl_surface_listener popup_wl_surface_listener = {
 	.preferred_buffer_scale = popup_wl_surface_preferred_buffer_scale,
 };
 
-static struct surface *popup_create(json_object *popup_json, struct surface *parent) {
+static struct surface *popup_create(const struct sbar_schema_popup *decoded,
+		struct surface *parent) {
 	struct surface *popup = calloc(1, sizeof(struct surface));
 	popup->type = SURFACE_TYPE_POPUP;
 	surface_init(popup);
@@ -2059,7 +3860,7 @@ static struct surface *popup_create(json_object *popup_json, struct surface *par
 	popup->xdg_positioner = xdg_wm_base_create_positioner(xdg_wm_base);
 	popup->parent = parent;
 
-	if (!popup_configure(popup, popup_json)) {
+	if (!popup_configure(popup, decoded)) {
 		goto error;
 	}
 
@@ -2068,10 +3869,8 @@ static struct surface *popup_create(json_object *popup_json, struct surface *par
 		popup->xdg_popup = xdg_surface_get_popup(
 			popup->xdg_surface, NULL, popup->xdg_positioner);
 		zwlr_layer_surface_v1_get_popup(parent->layer_surface, popup->xdg_popup);
-		json_object *grab;
-		json_object_object_get_ex(popup_json, "grab", &grab);
-		if (json_object_is_type(grab, json_type_int)) {
-			int64_t serial = json_object_get_int64(grab);
+		if (decoded->grab.set) {
+			int64_t serial = decoded->grab.value;
 			for (size_t i = 0; i < seats.len; ++i) {
 				struct seat *seat = seats.items[i];
 				for (uint8_t j = (uint8_t)(seat->popup_grab.index - 1);
@@ -2103,9 +3902,7 @@ grab:
 			popup->grab.seat, popup->grab.serial);
 	}
 
-	json_object *popups_array;
-	json_object_object_get_ex(popup_json, "popups", &popups_array);
-	parse_popups(popups_array, &popup->popups, popup);
+	parse_popups(decoded->popups.arena, &popup->popups, popup);
 
 	wl_surface_add_listener(popup->wl_surface, &popup_wl_surface_listener, popup);
 	xdg_surface_add_listener(popup->xdg_surface, &popup_xdg_surface_listener, popup);
@@ -2136,33 +3933,14 @@ static void bar_destroy(struct surface *bar) {
 	free(bar);
 }
 
-static bool bar_configure(struct surface *bar, json_object *bar_json) {
-	json_object *width, *height, *exclusive_zone_json, *anchor_json;
-	json_object *layer_json, *margins_json[4], *cursor_shape, *render_json;
-	json_object *input_regions_array, *userdata, *popups_array, *blocks_array;
-	json_object_object_get_ex(bar_json, "width", &width);
-	json_object_object_get_ex(bar_json, "height", &height);
-	json_object_object_get_ex(bar_json, "exclusive_zone", &exclusive_zone_json);
-	json_object_object_get_ex(bar_json, "anchor", &anchor_json);
-	json_object_object_get_ex(bar_json, "layer", &layer_json);
-	json_object_object_get_ex(bar_json, "margin_top", &margins_json[0]);
-	json_object_object_get_ex(bar_json, "margin_right", &margins_json[1]);
-	json_object_object_get_ex(bar_json, "margin_bottom", &margins_json[2]);
-	json_object_object_get_ex(bar_json, "margin_left", &margins_json[3]);
-	json_object_object_get_ex(bar_json, "cursor_shape", &cursor_shape);
-	json_object_object_get_ex(bar_json, "render", &render_json);
-	json_object_object_get_ex(bar_json, "input_regions", &input_regions_array);
-	json_object_object_get_ex(bar_json, "userdata", &userdata);
-	json_object_object_get_ex(bar_json, "popups", &popups_array);
-	json_object_object_get_ex(bar_json, "blocks", &blocks_array);
-
+static bool bar_configure(struct surface *bar, const struct sbar_schema_bar *decoded) {
 	bool render = false, commit = false;
-	if (parse_blocks(blocks_array, bar)) {
+	if (parse_blocks(decoded->blocks.arena, bar)) {
 		render = true;
 	}
+	bar->id = (uint64_t)SBAR_SCHEMA_GET(decoded->id, 0);
 
-	int32_t tmp = json_object_is_type(anchor_json, json_type_int)
-		? json_object_get_int(anchor_json) : -1;
+	int32_t tmp = (int32_t)SBAR_SCHEMA_GET(decoded->anchor, -1);
 	bool vertical = false;
 	enum zwlr_layer_surface_v1_anchor anchor;
 	switch ((enum sbar_bar_anchor)tmp) {
@@ -2183,32 +3961,12 @@ static bool bar_configure(struct surface *bar, json_object *bar_json) {
 		vertical = true;
 		break;
 	}
-	int32_t wanted_width = json_object_is_type(width, json_type_int)
-			? (int32_t)json_object_get_uint64(width) : 0;
-	if ((wanted_width == 0) && vertical) {
-		struct block_box box;
-		for (size_t i = 0; i < bar->blocks.len; ++i) {
-			struct block *block = bar->blocks.items[i];
-			block_get_size(block, bar, (i > 0) ? &box : NULL, &box);
-			if ((box.width > wanted_width) && block && block->render
-					&& (block->anchor != SBAR_BLOCK_ANCHOR_NONE)) {
-				wanted_width = box.width;
-			}
-		}
-	}
-	int32_t wanted_height = json_object_is_type(height, json_type_int)
-			? (int32_t)json_object_get_uint64(height) : 0;
-	if ((wanted_height == 0) && !vertical) {
-		struct block_box box;
-		for (size_t i = 0; i < bar->blocks.len; ++i) {
-			struct block *block = bar->blocks.items[i];
-			block_get_size(block, bar, (i > 0) ? &box : NULL, &box);
-			if (((box.height > wanted_height)) && block && block->render
-					&& (block->anchor != SBAR_BLOCK_ANCHOR_NONE)) {
-				wanted_height = box.height;
-			}
-		}
-	}
+	bar->config_width = (int32_t)SBAR_SCHEMA_GET(decoded->width, 0);
+	bar->config_height = (int32_t)SBAR_SCHEMA_GET(decoded->height, 0);
+	int32_t wanted_width = ((bar->config_width == 0) && vertical)
+		? surface_get_blocks_size(bar, false, false) : bar->config_width;
+	int32_t wanted_height = ((bar->config_height == 0) && !vertical)
+		? surface_get_blocks_size(bar, true, false) : bar->config_height;
 	if ((wanted_width == 0) && (wanted_height == 0)) {
 		return false;
 	}
@@ -2223,8 +3981,8 @@ static bool bar_configure(struct surface *bar, json_object *bar_json) {
 		render = true;
 	}
 
-	tmp = json_object_is_type(exclusive_zone_json, json_type_int)
-		? json_object_get_int(exclusive_zone_json) : -1;
+	tmp = (int32_t)SBAR_SCHEMA_GET(decoded->exclusive_zone, -1);
+	bar->config_exclusive_zone = tmp;
 	int32_t exclusive_zone = (tmp >= 0) ? tmp :
 		(vertical ? wanted_width : wanted_height);
 	if (bar->exclusive_zone != exclusive_zone) {
@@ -2234,7 +3992,7 @@ static bool bar_configure(struct surface *bar, json_object *bar_json) {
 		commit = true;
 	}
 
-	parse_cursor_shape(cursor_shape, bar);
+	parse_cursor_shape(decoded->cursor_shape, bar);
 
 	if (bar->anchor != anchor) {
 		zwlr_layer_surface_v1_set_anchor(bar->layer_surface, vertical
@@ -2244,8 +4002,7 @@ static bool bar_configure(struct surface *bar, json_object *bar_json) {
 		commit = true;
 	}
 
-	tmp = json_object_is_type(layer_json, json_type_int)
-		? json_object_get_int(layer_json) : -1;
+	tmp = (int32_t)SBAR_SCHEMA_GET(decoded->layer, -1);
 	enum zwlr_layer_shell_v1_layer layer;
 	switch ((enum sbar_bar_layer)tmp) {
 	case SBAR_BAR_LAYER_BACKGROUND:
@@ -2269,11 +4026,12 @@ static bool bar_configure(struct surface *bar, json_object *bar_json) {
 		commit = true;
 	}
 
-	int32_t margins[4];
-	for (size_t i = 0; i < LENGTH(margins); ++i) {
-		margins[i] = json_object_is_type(margins_json[i], json_type_int)
-			? (int32_t)json_object_get_uint64(margins_json[i]) : 0;
-	}
+	int32_t margins[4] = {
+		(int32_t)SBAR_SCHEMA_GET(decoded->margin_top, 0),
+		(int32_t)SBAR_SCHEMA_GET(decoded->margin_right, 0),
+		(int32_t)SBAR_SCHEMA_GET(decoded->margin_bottom, 0),
+		(int32_t)SBAR_SCHEMA_GET(decoded->margin_left, 0),
+	};
 	if (memcmp(bar->margins, margins, sizeof(margins)) != 0) {
 		zwlr_layer_surface_v1_set_margin(bar->layer_surface,
 			margins[0] / bar->scale,
@@ -2284,19 +4042,18 @@ static bool bar_configure(struct surface *bar, json_object *bar_json) {
 		commit = true;
 	}
 
-	tmp = json_object_is_type(render_json, json_type_boolean)
-		? json_object_get_boolean(render_json) : true;
+	tmp = SBAR_SCHEMA_GET(decoded->render, true);
 	if (tmp != bar->render) {
 		bar->render = tmp;
 		render = true;
 	}
 
-	if (parse_input_regions(bar, input_regions_array)) {
+	if (parse_input_regions(bar, decoded->input_regions.arena)) {
 		commit = true;
 	}
 
 	json_object_put(bar->userdata);
-	bar->userdata = json_object_get(userdata);
+	bar->userdata = arena_json_to_json_object(decoded->userdata.arena);
 
 	if (bar->buffer == NULL) {
 		wl_surface_commit(bar->wl_surface);
@@ -2306,7 +4063,7 @@ static bool bar_configure(struct surface *bar, json_object *bar_json) {
 		wl_surface_commit(bar->wl_surface);
 	}
 
-	parse_popups(popups_array, &bar->popups, bar);
+	parse_popups(decoded->popups.arena, &bar->popups, bar);
 
 	return true;
 }
@@ -2331,12 +4088,12 @@ static void bar_layer_surface_configure(void *data, MAYBE_UNUSED struct zwlr_lay
 
 static void bar_layer_surface_closed(void *data, MAYBE_UNUSED struct zwlr_layer_surface_v1 *layer_surface) {
 	struct surface *bar = data;
-	struct output *output = bar->output;
-	for (size_t i = 0; i < output->bars.len; ++i) {
-		if (output->bars.items[i] == bar) {
+	struct client_output *client_output = client_get_output(bar->client, bar->output, false);
+	for (size_t i = 0; i < client_output->bars.len; ++i) {
+		if (client_output->bars.items[i] == bar) {
 			bar_destroy(bar);
-			ptr_array_put(&output->bars, i, NULL);
-			state_dirty = true;
+			ptr_array_put(&client_output->bars, i, NULL);
+			state_dirty |= STATE_EVENTS_MASK_SURFACES;
 			return;
 		}
 	}
@@ -2372,7 +4129,8 @@ static const struct wl_surface_listener bar_wl_surface_listener = {
 	.preferred_buffer_scale = bar_wl_surface_preferred_buffer_scale,
 };
 
-static struct surface *bar_create(json_object *bar_json, struct output *output) {
+static struct surface *bar_create(const struct sbar_schema_bar *decoded, struct output *output,
+		struct client *client) {
 	struct surface *bar = calloc(1, sizeof(struct surface));
 	bar->type = SURFACE_TYPE_BAR;
 	surface_init(bar);
@@ -2381,12 +4139,13 @@ static struct surface *bar_create(json_object *bar_json, struct output *output)
 		zwlr_layer_shell_v1_get_layer_surface(zwlr_layer_shell_v1, bar->wl_surface,
 		output->wl_output, ZWLR_LAYER_SHELL_V1_LAYER_TOP, "sbar");
 	bar->output = output;
+	bar->client = client;
 	bar->layer = ZWLR_LAYER_SHELL_V1_LAYER_TOP;
 
 	wl_surface_add_listener(bar->wl_surface, &bar_wl_surface_listener, bar);
 	zwlr_layer_surface_v1_add_listener(bar->layer_surface, &bar_layer_surface_listener, bar);
 
-	if (!bar_configure(bar, bar_json)) {
+	if (!bar_configure(bar, decoded)) {
 		bar_destroy(bar);
 		return NULL;
 	}
@@ -2394,48 +4153,440 @@ static struct surface *bar_create(json_object *bar_json, struct output *output)
 	return bar;
 }
 
-static void parse_popups(json_object *popups_array, ptr_array_t *dest, // struct surface * , NULL
+static void parse_popups(const struct arena_json *popups_array, ptr_array_t *dest, // struct surface * , NULL
 		struct surface *parent) {
 	size_t _popups_len = 0;
-	if (json_object_is_type(popups_array, json_type_array)) {
-		_popups_len = json_object_array_length(popups_array);
+	if (arena_json_is_type(popups_array, ARENA_JSON_TYPE_ARRAY)) {
+		_popups_len = popups_array->len;
 		for (size_t i = 0; i < _popups_len; ++i) {
-			json_object *popup_json = json_object_array_get_idx(popups_array, i);
+			struct sbar_schema_popup decoded = { 0 };
+			sbar_schema_decode_arena(&sbar_schema_popup, &popups_array->items[i], &decoded);
 			struct surface *popup = (i < dest->len) ? dest->items[i] : NULL;
 			if (popup == NULL) {
-				ptr_array_put(dest, i, popup_create(popup_json, parent));
-			} else if (!popup_configure(popup, popup_json)) {
+				ptr_array_put(dest, i, popup_create(&decoded, parent));
+			} else if (!popup_configure(popup, &decoded)) {
 				popup_destroy(popup);
 				ptr_array_put(dest, i, NULL);
 			}
 		}
 	}
-	if (dest->len > _popups_len) {
-		for (size_t i = _popups_len; i < dest->len; ++i) {
-			popup_destroy(dest->items[i]);
+	if (dest->len > _popups_len) {
+		for (size_t i = _popups_len; i < dest->len; ++i) {
+			popup_destroy(dest->items[i]);
+		}
+		dest->len = _popups_len;
+	}
+	state_touch(&parent->state_generation);
+}
+
+static void client_output_destroy(struct client_output *client_output) {
+	for (size_t i = 0; i < client_output->bars.len; ++i) {
+		bar_destroy(client_output->bars.items[i]);
+	}
+	ptr_array_fini(&client_output->bars);
+
+	free(client_output);
+}
+
+static void surfaces_collect(ptr_array_t *surfaces, ptr_array_t *dest) { // struct surface * , NULL
+	for (size_t i = 0; i < surfaces->len; ++i) {
+		struct surface *surface = surfaces->items[i];
+		if (surface) {
+			ptr_array_add(dest, surface);
+			surfaces_collect(&surface->popups, dest);
+		}
+	}
+}
+
+// new block for SBAR_PATCH_OP_SET or SBAR_PATCH_OP_REPLACE
+// arena holds the merged json until the patch is applied
+static struct block *block_patch(struct block *old, enum sbar_patch_op op,
+		const struct arena_json *patch_block_json, struct client *client, arena_t *arena) {
+	struct arena_json merged;
+	const struct arena_json *block_json = patch_block_json;
+	if ((op == SBAR_PATCH_OP_SET) && old && arena_json_is_type(old->json, ARENA_JSON_TYPE_OBJECT)) {
+		arena_json_object_merge(arena, old->json, patch_block_json, &merged);
+		block_json = &merged;
+	}
+
+	struct sbar_schema_block decoded = { 0 };
+	sbar_schema_decode_arena(&sbar_schema_block, block_json, &decoded);
+	uint64_t id = block_decoded_id(&decoded);
+	if (id > 0) {
+		// content changed, so block_get must not return cached block with the same id
+		for (size_t i = 0; i < client->blocks_with_id.len; ++i) {
+			struct block *block = client->blocks_with_id.items[i];
+			if (block->id == id) {
+				ptr_array_pop(&client->blocks_with_id, i);
+				break;
+			}
+		}
+	}
+
+	return block_get(block_json, &decoded, client, BLOCK_GET_SURFACE);
+}
+
+static void surface_blocks_patched(struct surface *surface) {
+	if (surface->block_boxes.size < surface->blocks.len) {
+		array_resize(&surface->block_boxes, surface->blocks.len * 2);
+	}
+	if (surface->blocks.len > 0) {
+		memset(surface->block_boxes.items, 0, surface->blocks.len * sizeof(struct block_box));
+	}
+	surface->block_boxes.len = surface->blocks.len;
+
+	int32_t wanted_width, wanted_height;
+	if (surface->type == SURFACE_TYPE_BAR) {
+		wanted_width = ((surface->config_width == 0) && surface->vertical)
+			? surface_get_blocks_size(surface, false, false) : surface->config_width;
+		wanted_height = ((surface->config_height == 0) && !surface->vertical)
+			? surface_get_blocks_size(surface, true, false) : surface->config_height;
+	} else {
+		wanted_width = (surface->config_width != 0) ? surface->config_width
+			: surface_get_blocks_size(surface, false, !surface->vertical);
+		wanted_height = (surface->config_height != 0) ? surface->config_height
+			: surface_get_blocks_size(surface, true, surface->vertical);
+	}
+
+	bool resize = ((wanted_width != surface->wanted_width) || (wanted_height != surface->wanted_height))
+		&& (wanted_width > 0) && (wanted_height > 0);
+	if (resize) {
+		surface->wanted_width = wanted_width;
+		surface->wanted_height = wanted_height;
+	}
+
+	if (surface->type == SURFACE_TYPE_BAR) {
+		if (resize) {
+			zwlr_layer_surface_v1_set_size(surface->layer_surface,
+				(uint32_t)(wanted_width / surface->scale),
+				(uint32_t)(wanted_height / surface->scale));
+			int32_t exclusive_zone = (surface->config_exclusive_zone >= 0)
+				? surface->config_exclusive_zone
+				: (surface->vertical ? wanted_width : wanted_height);
+			if (surface->exclusive_zone != exclusive_zone) {
+				zwlr_layer_surface_v1_set_exclusive_zone(surface->layer_surface,
+					exclusive_zone / surface->scale);
+				surface->exclusive_zone = exclusive_zone;
+			}
+		}
+		// new size is applied by the commit in surface_render, configure event renders again
+		if (surface->buffer) {
+			surface_render(surface);
+		} else if (resize) {
+			wl_surface_commit(surface->wl_surface);
+		}
+	} else if (resize) {
+		popup_configure_xdg_positioner(surface);
+		if (surface->xdg_popup) {
+			xdg_popup_reposition(surface->xdg_popup, surface->xdg_positioner, 0);
+		}
+	} else if (surface->buffer) {
+		surface_render(surface);
+	}
+}
+
+// lays out text again after its font was resolved by font_worker
+static bool block_relayout_text(struct block *block) {
+	struct sbar_schema_block decoded = { 0 };
+	sbar_schema_decode_arena(&sbar_schema_block, block->json, &decoded);
+	struct text_layout *layout = text_cache_get(block->font, decoded.text.value, decoded.text.len,
+			(uint32_t)SBAR_SCHEMA_GET(decoded.text_color, 0xFFFFFFFF));
+	if (layout == NULL) {
+		return false;
+	}
+	text_layout_unref(block->layout);
+	block->layout = layout;
+	if (block->placeholder_font) {
+		font_unref(block->placeholder_font);
+		block->placeholder_font = NULL;
+	}
+	if (block->content_image) {
+		pixman_image_unref(block->content_image);
+		block->content_image = NULL;
+	}
+	if (block->fit) {
+		// fitted again by block_get_size()
+		text_fit_clear(block->fit);
+	}
+
+	block->content_width = (int32_t)SBAR_SCHEMA_GET(decoded.content_width, 0);
+	if (block->content_width == SBAR_BLOCK_SIZE_AUTO) {
+		block->content_width = layout->width;
+	}
+	block->content_height = (int32_t)SBAR_SCHEMA_GET(decoded.content_height, 0);
+	if (block->content_height == SBAR_BLOCK_SIZE_AUTO) {
+		block->content_height = layout->height;
+	}
+
+	return true;
+}
+
+static void font_worker_read(void) {
+	char buf[64];
+	while (read(font_worker.wake_fds[0], buf, sizeof(buf)) > 0) {
+		// drain wakeups, results are collected below
+	}
+
+	ptr_array_t resolved; // struct font_cache *
+	ptr_array_init(&resolved, 4);
+	pthread_mutex_lock(&font_worker.mutex);
+	for (size_t i = 0; i < font_worker.results.len; ++i) {
+		ptr_array_add(&resolved, font_worker.results.items[i]);
+	}
+	font_worker.results.len = 0;
+	pthread_mutex_unlock(&font_worker.mutex);
+
+	ptr_array_t surfaces; // struct surface *
+	ptr_array_init(&surfaces, 16);
+	for (size_t i = 0; i < clients.len; ++i) {
+		struct client *client = clients.items[i];
+		for (size_t j = 0; j < client->outputs.len; ++j) {
+			struct client_output *client_output = client->outputs.items[j];
+			surfaces_collect(&client_output->bars, &surfaces);
+		}
+	}
+
+	for (size_t i = 0; i < resolved.len; ++i) {
+		struct font_cache *cache = resolved.items[i];
+		if (cache->pending) {
+			cache->font = cache->resolved;
+			cache->pending = false;
+		} else if (cache->resolved) {
+			// already resolved synchronously by font_cache_resolve_pending()
+			fcft_destroy(cache->resolved);
+		}
+		cache->resolved = NULL;
+		cache->queued = false;
+		if (cache->font == NULL) {
+			// blocks keep the placeholder layout
+			log_stderr("fcft_from_name failed");
+		}
+		clock_gettime(CLOCK_MONOTONIC, &cache->unused_since);
+	}
+
+	for (size_t i = 0; i < surfaces.len; ++i) {
+		struct surface *surface = surfaces.items[i];
+		bool relayout = false;
+		for (size_t j = 0; j < surface->blocks.len; ++j) {
+			struct block *block = surface->blocks.items[j];
+			if ((block == NULL) || (block->type != SBAR_BLOCK_TYPE_TEXT)) {
+				continue;
+			}
+			if (block->placeholder_font && block->font->font) {
+				relayout |= block_relayout_text(block);
+				continue;
+			}
+			// relaid out by block_get() when it was reused as a composite child
+			for (size_t k = 0; k < resolved.len; ++k) {
+				relayout |= (resolved.items[k] == block->font);
+			}
+		}
+		if (relayout) {
+			surface_blocks_patched(surface);
+		}
+	}
+
+	ptr_array_fini(&surfaces);
+	ptr_array_fini(&resolved);
+}
+
+static void parse_patch(const struct arena_json *patch_array, struct client *client,
+		arena_t *arena) {
+	ptr_array_t surfaces; // struct surface *
+	ptr_array_init(&surfaces, 16);
+	for (size_t i = 0; i < client->outputs.len; ++i) {
+		struct client_output *client_output = client->outputs.items[i];
+		surfaces_collect(&client_output->bars, &surfaces);
+	}
+
+	ptr_array_t patched_surfaces; // struct surface *
+	ptr_array_init(&patched_surfaces, 4);
+
+	for (size_t i = 0; i < patch_array->len; ++i) {
+		const struct arena_json *patch_json = &patch_array->items[i];
+		const struct arena_json *op_json = arena_json_object_get(patch_json, "op");
+		const struct arena_json *surface_id_json = arena_json_object_get(patch_json, "surface_id");
+		const struct arena_json *block_id_json = arena_json_object_get(patch_json, "block_id");
+		const struct arena_json *index_json = arena_json_object_get(patch_json, "index");
+		const struct arena_json *block_json = arena_json_object_get(patch_json, "block");
+
+		enum sbar_patch_op op = arena_json_is_type(op_json, ARENA_JSON_TYPE_INT)
+			? (enum sbar_patch_op)op_json->integer : SBAR_PATCH_OP_DEFAULT;
+		switch (op) {
+		case SBAR_PATCH_OP_SET:
+		case SBAR_PATCH_OP_REPLACE:
+		case SBAR_PATCH_OP_INSERT:
+			if (!arena_json_is_type(block_json, ARENA_JSON_TYPE_OBJECT)) {
+				log_debug("discard patch %zu without block", i);
+				continue;
+			}
+			break;
+		case SBAR_PATCH_OP_REMOVE:
+			break;
+		case SBAR_PATCH_OP_DEFAULT:
+		default:
+			continue;
+		}
+
+		if (arena_json_is_type(block_id_json, ARENA_JSON_TYPE_INT)) {
+			// every top level block with this id, in all surfaces of the client
+			uint64_t block_id = (block_id_json->integer > 0) ? (uint64_t)block_id_json->integer : 0;
+			if ((block_id == 0) || (op == SBAR_PATCH_OP_INSERT)) {
+				continue;
+			}
+			struct block *new_block = NULL;
+			bool created = false;
+			for (size_t s = 0; s < surfaces.len; ++s) {
+				struct surface *surface = surfaces.items[s];
+				bool patched = false;
+				for (size_t j = 0; j < surface->blocks.len; ++j) {
+					struct block *block = surface->blocks.items[j];
+					if ((block == NULL) || (block->id != block_id)) {
+						continue;
+					}
+					if (op == SBAR_PATCH_OP_REMOVE) {
+						ptr_array_pop(&surface->blocks, j--);
+					} else {
+						if (!created) {
+							new_block = block_patch(block, op, block_json, client, arena);
+							created = true;
+						}
+						if (new_block) {
+							new_block->ref_count++;
+						}
+						surface->blocks.items[j] = new_block;
+					}
+					block_unref(block);
+					patched = true;
+				}
+				if (patched) {
+					ptr_array_add(&patched_surfaces, surface);
+				}
+			}
+			block_unref(new_block);
+			continue;
+		}
+
+		if (!arena_json_is_type(surface_id_json, ARENA_JSON_TYPE_INT)) {
+			continue;
+		}
+		uint64_t surface_id = (uint64_t)surface_id_json->integer;
+		struct surface *surface = NULL;
+		for (size_t s = 0; s < surfaces.len; ++s) {
+			struct surface *tmp = surfaces.items[s];
+			if ((surface_id > 0) && (tmp->id == surface_id)) {
+				surface = tmp;
+				break;
+			}
+		}
+		if (surface == NULL) {
+			log_debug("patch: no surface with id %llu", (unsigned long long)surface_id);
+			continue;
+		}
+
+		int64_t index = arena_json_is_type(index_json, ARENA_JSON_TYPE_INT)
+			? index_json->integer : -1;
+		if (op == SBAR_PATCH_OP_INSERT) {
+			if ((index < 0) || ((size_t)index > surface->blocks.len)) {
+				index = (int64_t)surface->blocks.len;
+			}
+			struct sbar_schema_block decoded = { 0 };
+			sbar_schema_decode_arena(&sbar_schema_block, block_json, &decoded);
+			ptr_array_insert(&surface->blocks, (size_t)index,
+				block_get(block_json, &decoded, client, BLOCK_GET_SURFACE));
+		} else if ((index >= 0) && ((size_t)index < surface->blocks.len)) {
+			struct block *block = surface->blocks.items[index];
+			if (op == SBAR_PATCH_OP_REMOVE) {
+				ptr_array_pop(&surface->blocks, (size_t)index);
+			} else {
+				surface->blocks.items[index] = block_patch(block, op, block_json, client, arena);
+			}
+			block_unref(block);
+		} else {
+			continue;
+		}
+		ptr_array_add(&patched_surfaces, surface);
+	}
+
+	for (size_t i = 0; i < patched_surfaces.len; ++i) {
+		struct surface *surface = patched_surfaces.items[i];
+		bool done = false;
+		for (size_t j = 0; j < i; ++j) {
+			if (patched_surfaces.items[j] == surface) {
+				done = true;
+				break;
+			}
+		}
+		if (!done) {
+			surface_blocks_patched(surface);
+		}
+	}
+
+	ptr_array_fini(&patched_surfaces);
+	ptr_array_fini(&surfaces);
+
+	state_dirty |= STATE_EVENTS_MASK_SURFACES;
+}
+
+// arena is for temporary allocations, it must outlive json only until this returns
+static void parse_json(struct client *client, const struct arena_json *json, arena_t *arena) {
+	if (!arena_json_is_type(json, ARENA_JSON_TYPE_OBJECT)) {
+		return;
+	}
+
+	const struct arena_json *patch_array = arena_json_object_get(json, "patch");
+	if (patch_array) {
+		if (arena_json_is_type(patch_array, ARENA_JSON_TYPE_ARRAY)) {
+			parse_patch(patch_array, client, arena);
 		}
-		dest->len = _popups_len;
+		return;
 	}
-}
 
-static void parse_json(const char *json_str) {
-	json_object *json = json_tokener_parse(json_str);
-	if (!json_object_is_type(json, json_type_object)) {
-		log_debug("discard invalid json: %s", json_str);
-		goto cleanup;
+	const struct arena_json *measure_array = arena_json_object_get(json, "measure");
+	if (measure_array) {
+		if (arena_json_is_type(measure_array, ARENA_JSON_TYPE_ARRAY)) {
+			client_send_measure(client, measure_array);
+		}
+		return;
 	}
 
-	log_debug("parsing json:\n%s", json_str);
+	const struct arena_json *state_ack = arena_json_object_get(json, "state_ack");
+	const struct arena_json *state_snapshot = arena_json_object_get(json, "state_snapshot");
+	if (state_ack || state_snapshot) {
+		if (arena_json_is_type(state_ack, ARENA_JSON_TYPE_INT) && (state_ack->integer > 0)) {
+			uint64_t generation = (uint64_t)state_ack->integer;
+			if ((generation > client->state_acked_generation)
+					&& (generation <= state_generation)) {
+				client->state_acked_generation = generation;
+			}
+		}
+		if (arena_json_is_type(state_snapshot, ARENA_JSON_TYPE_BOOLEAN)
+				&& state_snapshot->boolean) {
+			client->state_snapshot = true;
+			client_send_state(client);
+		}
+		return;
+	}
 
-	json_object *userdata, *state_events_json;
-	json_object_object_get_ex(json, "userdata", &userdata);
-	json_object_object_get_ex(json, "state_events", &state_events_json);
+	const struct arena_json *state_events_json = arena_json_object_get(json, "state_events");
+	const struct arena_json *state_events_mask_json = arena_json_object_get(json, "state_events_mask");
+	const struct arena_json *pointer_events_json = arena_json_object_get(json, "pointer_events");
+	const struct arena_json *state_delta_json = arena_json_object_get(json, "state_delta");
 
-	json_object_put(state_userdata);
-	state_userdata = json_object_get(userdata);
+	json_object_put(client->userdata);
+	client->userdata = arena_json_to_json_object(arena_json_object_get(json, "userdata"));
 
-	state_events = json_object_is_type(state_events_json, json_type_boolean)
-		? json_object_get_boolean(state_events_json) : false;
+	client->state_events = arena_json_is_type(state_events_json, ARENA_JSON_TYPE_BOOLEAN)
+		? state_events_json->boolean : false;
+	client->state_events_mask = arena_json_is_type(state_events_mask_json, ARENA_JSON_TYPE_INT)
+		? (uint32_t)state_events_mask_json->integer & SBAR_STATE_EVENTS_MASK_ALL
+		: SBAR_STATE_EVENTS_MASK_ALL;
+	client->pointer_events = arena_json_is_type(pointer_events_json, ARENA_JSON_TYPE_BOOLEAN)
+		? pointer_events_json->boolean : false;
+	client->state_delta = arena_json_is_type(state_delta_json, ARENA_JSON_TYPE_BOOLEAN)
+		? state_delta_json->boolean : false;
+	// new userdata, so client will discard deltas against older state
+	client->state_snapshot = true;
 
 	for (size_t o = 0; o < outputs.len; ++o) {
 		struct output *output = outputs.items[o];
@@ -2443,41 +4594,208 @@ static void parse_json(const char *json_str) {
 			continue;
 		}
 
-		json_object *bars_array;
+		const struct arena_json *bars_array = arena_json_object_get(json, output->name);
 		size_t _bars_len = 0;
-		json_object_object_get_ex(json, output->name, &bars_array);
-		if (json_object_is_type(bars_array, json_type_array)) {
-			_bars_len = json_object_array_length(bars_array);
+		struct client_output *client_output = client_get_output(client, output,
+			arena_json_is_type(bars_array, ARENA_JSON_TYPE_ARRAY));
+		if (client_output == NULL) {
+			continue;
+		}
+		ptr_array_t *bars = &client_output->bars;
+		if (arena_json_is_type(bars_array, ARENA_JSON_TYPE_ARRAY)) {
+			_bars_len = bars_array->len;
 			for (size_t i = 0; i < _bars_len; ++i) {
-				json_object *bar_json = json_object_array_get_idx(bars_array, i);
-				struct surface *bar = (i < output->bars.len) ? output->bars.items[i] : NULL;
+				struct sbar_schema_bar decoded = { 0 };
+				sbar_schema_decode_arena(&sbar_schema_bar, &bars_array->items[i], &decoded);
+				struct surface *bar = (i < bars->len) ? bars->items[i] : NULL;
 				if (bar == NULL) {
-					ptr_array_put(&output->bars, i, bar_create(bar_json, output));
-				} else if (!bar_configure(bar, bar_json)) {
+					ptr_array_put(bars, i, bar_create(&decoded, output, client));
+				} else if (!bar_configure(bar, &decoded)) {
 					bar_destroy(bar);
-					ptr_array_put(&output->bars, i, NULL);
+					ptr_array_put(bars, i, NULL);
 				}
 			}
 		}
-		if (output->bars.len > _bars_len) {
-			for (size_t i = _bars_len; i < output->bars.len; ++i) {
-				bar_destroy(output->bars.items[i]);
+		if (bars->len > _bars_len) {
+			for (size_t i = _bars_len; i < bars->len; ++i) {
+				bar_destroy(bars->items[i]);
 			}
-			output->bars.len = _bars_len;
+			bars->len = _bars_len;
 		}
 	}
 
-	state_dirty = true;
+	state_dirty |= SBAR_STATE_EVENTS_MASK_ALL;
+}
 
-cleanup:
-	json_object_put(json);
+static void client_discard_pending_json(struct client *client) {
+	client->pending_json.len = 0;
+	arena_reset(&client->pending_arena);
+}
+
+static struct client *client_create(int read_fd, int write_fd) {
+	struct client *client = calloc(1, sizeof(struct client));
+	client->read_fd = read_fd;
+	client->write_fd = write_fd;
+	client->read_buffer_size = 4096;
+	client->read_buffer = malloc(client->read_buffer_size);
+	arena_init(&client->parse_arena, 65536);
+	arena_init(&client->pending_arena, 65536);
+	array_init(&client->pending_json, 16, sizeof(struct arena_json));
+	client_write_queue_resize(client, CLIENT_WRITE_QUEUE_MIN_LEN);
+	ptr_array_init(&client->outputs, 4);
+	ptr_array_init(&client->blocks_with_id, 100);
+
+	return client;
+}
+
+static void client_destroy_bars(struct client *client) {
+	for (size_t i = 0; i < client->outputs.len; ++i) {
+		client_output_destroy(client->outputs.items[i]);
+	}
+	client->outputs.len = 0;
+	client->state_events = false;
+	client->pointer_events = false;
+
+	state_dirty |= SBAR_STATE_EVENTS_MASK_ALL;
+}
+
+static void client_destroy(struct client *client) {
+	if (client == NULL) {
+		return;
+	}
+
+	client_destroy_bars(client);
+	assert(client->blocks_with_id.len == 0);
+
+	for (size_t i = 0; i < seats.len; ++i) {
+		struct seat *seat = seats.items[i];
+		if (seat->pointer.frame.left_client == client) {
+			seat->pointer.frame.left_client = NULL;
+		}
+	}
+
+	if (client->read_fd != STDIN_FILENO) {
+		close(client->read_fd);
+	}
+	ptr_array_fini(&client->outputs);
+	ptr_array_fini(&client->blocks_with_id);
+	json_object_put(client->userdata);
+	free(client->read_buffer);
+	arena_fini(&client->parse_arena);
+	arena_fini(&client->pending_arena);
+	array_fini(&client->pending_json);
+	for (size_t i = 0; i < client->write_queue_size; ++i) {
+		json_writer_fini(&client->write_queue[i].writer);
+	}
+	free(client->write_queue);
+
+	free(client);
+}
+
+static void client_apply_pending_json(struct client *client) {
+	for (size_t i = 0; i < client->pending_json.len; ++i) {
+		parse_json(client, &((struct arena_json *)client->pending_json.items)[i],
+			&client->pending_arena);
+	}
+	client_discard_pending_json(client);
+}
+
+// returns false on eof or error
+static bool json_is_full_state(const struct arena_json *json) {
+	return arena_json_is_type(json, ARENA_JSON_TYPE_OBJECT)
+		&& !arena_json_object_get(json, "patch")
+		&& !arena_json_object_get(json, "measure")
+		&& !arena_json_object_get(json, "state_ack")
+		&& !arena_json_object_get(json, "state_snapshot");
+}
+
+// json is in client->parse_arena
+static void client_queue_json(struct client *client, const struct arena_json *json) {
+	if (json_is_full_state(json)) {
+		// full state replaces everything that came before it
+		if (client->pending_json.len > 0) {
+			log_debug("dropping %zu superseded messages", client->pending_json.len);
+		}
+		client_discard_pending_json(client);
+	} else if (!arena_json_object_get(json, "patch")) {
+		if (!arena_json_object_get(json, "measure")) {
+			// state_ack and state_snapshot refer to the state sent before them
+			client_apply_pending_json(client);
+		}
+		// measure does not depend on bars, so it does not wait for pending state
+		parse_json(client, json, &client->parse_arena);
+		arena_reset(&client->parse_arena);
+		return;
+	}
+
+	if (client->pending_json.len == 0) {
+		// pending_arena is empty, take over parse_arena instead of copying
+		arena_t tmp = client->pending_arena;
+		client->pending_arena = client->parse_arena;
+		client->parse_arena = tmp;
+		array_add(&client->pending_json, (void *)json);
+	} else {
+		struct arena_json copy;
+		arena_json_copy(&client->pending_arena, json, &copy);
+		array_add(&client->pending_json, &copy);
+		arena_reset(&client->parse_arena);
+	}
+}
+
+static void client_parse_line(struct client *client, const char *line, size_t len) {
+	struct arena_json json;
+	if (!arena_json_parse(&json_parser, &client->parse_arena, line, len, &json)) {
+		log_debug("discard invalid json: %s at %zu", json_parser.error, json_parser.error_offset);
+		arena_reset(&client->parse_arena);
+		return;
+	}
+	if (json.type != ARENA_JSON_TYPE_OBJECT) {
+		log_debug("discard json: %.*s", (int)len, line);
+		arena_reset(&client->parse_arena);
+		return;
+	}
+
+	log_debug("parsing json:\n%.*s", (int)len, line);
+	client_queue_json(client, &json);
+}
+
+static void client_read_buffer_append(struct client *client, const char *data, size_t len) {
+	if ((client->read_buffer_len + len) > client->read_buffer_size) {
+		while ((client->read_buffer_len + len) > client->read_buffer_size) {
+			client->read_buffer_size *= 2;
+		}
+		client->read_buffer = realloc(client->read_buffer, client->read_buffer_size);
+	}
+	memcpy(&client->read_buffer[client->read_buffer_len], data, len);
+	client->read_buffer_len += len;
 }
 
-static void read_stdin(void) {
+// messages are separated by newlines, complete lines are parsed straight from data
+static void client_parse(struct client *client, const char *data, size_t len) {
+	size_t offset = 0;
+	const char *newline;
+	while ((offset < len) && (newline = memchr(&data[offset], '\n', len - offset))) {
+		size_t line_len = (size_t)(newline - &data[offset]);
+		if (client->read_buffer_len > 0) {
+			// rest of the line started in previous read
+			client_read_buffer_append(client, &data[offset], line_len);
+			client_parse_line(client, client->read_buffer, client->read_buffer_len);
+			client->read_buffer_len = 0;
+		} else if (line_len > 0) {
+			client_parse_line(client, &data[offset], line_len);
+		}
+		offset += line_len + 1;
+	}
+	if (offset < len) {
+		client_read_buffer_append(client, &data[offset], len - offset);
+	}
+}
+
+static bool client_read(struct client *client) {
+	// complete lines are parsed as they arrive, only incomplete one is kept between reads
+	static char buffer[65536];
     for (;;) {
-		ssize_t read_bytes = read(STDIN_FILENO,
-			&stdin_buffer[stdin_buffer_index],
-			stdin_buffer_size - stdin_buffer_index);
+		ssize_t read_bytes = read(client->read_fd, buffer, sizeof(buffer));
 		if (read_bytes <= 0) {
 			if (read_bytes == 0) {
 				errno = EPIPE;
@@ -2487,51 +4805,261 @@ static void read_stdin(void) {
 			} else if (errno == EINTR) {
 				continue;
 			} else {
-				abort_(errno, "read: %s", strerror(errno));
+				log_debug("read: %s", strerror(errno));
+				// messages read before eof are applied like they were before batching
+				client_apply_pending_json(client);
+				return false;
 			}
 		} else {
-			stdin_buffer_index += (size_t)read_bytes;
-			if (stdin_buffer_index == stdin_buffer_size) {
-				stdin_buffer_size *= 2;
-				stdin_buffer = realloc(stdin_buffer, stdin_buffer_size);
-			}
+			client_parse(client, buffer, (size_t)read_bytes);
 		}
     }
 
-	if (stdin_buffer_index > 0) {
-		for (size_t n = stdin_buffer_index - 1; n > 0; --n) {
-			if (stdin_buffer[n] == '\n') {
-				stdin_buffer[n] = '\0';
-				char *tmp = NULL;
-				const char *json = strtok_r(stdin_buffer, "\n", &tmp);
-				while (json) {
-					parse_json(json);
-					json = strtok_r(NULL, "\n", &tmp);
-				}
-				stdin_buffer_index -= ++n;
-				memmove(stdin_buffer, &stdin_buffer[n], stdin_buffer_index);
-			}
-		}
-	}
+	// only the last full state and patches after it
+	client_apply_pending_json(client);
+
+	return true;
 }
 
-static void flush_stdout(void) {
-	while (stdout_buffer_index > 0) {
-		ssize_t written = write(STDOUT_FILENO, stdout_buffer, stdout_buffer_index);
+// poll_fd is the one used to wait for client->write_fd to become writable.
+// returns false on error
+static bool client_flush(struct client *client, struct pollfd *poll_fd) {
+	bool stdio = (client->write_fd == STDOUT_FILENO);
+	while (client->write_queue_len > 0) {
+		struct iovec iov[64];
+		int iovcnt = 0;
+		for (size_t i = 0; (i < client->write_queue_len) && (iovcnt < (int)LENGTH(iov)); ++i) {
+			struct client_message *message = client_write_queue_at(client, i);
+			size_t offset = (i == 0) ? client->write_offset : 0;
+			iov[iovcnt++] = (struct iovec){
+				.iov_base = &message->writer.data[offset],
+				.iov_len = message->writer.len - offset,
+			};
+		}
+		// MSG_NOSIGNAL: disconnected socket client must not SIGPIPE the whole bar
+		ssize_t written = stdio
+			? writev(client->write_fd, iov, iovcnt)
+			: sendmsg(client->write_fd, &(struct msghdr){
+				.msg_iov = iov,
+				.msg_iovlen = (size_t)iovcnt,
+			}, MSG_NOSIGNAL);
 		if (written == -1) {
 			if (errno == EAGAIN) {
-				poll_fds[1].fd = STDOUT_FILENO;
+				poll_fd->fd = client->write_fd;
+				poll_fd->events |= POLLOUT;
 				break;
 			} else if (errno == EINTR) {
 				continue;
 			} else {
-				abort_(errno, "write: %s", strerror(errno));
+				log_debug("write: %s", strerror(errno));
+				return false;
 			}
 		} else {
-			stdout_buffer_index -= (size_t)written;
-			memmove(stdout_buffer, &stdout_buffer[written], stdout_buffer_index);
-			poll_fds[1].fd = -1;
+			client->write_queued -= (size_t)written;
+			size_t left = (size_t)written;
+			while (left > 0) {
+				struct client_message *message = client_write_queue_at(client, 0);
+				size_t message_left = message->writer.len - client->write_offset;
+				if (left < message_left) {
+					client->write_offset += left;
+					break;
+				}
+				left -= message_left;
+				client->write_offset = 0;
+				client_message_shrink(client, message);
+				client->write_queue_head = (client->write_queue_head + 1) & (client->write_queue_size - 1);
+				client->write_queue_len--;
+			}
+			if (stdio) {
+				poll_fd->fd = -1;
+			} else {
+				poll_fd->events = POLLIN;
+			}
+		}
+	}
+
+	if ((client->write_queue_len == 0)
+			&& (client->write_queue_size > CLIENT_WRITE_QUEUE_MIN_LEN)) {
+		client_write_queue_resize(client, CLIENT_WRITE_QUEUE_MIN_LEN);
+	}
+	if (client->write_queue_len == 0) {
+		client->write_dropping = false;
+	}
+
+	return true;
+}
+
+static void server_socket_accept(void) {
+	int fd = accept(poll_fds[5].fd, NULL, NULL);
+	if (fd == -1) {
+		if ((errno != EAGAIN) && (errno != EINTR)) {
+			log_stderr("accept: %s", strerror(errno));
+		}
+		return;
+	}
+	if ((fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) || (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)) {
+		log_stderr("server socket connection fcntl: %s", strerror(errno));
+		close(fd);
+		return;
+	}
+
+	ptr_array_add(&clients, client_create(fd, fd));
+	poll_fds = realloc(poll_fds, sizeof(struct pollfd) * (poll_fds_len + 1));
+	poll_fds[poll_fds_len++] = (struct pollfd){ .fd = fd, .events = POLLIN };
+
+	log_debug("client %d connected", fd);
+}
+
+static void server_socket_disconnect(size_t client_idx) {
+	assert(client_idx > 0);
+	struct client *client = clients.items[client_idx];
+	log_debug("client %d disconnected", client->read_fd);
+
+	size_t poll_fd_idx = POLL_FDS_FIXED_LEN + client_idx - 1;
+	poll_fds_len--;
+	memmove(&poll_fds[poll_fd_idx], &poll_fds[poll_fd_idx + 1],
+		sizeof(struct pollfd) * (poll_fds_len - poll_fd_idx));
+
+	ptr_array_pop(&clients, client_idx);
+	client_destroy(client);
+}
+
+// fds belong to the connection that sent them, images already used by blocks are kept
+static void image_socket_close(void) {
+	close(poll_fds[4].fd);
+	poll_fds[4].fd = -1;
+	for (size_t i = 0; i < image_fds.len; ++i) {
+		image_fd_free(image_fds.items[i]);
+	}
+	image_fds.len = 0;
+}
+
+static void image_socket_accept(void) {
+	int fd = accept(poll_fds[3].fd, NULL, NULL);
+	if (fd == -1) {
+		if ((errno != EAGAIN) && (errno != EINTR)) {
+			log_stderr("accept: %s", strerror(errno));
+		}
+		return;
+	}
+	if ((fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) || (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)) {
+		log_stderr("image socket connection fcntl: %s", strerror(errno));
+		close(fd);
+		return;
+	}
+
+	// only one client at a time, new connection replaces the old one
+	if (poll_fds[4].fd != -1) {
+		image_socket_close();
+	}
+	poll_fds[4].fd = fd;
+}
+
+static void image_socket_read(void) {
+	for (;;) {
+		char handle[256];
+		union {
+			struct cmsghdr hdr;
+			char buf[CMSG_SPACE(sizeof(int) * 4)];
+		} cmsg_buf;
+		struct iovec iov = {
+			.iov_base = handle,
+			.iov_len = sizeof(handle) - 1,
+		};
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = cmsg_buf.buf,
+			.msg_controllen = sizeof(cmsg_buf.buf),
+		};
+
+		ssize_t len = recvmsg(poll_fds[4].fd, &msg, MSG_CMSG_CLOEXEC);
+		if (len <= 0) {
+			if ((len == -1) && (errno == EINTR)) {
+				continue;
+			}
+			if ((len == 0) || (errno != EAGAIN)) {
+				image_socket_close();
+			}
+			return;
+		}
+
+		int fd = -1;
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+				continue;
+			}
+			size_t fds_len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (size_t i = 0; i < fds_len; ++i) {
+				int f;
+				memcpy(&f, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+				if (fd == -1) {
+					fd = f;
+				} else {
+					close(f);
+				}
+			}
+		}
+
+		if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+			log_stderr("discard truncated image socket message");
+			if (fd != -1) {
+				close(fd);
+			}
+			continue;
+		}
+
+		handle[len] = '\0';
+		log_debug("image socket: %s handle %s", (fd == -1) ? "remove" : "set", handle);
+
+		for (size_t i = 0; i < image_fds.len; ++i) {
+			struct image_fd *image_fd = image_fds.items[i];
+			if (strcmp(image_fd->handle, handle) == 0) {
+				image_fd_free(image_fd);
+				ptr_array_pop(&image_fds, i);
+				break;
+			}
 		}
+
+		if ((fd != -1) && (image_fds.len >= IMAGE_FDS_MAX_LEN)) {
+			log_stderr("image socket: too many fds, rejecting handle %s", handle);
+			close(fd);
+		} else if (fd != -1) {
+			struct image_fd *image_fd = calloc(1, sizeof(struct image_fd));
+			image_fd->handle = strdup(handle);
+			image_fd->fd = fd;
+			ptr_array_add(&image_fds, image_fd);
+		}
+	}
+}
+
+static void pointer_frame(struct seat *seat) {
+	struct pointer *pointer = &seat->pointer;
+	if (pointer->frame.changes == 0) {
+		return;
+	}
+
+	struct client *client = pointer->focus.surface
+		? surface_get_bar(pointer->focus.surface)->client : NULL;
+	if (pointer->frame.left_client && (pointer->frame.left_client != client)) {
+		client_send_pointer(pointer->frame.left_client, seat,
+			SBAR_STATE_EVENTS_MASK_POINTER_MOTION);
+	}
+	if (client) {
+		client_send_pointer(client, seat, pointer->frame.changes);
+	}
+
+	memset(&pointer->button, 0, sizeof(pointer->button));
+	memset(&pointer->scroll, 0, sizeof(pointer->scroll));
+	memset(&pointer->frame, 0, sizeof(pointer->frame));
+}
+
+static void seat_pointer_changed(struct seat *seat, enum sbar_state_events_mask change) {
+	state_touch(&seat->pointer.state_generation);
+	seat->pointer.frame.changes |= change;
+	if (seat->version < WL_POINTER_FRAME_SINCE_VERSION) {
+		// every event is a frame of its own
+		pointer_frame(seat);
 	}
 }
 
@@ -2557,16 +5085,25 @@ static void wl_pointer_enter(void *data, MAYBE_UNUSED struct wl_pointer *wl_poin
 	pointer->focus.x = wl_fixed_to_double(surface_x);
 	pointer->focus.y = wl_fixed_to_double(surface_y);
 
-	send_state(true);
+	seat_pointer_changed(seat, SBAR_STATE_EVENTS_MASK_POINTER_MOTION);
 }
 
 static void wl_pointer_leave(void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer,
 		MAYBE_UNUSED uint32_t serial, MAYBE_UNUSED struct wl_surface *surface) {
 	struct seat *seat = data;
 	struct pointer *pointer = &seat->pointer;
+	if (pointer->focus.surface == NULL) {
+		return;
+	}
 
+	struct client *client = surface_get_bar(pointer->focus.surface)->client;
+	if (pointer->frame.left_client && (pointer->frame.left_client != client)) {
+		pointer_frame(seat);
+	}
+	pointer->frame.left_client = client;
 	memset(&pointer->focus, 0, sizeof(pointer->focus));
-	send_state(true);
+
+	seat_pointer_changed(seat, SBAR_STATE_EVENTS_MASK_POINTER_MOTION);
 }
 
 static void wl_pointer_motion(void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer,
@@ -2580,7 +5117,7 @@ static void wl_pointer_motion(void *data, MAYBE_UNUSED struct wl_pointer *wl_poi
 	pointer->focus.x = wl_fixed_to_double(surface_x);
 	pointer->focus.y = wl_fixed_to_double(surface_y);
 
-	send_state(true);
+	seat_pointer_changed(seat, SBAR_STATE_EVENTS_MASK_POINTER_MOTION);
 }
 
 static void wl_pointer_button(void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer,
@@ -2593,14 +5130,18 @@ static void wl_pointer_button(void *data, MAYBE_UNUSED struct wl_pointer *wl_poi
 
 	assert((state == WL_POINTER_BUTTON_STATE_PRESSED) || (state == WL_POINTER_BUTTON_STATE_RELEASED));
 
+	// only one button per event
+	if (pointer->button.code != 0) {
+		pointer_frame(seat);
+	}
+
 	pointer->button.code = button;
 	pointer->button.state = state;
 	pointer->button.serial = serial;
 
-	send_state(true);
-
 	array_put(&seat->popup_grab.serials, seat->popup_grab.index++, &serial);
-	memset(&pointer->button, 0, sizeof(pointer->button));
+
+	seat_pointer_changed(seat, SBAR_STATE_EVENTS_MASK_POINTER_BUTTON);
 }
 
 static void wl_pointer_axis(void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer,
@@ -2613,12 +5154,31 @@ static void wl_pointer_axis(void *data, MAYBE_UNUSED struct wl_pointer *wl_point
 
 	assert((axis == WL_POINTER_AXIS_VERTICAL_SCROLL) || (axis == WL_POINTER_AXIS_HORIZONTAL_SCROLL));
 
+	// only one axis per event
+	if ((pointer->scroll.vector_length != 0) && (pointer->scroll.axis != axis)) {
+		pointer_frame(seat);
+	}
+
 	pointer->scroll.axis = axis;
-	pointer->scroll.vector_length = value;
+	pointer->scroll.vector_length += value;
 
-	send_state(true);
+	seat_pointer_changed(seat, SBAR_STATE_EVENTS_MASK_POINTER_SCROLL);
+}
 
-	memset(&pointer->scroll, 0, sizeof(pointer->scroll));
+static void wl_pointer_frame(void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer) {
+	pointer_frame(data);
+}
+
+static void wl_pointer_axis_source(MAYBE_UNUSED void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer,
+		MAYBE_UNUSED uint32_t axis_source) {
+}
+
+static void wl_pointer_axis_stop(MAYBE_UNUSED void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer,
+		MAYBE_UNUSED uint32_t time, MAYBE_UNUSED uint32_t axis) {
+}
+
+static void wl_pointer_axis_discrete(MAYBE_UNUSED void *data, MAYBE_UNUSED struct wl_pointer *wl_pointer,
+		MAYBE_UNUSED uint32_t axis, MAYBE_UNUSED int32_t discrete) {
 }
 
 static const struct wl_pointer_listener wl_pointer_listener = {
@@ -2627,6 +5187,10 @@ static const struct wl_pointer_listener wl_pointer_listener = {
 	.motion = wl_pointer_motion,
 	.button = wl_pointer_button,
 	.axis = wl_pointer_axis,
+	.frame = wl_pointer_frame,
+	.axis_source = wl_pointer_axis_source,
+	.axis_stop = wl_pointer_axis_stop,
+	.axis_discrete = wl_pointer_axis_discrete,
 };
 
 static void xdg_wm_base_ping(MAYBE_UNUSED void *data, MAYBE_UNUSED struct xdg_wm_base *xdg_wm_base_,
@@ -2647,7 +5211,8 @@ static void wl_output_geometry(void *data, MAYBE_UNUSED struct wl_output *wl_out
 	struct output *output = data;
 	if (output->transform != (enum wl_output_transform)transform) {
 		output->transform = (enum wl_output_transform)transform;
-		state_dirty = true;
+		state_touch(&output->state_generation);
+		state_dirty |= SBAR_STATE_EVENTS_MASK_OUTPUTS;
 	}
 }
 
@@ -2657,7 +5222,8 @@ static void wl_output_mode(void *data, MAYBE_UNUSED struct wl_output *wl_output,
 	if ((output->width != width) || (output->height != height)) {
 		output->width = width;
 		output->height = height;
-		state_dirty = true;
+		state_touch(&output->state_generation);
+		state_dirty |= SBAR_STATE_EVENTS_MASK_OUTPUTS;
 	}
 }
 
@@ -2671,7 +5237,8 @@ static void wl_output_scale(void *data, MAYBE_UNUSED struct wl_output *wl_output
 	struct output *output = data;
 	if (output->scale != factor) {
 		output->scale = factor;
-		state_dirty = true;
+		state_touch(&output->state_generation);
+		state_dirty |= SBAR_STATE_EVENTS_MASK_OUTPUTS;
 	}
 }
 
@@ -2680,7 +5247,8 @@ static void wl_output_name(void *data, MAYBE_UNUSED struct wl_output *wl_output,
 	struct output *output = data;
 	assert(output->name == NULL);
 	output->name = strdup(name);
-	state_dirty = true;
+	state_touch(&output->state_generation);
+	state_dirty |= SBAR_STATE_EVENTS_MASK_OUTPUTS;
 }
 
 static void wl_output_description(MAYBE_UNUSED void *data, MAYBE_UNUSED struct wl_output *wl_output,
@@ -2712,14 +5280,16 @@ static void wl_seat_capabilities(void *data, MAYBE_UNUSED struct wl_seat *wl_sea
 		}
 		wl_pointer_add_listener(
 			seat->pointer.wl_pointer, &wl_pointer_listener, seat);
-		state_dirty = true;
+		state_touch(&seat->state_generation);
+		state_dirty |= STATE_EVENTS_MASK_SEATS;
 	} else if (!have_pointer && seat->pointer.wl_pointer) {
 		wl_pointer_destroy(seat->pointer.wl_pointer);
 		if (seat->pointer.cursor_shape_device) {
 			wp_cursor_shape_device_v1_destroy(seat->pointer.cursor_shape_device);
 		}
 		memset(&seat->pointer, 0, sizeof(seat->pointer));
-		state_dirty = true;
+		state_touch(&seat->state_generation);
+		state_dirty |= STATE_EVENTS_MASK_SEATS;
 	}
 }
 
@@ -2728,7 +5298,8 @@ static void wl_seat_name(void *data, MAYBE_UNUSED struct wl_seat *wl_seat,
 	struct seat *seat = data;
 	assert(seat->name == NULL);
 	seat->name = strdup(name);
-	state_dirty = true;
+	state_touch(&seat->state_generation);
+	state_dirty |= STATE_EVENTS_MASK_SEATS;
 }
 
 static const struct wl_seat_listener wl_seat_listener = {
@@ -2740,10 +5311,19 @@ static void output_free(struct output *output) {
 		return;
 	}
 
-	for (size_t i = 0; i < output->bars.len; ++i) {
-		bar_destroy(output->bars.items[i]);
+	for (size_t i = 0; i < clients.len; ++i) {
+		struct client *client = clients.items[i];
+		struct client_output *client_output = client_get_output(client, output, false);
+		if (client_output) {
+			client_output_destroy(client_output);
+			for (size_t j = 0; j < client->outputs.len; ++j) {
+				if (client->outputs.items[j] == client_output) {
+					ptr_array_pop(&client->outputs, j);
+					break;
+				}
+			}
+		}
 	}
-	ptr_array_fini(&output->bars);
 
 	if (output->wl_output) {
 		wl_output_destroy(output->wl_output);
@@ -2775,20 +5355,21 @@ static void seat_free(struct seat *seat) {
 }
 
 static void wl_registry_global(MAYBE_UNUSED void *data, MAYBE_UNUSED struct wl_registry *registry,
-		uint32_t name, const char *interface, MAYBE_UNUSED uint32_t version) {
+		uint32_t name, const char *interface, uint32_t version) {
 	if (strcmp(interface, wl_output_interface.name) == 0) {
 		struct output *output = calloc(1, sizeof(struct output));
 		output->wl_output = wl_registry_bind(wl_registry,
 			name, &wl_output_interface, 4);
 		output->wl_name = name;
 		output->scale = 1;
-		ptr_array_init(&output->bars, 4);
 		wl_output_add_listener(output->wl_output, &wl_output_listener, output);
 		ptr_array_add(&outputs, output);
 	} else if (strcmp(interface, wl_seat_interface.name) == 0) {
 		struct seat *seat = calloc(1, sizeof(struct seat));
+		// wl_pointer.frame
+		seat->version = (version < 5) ? version : 5;
 		seat->wl_seat = wl_registry_bind(wl_registry,
-			name, &wl_seat_interface, 2);
+			name, &wl_seat_interface, seat->version);
 		seat->wl_name = name;
 		array_init(&seat->popup_grab.serials, 256, sizeof(uint32_t));
 		wl_seat_add_listener(seat->wl_seat, &wl_seat_listener, seat);
@@ -2819,7 +5400,7 @@ static void wl_registry_global_remove(MAYBE_UNUSED void *data, MAYBE_UNUSED stru
 		if (output->wl_name == name) {
 			output_free(output);
 			ptr_array_pop(&outputs, i);
-			state_dirty = true;
+			state_dirty |= SBAR_STATE_EVENTS_MASK_OUTPUTS;
 			return;
 		}
 	}
@@ -2829,7 +5410,7 @@ static void wl_registry_global_remove(MAYBE_UNUSED void *data, MAYBE_UNUSED stru
 		if (seat->wl_name == name) {
 			seat_free(seat);
 			ptr_array_pop(&seats, i);
-			state_dirty = true;
+			state_dirty |= STATE_EVENTS_MASK_SEATS;
 			return;
 		}
 	}
@@ -2847,7 +5428,44 @@ static const struct sigaction sigact = {
 	.sa_handler = &signal_handler
 };
 
+static int unix_socket_listen(const char *path, int type) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		abort_(ENAMETOOLONG, "%s: socket path is too long", path);
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		abort_(errno, "%s: socket: %s", path, strerror(errno));
+	}
+	// stale socket from a crashed instance is removed, live one is left alone
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		abort_(EADDRINUSE, "%s: socket is already in use", path);
+	}
+	close(fd);
+	unlink(path);
+
+	fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ((fd == -1) || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+			|| (listen(fd, 16) == -1)) {
+		abort_(errno, "%s: socket: %s", path, strerror(errno));
+	}
+
+	return fd;
+}
+
 static void setup(void) {
+	poll_fds_len = POLL_FDS_FIXED_LEN;
+	poll_fds = malloc(sizeof(struct pollfd) * poll_fds_len);
+	poll_fds[0] = (struct pollfd){ .fd = STDIN_FILENO, .events = POLLIN };
+	poll_fds[1] = (struct pollfd){ .fd = -1, .events = POLLOUT }; // stdout
+	poll_fds[2] = (struct pollfd){ .fd = -1, .events = POLLIN }; // wayland
+	poll_fds[3] = (struct pollfd){ .fd = -1, .events = POLLIN }; // image socket
+	poll_fds[4] = (struct pollfd){ .fd = -1, .events = POLLIN }; // image socket connection
+	poll_fds[5] = (struct pollfd){ .fd = -1, .events = POLLIN }; // server socket
+	poll_fds[6] = (struct pollfd){ .fd = -1, .events = POLLIN }; // font worker
+
 	wl_display = wl_display_connect(NULL);
 	if (wl_display == NULL) {
 		abort_(1, "wl_display_connect failed");
@@ -2885,6 +5503,30 @@ static void setup(void) {
 	}
 	fcft_set_scaling_filter(FCFT_SCALING_FILTER_LANCZOS3);
 
+	if (pipe(font_worker.wake_fds) == -1) {
+		abort_(errno, "pipe: %s", strerror(errno));
+	}
+	for (size_t i = 0; i < LENGTH(font_worker.wake_fds); ++i) {
+		if ((fcntl(font_worker.wake_fds[i], F_SETFD, FD_CLOEXEC) == -1)
+				|| (fcntl(font_worker.wake_fds[i], F_SETFL, O_NONBLOCK) == -1)) {
+			abort_(errno, "font worker pipe fcntl: %s", strerror(errno));
+		}
+	}
+	poll_fds[6].fd = font_worker.wake_fds[0];
+	pthread_mutex_init(&font_worker.mutex, NULL);
+	pthread_cond_init(&font_worker.cond, NULL);
+	ptr_array_init(&font_worker.requests, 16);
+	ptr_array_init(&font_worker.results, 16);
+	// signals must interrupt poll() in the main thread
+	sigset_t mask, old_mask;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+	int err = pthread_create(&font_worker.thread, NULL, font_worker_run, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (err != 0) {
+		abort_(err, "pthread_create: %s", strerror(err));
+	}
+
 #if HAVE_SVG
 	resvg_init_log();
 #endif // HAVE_SVG
@@ -2896,32 +5538,63 @@ static void setup(void) {
 		abort_(errno, "STDIN_FILENO O_NONBLOCK fcntl: %s", strerror(errno));
 	}
 
-	stdin_buffer_size = stdout_buffer_size = 4096;
-	stdin_buffer = malloc(stdin_buffer_size);
-	stdout_buffer = malloc(stdout_buffer_size);
+	arena_json_parser_init(&json_parser);
+	ptr_array_init(&clients, 4);
+	ptr_array_add(&clients, client_create(STDIN_FILENO, STDOUT_FILENO));
 
-	ptr_array_init(&blocks_with_id, 100);
 	ptr_array_init(&image_cache, 100);
+	ptr_array_init(&font_cache, 16);
+	list_init(&text_cache.lru);
+	glyph_cache = pixman_glyph_cache_create();
+	array_init(&text_scratch, 256, sizeof(char32_t));
+	ptr_array_init(&image_fds, 16);
+
+	if (image_socket_path) {
+		poll_fds[3].fd = unix_socket_listen(image_socket_path, SOCK_SEQPACKET);
+	}
+	if (server_socket_path) {
+		poll_fds[5].fd = unix_socket_listen(server_socket_path, SOCK_STREAM);
+	}
 
 	sigaction(SIGINT, &sigact, NULL);
 	sigaction(SIGTERM, &sigact, NULL);
 	sigaction(SIGPIPE, &sigact, NULL);
 }
 
+static void stdin_close(void) {
+	// in server mode sbar keeps running for socket clients
+	if (poll_fds[5].fd == -1) {
+		running = false;
+		return;
+	}
+
+	struct client *client = clients.items[0];
+	client_destroy_bars(client);
+	client_clear_write_queue(client);
+	poll_fds[0].fd = -1;
+	poll_fds[1].fd = -1;
+}
+
 static void run(void) {
 	while (running) {
-		if ((poll(poll_fds, LENGTH(poll_fds), -1) == -1) && (errno != EINTR)) {
+		if ((poll(poll_fds, poll_fds_len, -1) == -1) && (errno != EINTR)) {
 			abort_(errno, "poll: %s", strerror(errno));
 		}
 		if (poll_fds[0].revents & POLLHUP) {
-			break;
+			stdin_close();
+			if (!running) {
+				break;
+			}
 		}
 		if (poll_fds[0].revents & (POLLERR | POLLNVAL)) {
 			abort_(poll_fds[0].revents, "stdin poll error");
 		}
 		if (poll_fds[1].fd != -1) {
 			if (poll_fds[1].revents & POLLHUP) {
-				break;
+				stdin_close();
+				if (!running) {
+					break;
+				}
 			}
 			if (poll_fds[1].revents & (POLLERR | POLLNVAL)) {
 				abort_(poll_fds[1].revents, "stdout poll error");
@@ -2930,9 +5603,42 @@ static void run(void) {
 		if (poll_fds[2].revents & (POLLERR | POLLHUP | POLLNVAL)) {
 			abort_(poll_fds[2].revents, "wayland display poll error");
 		}
+		if (poll_fds[3].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			abort_(poll_fds[3].revents, "image socket poll error");
+		}
+		if (poll_fds[5].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			abort_(poll_fds[5].revents, "server socket poll error");
+		}
+		if (poll_fds[6].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			abort_(poll_fds[6].revents, "font worker poll error");
+		}
+
+		if (poll_fds[4].revents & (POLLIN | POLLERR | POLLHUP)) {
+			// pending fds must be registered before state that references them
+			image_socket_read();
+		}
+		if (poll_fds[3].revents & POLLIN) {
+			image_socket_accept();
+		}
+
+		if ((poll_fds[0].fd != -1) && (poll_fds[0].revents & POLLIN)) {
+			if (!client_read(clients.items[0])) {
+				if (poll_fds[5].fd == -1) {
+					abort_(errno, "read: %s", strerror(errno));
+				}
+				stdin_close();
+			}
+		}
 
-		if (poll_fds[0].revents & POLLIN) {
-			read_stdin();
+		for (size_t i = clients.len - 1; i > 0; --i) {
+			struct pollfd *poll_fd = &poll_fds[POLL_FDS_FIXED_LEN + i - 1];
+			if ((poll_fd->revents & (POLLERR | POLLNVAL)) || ((poll_fd->revents & (POLLIN | POLLHUP))
+					&& !client_read(clients.items[i]))) {
+				server_socket_disconnect(i);
+			}
+		}
+		if (poll_fds[5].revents & POLLIN) {
+			server_socket_accept();
 		}
 
 		if (poll_fds[2].revents & POLLIN) {
@@ -2941,8 +5647,22 @@ static void run(void) {
 			}
 		}
 
-		send_state(false);
-		flush_stdout();
+		if (poll_fds[6].revents & POLLIN) {
+			font_worker_read();
+		}
+
+		send_state();
+		if (!client_flush(clients.items[0], &poll_fds[1])) {
+			if (poll_fds[5].fd == -1) {
+				abort_(errno, "write: %s", strerror(errno));
+			}
+			stdin_close();
+		}
+		for (size_t i = clients.len - 1; i > 0; --i) {
+			if (!client_flush(clients.items[i], &poll_fds[POLL_FDS_FIXED_LEN + i - 1])) {
+				server_socket_disconnect(i);
+			}
+		}
 
 		if (wl_display_flush(wl_display) == -1) {
 			if (errno == EAGAIN) {
@@ -2958,6 +5678,29 @@ static void run(void) {
 
 #if DEBUG
 static void cleanup(void) {
+	pthread_mutex_lock(&font_worker.mutex);
+	font_worker.stop = true;
+	pthread_cond_signal(&font_worker.cond);
+	pthread_mutex_unlock(&font_worker.mutex);
+	pthread_join(font_worker.thread, NULL);
+	for (size_t i = 0; i < font_worker.results.len; ++i) {
+		struct font_cache *cache = font_worker.results.items[i];
+		if (cache->resolved) {
+			fcft_destroy(cache->resolved);
+		}
+	}
+	ptr_array_fini(&font_worker.requests);
+	ptr_array_fini(&font_worker.results);
+	pthread_cond_destroy(&font_worker.cond);
+	pthread_mutex_destroy(&font_worker.mutex);
+	close(font_worker.wake_fds[1]); // read end is closed with poll_fds
+
+	for (size_t i = 0; i < clients.len; ++i) {
+		client_destroy(clients.items[i]);
+	}
+	ptr_array_fini(&clients);
+	arena_json_parser_fini(&json_parser);
+
 	for (size_t i = 0; i < outputs.len; ++i) {
 		output_free(outputs.items[i]);
 	}
@@ -2968,13 +5711,35 @@ static void cleanup(void) {
 	}
 	ptr_array_fini(&seats);
 
-	ptr_array_fini(&blocks_with_id);
-
 	for (size_t i = 0; i < image_cache.len; ++i) {
 		free_image_cache(image_cache.items[i]);
 	}
 	ptr_array_fini(&image_cache);
 
+	log_debug("text cache: %llu lookups, %llu misses",
+		(unsigned long long)text_cache.lookups, (unsigned long long)text_cache.misses);
+	struct text_cache *entry, *tmp;
+	list_for_each_safe(entry, tmp, &text_cache.lru, link) {
+		text_cache_remove(entry);
+	}
+
+	log_debug("font cache: %llu lookups, %llu misses, %llu evictions",
+		(unsigned long long)font_cache_stats.lookups,
+		(unsigned long long)font_cache_stats.misses,
+		(unsigned long long)font_cache_stats.evictions);
+	free(prewarm_glyphs);
+	for (size_t i = 0; i < font_cache.len; ++i) {
+		free_font_cache(font_cache.items[i]);
+	}
+	ptr_array_fini(&font_cache);
+	pixman_glyph_cache_destroy(glyph_cache);
+	array_fini(&text_scratch);
+
+	for (size_t i = 0; i < image_fds.len; ++i) {
+		image_fd_free(image_fds.items[i]);
+	}
+	ptr_array_fini(&image_fds);
+
 	fcft_fini();
 
 	if (wp_cursor_shape_manager_v1) {
@@ -2987,23 +5752,64 @@ static void cleanup(void) {
 	wl_registry_destroy(wl_registry);
 	wl_display_disconnect(wl_display);
 
-	json_object_put(state_userdata);
-
-	free(stdin_buffer);
-	free(stdout_buffer);
+	for (size_t i = 3; i < POLL_FDS_FIXED_LEN; ++i) {
+		if (poll_fds[i].fd != -1) {
+			close(poll_fds[i].fd);
+		}
+	}
+	free(poll_fds);
 }
 #endif // DEBUG
 
 int main(int argc, char **argv) {
 	static const struct option long_options[] = {
 		{"version", no_argument, NULL, 'v'},
+		{"image-socket", required_argument, NULL, 's'},
+		{"server", optional_argument, NULL, 'S'},
+		{"write-limit", required_argument, NULL, 'w'},
+		{"prewarm-glyphs", optional_argument, NULL, 'g'},
 		{ 0 },
 	};
 	int c;
-	while ((c = getopt_long(argc, argv, "v", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "vs:S::w:g::", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'v':
 			abort_(0, VERSION);
+		case 's':
+			image_socket_path = optarg;
+			break;
+		case 'S': {
+			const char *xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
+			if ((xdg_runtime_dir == NULL) || (*xdg_runtime_dir == '\0')) {
+				abort_(1, "XDG_RUNTIME_DIR is not set");
+			}
+			const char *name = optarg ? optarg : "sbar.sock";
+			size_t len = strlen(xdg_runtime_dir) + strlen(name) + 2;
+			server_socket_path = malloc(len);
+			snprintf(server_socket_path, len, "%s/%s", xdg_runtime_dir, name);
+			break;
+		}
+		case 'w': {
+			char *end;
+			errno = 0;
+			unsigned long long limit = strtoull(optarg, &end, 10);
+			if ((errno != 0) || (end == optarg) || (*end != '\0')) {
+				abort_(1, "invalid write limit: %s", optarg);
+			}
+			client_write_limit = (size_t)limit;
+			break;
+		}
+		case 'g': {
+			const char *glyphs = optarg ? optarg : "0123456789 .,:;%+-/()[]";
+			size_t len = strlen(glyphs);
+			free(prewarm_glyphs);
+			prewarm_glyphs = malloc(len * sizeof(char32_t));
+			prewarm_glyphs_len = utf8_to_utf32(prewarm_glyphs, glyphs, len);
+			if (prewarm_glyphs_len == SIZE_MAX) {
+				abort_(1, "prewarm glyphs are not valid UTF-8");
+			}
+			break;
+		}
 		default:
 			break;
 		}
@@ -3015,5 +5821,13 @@ int main(int argc, char **argv) {
 	cleanup();
 #endif // DEBUG
 
+	if (image_socket_path) {
+		unlink(image_socket_path);
+	}
+	if (server_socket_path) {
+		unlink(server_socket_path);
+		free(server_socket_path);
+	}
+
 	return EXIT_SUCCESS;
 }
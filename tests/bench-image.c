@@ -0,0 +1,194 @@
+// Decode time of icon sized images with decode_png and decode_qoi, as used by image blocks.
+// Icons are generated: an anti-aliased disc with a gradient on a transparent background.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <pixman.h>
+#include <png.h>
+
+#include "util.h"
+#include "image-decode.h"
+
+#define PIXELS_PER_SIZE (32 * 1024 * 1024) // decoded per format and size
+
+struct buffer {
+	uint8_t *data;
+	size_t len, size;
+};
+
+static void buffer_write(struct buffer *buffer, const void *data, size_t len) {
+	if ((buffer->len + len) > buffer->size) {
+		buffer->size = (buffer->len + len) * 2;
+		buffer->data = realloc(buffer->data, buffer->size);
+	}
+	memcpy(&buffer->data[buffer->len], data, len);
+	buffer->len += len;
+}
+
+// rgba, not premultiplied
+static uint8_t *make_icon(uint32_t size) {
+	uint8_t *rgba = malloc((size_t)size * size * 4);
+	int32_t r2 = (int32_t)(size * size / 4), c = (int32_t)size / 2;
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			uint8_t *p = &rgba[((size_t)y * size + x) * 4];
+			int32_t dx = (int32_t)x - c, dy = (int32_t)y - c;
+			int32_t d = r2 - (dx * dx + dy * dy);
+			p[0] = (uint8_t)(x * 255 / size);
+			p[1] = (uint8_t)(y * 255 / size);
+			p[2] = (uint8_t)(((x / 4) % 2) ? 0xC0 : 0x40);
+			p[3] = (uint8_t)((d <= 0) ? 0 : (d >= (int32_t)size) ? 0xFF : (d * 255 / (int32_t)size));
+		}
+	}
+	return rgba;
+}
+
+static void png_write_buffer(png_structp png, png_bytep data, size_t len) {
+	buffer_write(png_get_io_ptr(png), data, len);
+}
+
+static void png_flush_buffer(MAYBE_UNUSED png_structp png) {
+}
+
+static struct buffer encode_png(const uint8_t *rgba, uint32_t size) {
+	struct buffer buffer = { 0 };
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png_create_info_struct(png);
+	if (setjmp(png_jmpbuf(png))) {
+		abort_(1, "libpng error");
+	}
+	png_set_write_fn(png, &buffer, png_write_buffer, png_flush_buffer);
+	png_set_IHDR(png, info, size, size, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	for (uint32_t y = 0; y < size; ++y) {
+		png_write_row(png, &rgba[(size_t)y * size * 4]);
+	}
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	return buffer;
+}
+
+static void write_be32(struct buffer *buffer, uint32_t v) {
+	uint8_t b[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+	buffer_write(buffer, b, sizeof(b));
+}
+
+static struct buffer encode_qoi(const uint8_t *rgba, uint32_t size) {
+	struct buffer buffer = { 0 };
+	buffer_write(&buffer, "qoif", 4);
+	write_be32(&buffer, size);
+	write_be32(&buffer, size);
+	buffer_write(&buffer, (uint8_t[]){ 4, 0 }, 2);
+
+	uint8_t index[64][4] = { 0 };
+	uint8_t prev[4] = { 0, 0, 0, 0xFF };
+	uint8_t run = 0;
+	for (size_t i = 0, len = (size_t)size * size; i < len; ++i) {
+		const uint8_t *px = &rgba[i * 4];
+		if (memcmp(px, prev, 4) == 0) {
+			if ((++run == 62) || (i == (len - 1))) {
+				buffer_write(&buffer, (uint8_t[]){ (uint8_t)(0xC0 | (run - 1)) }, 1);
+				run = 0;
+			}
+			continue;
+		}
+		if (run > 0) {
+			buffer_write(&buffer, (uint8_t[]){ (uint8_t)(0xC0 | (run - 1)) }, 1);
+			run = 0;
+		}
+		uint8_t hash = (uint8_t)((px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64);
+		if (memcmp(index[hash], px, 4) == 0) {
+			buffer_write(&buffer, &hash, 1);
+		} else {
+			memcpy(index[hash], px, 4);
+			if (px[3] == prev[3]) {
+				int vr = (int8_t)(uint8_t)(px[0] - prev[0]);
+				int vg = (int8_t)(uint8_t)(px[1] - prev[1]);
+				int vb = (int8_t)(uint8_t)(px[2] - prev[2]);
+				int vg_r = vr - vg, vg_b = vb - vg;
+				if ((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) && (vb > -3) && (vb < 2)) {
+					buffer_write(&buffer, (uint8_t[]){
+						(uint8_t)(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)) }, 1);
+				} else if ((vg_r > -9) && (vg_r < 8) && (vg > -33) && (vg < 32)
+						&& (vg_b > -9) && (vg_b < 8)) {
+					buffer_write(&buffer, (uint8_t[]){
+						(uint8_t)(0x80 | (vg + 32)), (uint8_t)((vg_r + 8) << 4 | (vg_b + 8)) }, 2);
+				} else {
+					buffer_write(&buffer, (uint8_t[]){ 0xFE, px[0], px[1], px[2] }, 4);
+				}
+			} else {
+				buffer_write(&buffer, (uint8_t[]){ 0xFF, px[0], px[1], px[2], px[3] }, 5);
+			}
+		}
+		memcpy(prev, px, 4);
+	}
+	buffer_write(&buffer, (uint8_t[]){ 0, 0, 0, 0, 0, 0, 0, 1 }, 8);
+	return buffer;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+	static const uint32_t sizes[] = { 16, 24, 32, 48, 64, 128 };
+	bool ok = true;
+	printf("size   png bytes   qoi bytes   png us/image   qoi us/image\n");
+	for (size_t s = 0; s < LENGTH(sizes); ++s) {
+		uint32_t size = sizes[s];
+		uint8_t *rgba = make_icon(size);
+		struct buffer png = encode_png(rgba, size);
+		struct buffer qoi = encode_qoi(rgba, size);
+		size_t iterations = PIXELS_PER_SIZE / ((size_t)size * size);
+
+		pixman_image_t *png_image = decode_png(NULL,
+			&(struct png_memory){ .data = png.data, .size = png.len }, "png");
+		pixman_image_t *qoi_image = decode_qoi(qoi.data, qoi.len);
+		if ((png_image == NULL) || (qoi_image == NULL) || (memcmp(pixman_image_get_data(png_image),
+				pixman_image_get_data(qoi_image), (size_t)size * size * 4) != 0)) {
+			fprintf(stderr, "%ux%u: decoded images differ\n", size, size);
+			ok = false;
+		}
+		if (png_image) {
+			pixman_image_unref(png_image);
+		}
+		if (qoi_image) {
+			pixman_image_unref(qoi_image);
+		}
+
+		double start = now();
+		for (size_t i = 0; i < iterations; ++i) {
+			pixman_image_t *image = decode_png(NULL,
+				&(struct png_memory){ .data = png.data, .size = png.len }, "png");
+			if (image) {
+				pixman_image_unref(image);
+			}
+		}
+		double png_time = now() - start;
+
+		start = now();
+		for (size_t i = 0; i < iterations; ++i) {
+			pixman_image_t *image = decode_qoi(qoi.data, qoi.len);
+			if (image) {
+				pixman_image_unref(image);
+			}
+		}
+		double qoi_time = now() - start;
+
+		printf("%4u %11zu %11zu %14.2f %14.2f\n", size, png.len, qoi.len,
+			png_time * 1e6 / (double)iterations, qoi_time * 1e6 / (double)iterations);
+
+		free(png.data);
+		free(qoi.data);
+		free(rgba);
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,141 @@
+// Parse time of client messages with json-c, which sbar used before, and with arena_json.
+// Usage: bench-json [capture]
+// capture holds newline-separated messages as sent to sbar, e.g. recorded with
+// `client | tee capture | sbar`. Without it, full states of a 200 block bar and patches
+// changing a few of them are generated.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <json_tokener.h>
+#include <json_object.h>
+
+#include "util.h"
+#include "arena-json.h"
+
+#define ROUNDS 20
+
+static void generate_capture(ptr_array_t *capture) {
+	for (int message = 0; message < 200; ++message) {
+		char *line;
+		if ((message % 10) == 0) {
+			line = fstr_create("{\"userdata\":{\"message\":%d},\"bars\":[{\"output_name\":\"eDP-1\","
+				"\"height\":24,\"blocks\":[", message);
+			for (int block = 0; block < 200; ++block) {
+				char *prev = line;
+				line = fstr_create("%s%s{\"id\":%d,\"type\":2,\"text\":\"block %d: %d%%\","
+					"\"font_names\":[\"monospace:size=12\"],\"text_color\":4294967295,"
+					"\"color\":%d,\"content_width\":-1,\"content_height\":-1,"
+					"\"borders\":[{\"width\":1,\"color\":4278190335}],\"anchor\":%d}",
+					prev, (block > 0) ? "," : "", block + 1, block, (message + block) % 100,
+					0x20202020 + block, block % 3);
+				free(prev);
+			}
+			char *prev = line;
+			line = fstr_create("%s]}]}", prev);
+			free(prev);
+		} else {
+			line = fstr_create("{\"patch\":[{\"op\":1,\"surface_id\":1,\"index\":%d,"
+				"\"block\":{\"text\":\"block %d: %d%%\",\"text_color\":4294901760}}]}",
+				message % 200, message % 200, message);
+		}
+		ptr_array_add(capture, line);
+	}
+}
+
+static void read_capture(ptr_array_t *capture, const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		abort_(1, "%s: fopen failed", path);
+	}
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, f)) != -1) {
+		if (len > 1) {
+			line[len - 1] = '\0';
+			ptr_array_add(capture, strdup(line));
+		}
+	}
+	free(line);
+	fclose(f);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	ptr_array_t capture; // char *
+	ptr_array_init(&capture, 256);
+	if (argc > 1) {
+		read_capture(&capture, argv[1]);
+	} else {
+		generate_capture(&capture);
+	}
+	char **lines = (char **)capture.items;
+	size_t bytes = 0;
+	for (size_t i = 0; i < capture.len; ++i) {
+		bytes += strlen(lines[i]);
+	}
+	if (capture.len == 0) {
+		abort_(1, "no messages");
+	}
+
+	json_tokener *tokener = json_tokener_new();
+	double start = now();
+	size_t json_c_failed = 0, arena_json_failed = 0;
+	for (int round = 0; round < ROUNDS; ++round) {
+		for (size_t i = 0; i < capture.len; ++i) {
+			json_tokener_reset(tokener);
+			json_object *json = json_tokener_parse_ex(tokener, lines[i], (int)strlen(lines[i]));
+			if (json) {
+				json_object_put(json);
+			} else {
+				json_c_failed++;
+			}
+		}
+	}
+	double json_c = now() - start;
+	json_tokener_free(tokener);
+
+	struct arena_json_parser parser;
+	arena_json_parser_init(&parser);
+	arena_t arena;
+	arena_init(&arena, 65536);
+	start = now();
+	for (int round = 0; round < ROUNDS; ++round) {
+		for (size_t i = 0; i < capture.len; ++i) {
+			struct arena_json json;
+			if (!arena_json_parse(&parser, &arena, lines[i], strlen(lines[i]), &json)) {
+				arena_json_failed++;
+			}
+			arena_reset(&arena);
+		}
+	}
+	double arena_json = now() - start;
+	arena_fini(&arena);
+	arena_json_parser_fini(&parser);
+
+	double messages = (double)capture.len * ROUNDS;
+	double mib = (double)bytes * ROUNDS / (1024 * 1024);
+	printf("%zu messages, %zu bytes, %d rounds\n", capture.len, bytes, ROUNDS);
+	printf("json-c:     %8.2f us/message %8.1f MiB/s\n", json_c * 1e6 / messages, mib / json_c);
+	printf("arena_json: %8.2f us/message %8.1f MiB/s\n", arena_json * 1e6 / messages, mib / arena_json);
+	if ((json_c_failed > 0) || (arena_json_failed > 0)) {
+		printf("failed to parse: json-c %zu, arena_json %zu\n", json_c_failed, arena_json_failed);
+	}
+
+	for (size_t i = 0; i < capture.len; ++i) {
+		free(lines[i]);
+	}
+	ptr_array_fini(&capture);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+// utf8_to_utf32 compared with the mbrtoc32 loop it replaced, in a UTF-8 locale.
+// The one expected difference is that code points above U+10FFFF are rejected.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <uchar.h>
+#include <wchar.h>
+#include <locale.h>
+
+#include "util.h"
+
+#define MAX_LEN 64
+
+static size_t mbrtoc32_to_utf32(char32_t *dest, const char *src, size_t len) {
+	mbstate_t ps = { 0 };
+	size_t i = 0, n = 0;
+	while (i < len) {
+		size_t ret = mbrtoc32(&dest[n], &src[i], len - i, &ps);
+		if (ret == 0) {
+			break;
+		}
+		if ((ret == (size_t)-1) || (ret == (size_t)-2) || (ret == (size_t)-3)) {
+			return SIZE_MAX;
+		}
+		i += ret;
+		n++;
+	}
+
+	return n;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15;
+
+static uint32_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (uint32_t)(rng_state >> 32);
+}
+
+// mostly valid text with some broken sequences, so both fast and slow paths are hit
+static size_t random_input(unsigned char *dest) {
+	size_t len = 0, target = rng() % MAX_LEN;
+	while (len < target) {
+		uint32_t kind = rng() % 16;
+		if (kind < 8) { // ascii run
+			for (uint32_t n = rng() % 12; (n > 0) && (len < MAX_LEN); --n) {
+				dest[len++] = (unsigned char)(0x20 + (rng() % 0x5F));
+			}
+		} else if (kind < 12) { // any code point, maybe a surrogate or above U+10FFFF
+			static const uint32_t limits[] = { 0x80, 0x800, 0x10000, 0x110000, 0x200000 };
+			uint32_t cp = rng() % limits[rng() % LENGTH(limits)];
+			unsigned char buf[4];
+			size_t n;
+			if (cp < 0x80) {
+				buf[0] = (unsigned char)cp;
+				n = 1;
+			} else if (cp < 0x800) {
+				buf[0] = (unsigned char)(0xC0 | (cp >> 6));
+				buf[1] = (unsigned char)(0x80 | (cp & 0x3F));
+				n = 2;
+			} else if (cp < 0x10000) {
+				buf[0] = (unsigned char)(0xE0 | (cp >> 12));
+				buf[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+				buf[2] = (unsigned char)(0x80 | (cp & 0x3F));
+				n = 3;
+			} else {
+				buf[0] = (unsigned char)(0xF0 | (cp >> 18));
+				buf[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+				buf[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+				buf[3] = (unsigned char)(0x80 | (cp & 0x3F));
+				n = 4;
+			}
+			for (size_t i = 0; (i < n) && (len < MAX_LEN); ++i) {
+				dest[len++] = buf[i];
+			}
+		} else if (kind < 15) { // random byte: stray continuation, overlong or truncated lead
+			dest[len++] = (unsigned char)rng();
+		} else {
+			dest[len++] = '\0';
+		}
+	}
+
+	return len;
+}
+
+static bool check(const unsigned char *input, size_t len) {
+	char32_t expected[MAX_LEN + 8], got[MAX_LEN + 8];
+	size_t expected_len = mbrtoc32_to_utf32(expected, (const char *)input, len);
+	size_t got_len = utf8_to_utf32(got, (const char *)input, len);
+
+	if (expected_len != SIZE_MAX) {
+		for (size_t i = 0; i < expected_len; ++i) {
+			if (expected[i] > 0x10FFFF) {
+				expected_len = SIZE_MAX;
+				break;
+			}
+		}
+	}
+
+	if ((expected_len == got_len)
+			&& ((got_len == SIZE_MAX) || (memcmp(expected, got, got_len * sizeof(char32_t)) == 0))) {
+		return true;
+	}
+
+	fprintf(stderr, "mismatch for");
+	for (size_t i = 0; i < len; ++i) {
+		fprintf(stderr, " %02x", input[i]);
+	}
+	fprintf(stderr, ": mbrtoc32 %zu, utf8_to_utf32 %zu\n", expected_len, got_len);
+	return false;
+}
+
+int main(void) {
+	if (!setlocale(LC_CTYPE, "C.UTF-8") && !setlocale(LC_CTYPE, "en_US.UTF-8")) {
+		fprintf(stderr, "no UTF-8 locale, skipping\n");
+		return 77;
+	}
+
+	size_t failures = 0;
+
+	// every sequence of up to 3 bytes, and the same after 8 ASCII bytes for the fast path
+	unsigned char input[MAX_LEN + 8];
+	for (size_t prefix = 0; prefix <= 8; prefix += 8) {
+		memset(input, 'a', prefix);
+		for (size_t len = 1; len <= 3; ++len) {
+			for (uint32_t v = 0; v < (1u << (len * 8)); ++v) {
+				for (size_t i = 0; i < len; ++i) {
+					input[prefix + i] = (unsigned char)(v >> ((len - 1 - i) * 8));
+				}
+				if (!check(input, prefix + len) && (++failures > 16)) {
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < 2000000; ++i) {
+		size_t len = random_input(input);
+		if (!check(input, len) && (++failures > 16)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return (failures > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}